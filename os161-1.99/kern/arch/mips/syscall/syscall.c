@@ -108,6 +108,15 @@ syscall(struct trapframe *tf)
 		err = sys___time((userptr_t)tf->tf_a0,
 				 (userptr_t)tf->tf_a1);
 		break;
+
+	    case SYS_futex_wait:
+		err = sys_futex_wait((userptr_t)tf->tf_a0, (int)tf->tf_a1);
+		break;
+
+	    case SYS_futex_wake:
+		err = sys_futex_wake((userptr_t)tf->tf_a0, (int)tf->tf_a1,
+				     &retval);
+		break;
 #if OPT_A2
 	case SYS_fork:
 		err = sys_fork(tf);
@@ -56,6 +56,9 @@
  * The c0_count register increments on every cycle; when the value
  * matches the c0_compare register, the timer interrupt line is
  * asserted. Writing to c0_compare again clears the interrupt.
+ *
+ * System/161 restarts the count when c0_compare is written, so the
+ * value written is the number of cycles from now until the interrupt.
  */
 static
 void
@@ -111,9 +114,10 @@ mainbus_bootstrap(void)
 	autoconf_lamebus(lamebus, 0);
 
 	/*
-	 * Configure the MIPS on-chip timer to interrupt HZ times a second.
+	 * Now that the real-time clock is attached, start the MIPS
+	 * on-chip timer.
 	 */
-	mips_timer_set(CPU_FREQUENCY / HZ);
+	clock_start();
 }
 
 /*
@@ -233,6 +237,27 @@ mainbus_ramsize(void)
 	return lamebus_ramsize();
 }
 
+/*
+ * Set the on-chip timer to go off NSECS from now. Clamp to what the
+ * hardware can do; a zero-length setting would mean 2^32 cycles.
+ */
+#define TIMER_MIN_CYCLES 100
+
+void
+mainbus_settimer(uint64_t nsecs)
+{
+	uint64_t cycles;
+
+	cycles = nsecs * (CPU_FREQUENCY / 1000000) / 1000;
+	if (cycles < TIMER_MIN_CYCLES) {
+		cycles = TIMER_MIN_CYCLES;
+	}
+	if (cycles > 0xffffffff) {
+		cycles = 0xffffffff;
+	}
+	mips_timer_set(cycles);
+}
+
 /*
  * Send IPI.
  */
@@ -268,10 +293,8 @@ mainbus_interrupt(struct trapframe *tf)
 		lamebus_clear_ipi(lamebus, curcpu);
 	}
 	else if (cause & MIPS_TIMER_BIT) {
-		/* Reset the timer (this clears the interrupt) */
-		mips_timer_set(CPU_FREQUENCY / HZ);
-		/* and call hardclock */
-		hardclock();
+		/* clock_interrupt resets the timer, clearing the interrupt */
+		clock_interrupt();
 	}
 	else {
 		panic("Unknown interrupt; cause register is %08x\n", cause);
@@ -38,6 +38,11 @@
 #include <current.h>
 #include <lamebus/lamebus.h>
 
+/* Per-cpu interrupt counts are kept by slot */
+#if LB_NSLOTS > CPU_NIRQSLOTS
+#error "CPU_NIRQSLOTS is too small for LAMEbus"
+#endif
+
 /* Register offsets within each config region */
 #define CFGREG_VID   0    /* Vendor ID */
 #define CFGREG_DID   4    /* Device ID */
@@ -504,6 +509,8 @@ lamebus_interrupt(struct lamebus_softc *lamebus)
 		data = lamebus->ls_devdata[slot];
 		spinlock_release(&lamebus->ls_lock);
 
+		curcpu->c_irqs[slot]++;
+
 		handler(data);
 
 		spinlock_acquire(&lamebus->ls_lock);
@@ -46,8 +46,6 @@
 #define LT_REG_COUNT  16    /* Time for countdown timer (usec) */
 #define LT_REG_SPKR   20    /* Beep control */
 
-static bool havetimerclock;
-
 /*
  * Setup routine called by autoconf stuff when an ltimer is found.
  */
@@ -76,25 +74,14 @@ config_ltimer(struct ltimer_softc *lt, int ltimerno)
 	 *
 	 * Note that the beep and rtclock devices *do* attach to
 	 * ltimer.
+	 *
+	 * We don't use the countdown timer for timed sleeps either;
+	 * those are timeouts on the per-cpu timer wheels in clock.c,
+	 * which run off the on-chip timer.
 	 */
 	(void)ltimerno;
 	lt->lt_hardclock = 0;
 
-	/*
-	 * We do, however, use ltimer for the timer clock, since the
-	 * on-chip timer can't do that.
-	 */
-	if (!havetimerclock) {
-		havetimerclock = true;
-		lt->lt_timerclock = 1;
-
-		/* Wire it to go off once every 10 ms */
-		/* KMS: reduced this from 1s to 10ms */
-		bus_write_register(lt->lt_bus, lt->lt_buspos, LT_REG_ROE, 1);
-		bus_write_register(lt->lt_bus, lt->lt_buspos, LT_REG_COUNT,
-				   LT_GRANULARITY);
-	}
-	
 	return 0;
 }
 
@@ -116,12 +103,6 @@ ltimer_irq(void *vlt)
 		if (lt->lt_hardclock) {
 			hardclock();
 		}
-		/*
-		 * Likewise for timerclock.
-		 */
-		if (lt->lt_timerclock) {
-			timerclock();
-		}
 	}
 }
 
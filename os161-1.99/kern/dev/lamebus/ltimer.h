@@ -36,7 +36,6 @@
 struct ltimer_softc {
 	/* Initialized by config function */
 	int lt_hardclock;        /* true if we should call hardclock() */
-	int lt_timerclock;        /* true if we should call timerclock() */
 
 	/* Initialized by lower-level attach routine */
 	void *lt_bus;		/* bus we're on */
@@ -44,7 +43,7 @@ struct ltimer_softc {
 	
 };
 
-/* Granularity of countdown timer (usec) */
+/* Length of a clocknap() tick (usec) */
 /* Should be less than 1000000 */
 #define LT_GRANULARITY   10000
 
@@ -39,6 +39,7 @@
 #include <array.h>
 #include <bitmap.h>
 #include <uio.h>
+#include <synch.h>
 #include <vfs.h>
 #include <device.h>
 #include <sfs.h>
@@ -111,6 +112,7 @@ int
 sfs_sync(struct fs *fs)
 {
 	struct sfs_fs *sfs; 
+	struct vnode **vns;
 	unsigned i, num;
 	int result;
 
@@ -148,17 +150,38 @@ sfs_sync(struct fs *fs)
 
 	sfs = fs->fs_data;
 
-	/* Go over the array of loaded vnodes, syncing as we go. */
+	/*
+	 * Take a snapshot of the loaded vnodes, with a reference to
+	 * each, and sync them. VOP_FSYNC takes the vnode's lock, which
+	 * comes before sfs_vnlock, so we can't sync them in place.
+	 */
+	lock_acquire(sfs->sfs_vnlock);
 	num = vnodearray_num(sfs->sfs_vnodes);
+	vns = kmalloc((num > 0 ? num : 1) * sizeof(struct vnode *));
+	if (vns == NULL) {
+		lock_release(sfs->sfs_vnlock);
+		vfs_biglock_release();
+		return ENOMEM;
+	}
 	for (i=0; i<num; i++) {
-		struct vnode *v = vnodearray_get(sfs->sfs_vnodes, i);
-		VOP_FSYNC(v);
+		vns[i] = vnodearray_get(sfs->sfs_vnodes, i);
+		VOP_INCREF(vns[i]);
 	}
+	lock_release(sfs->sfs_vnlock);
+
+	for (i=0; i<num; i++) {
+		VOP_FSYNC(vns[i]);
+		VOP_DECREF(vns[i]);
+	}
+	kfree(vns);
+
+	lock_acquire(sfs->sfs_freemaplock);
 
 	/* If the free block map needs to be written, write it. */
 	if (sfs->sfs_freemapdirty) {
 		result = sfs_mapio(sfs, UIO_WRITE);
 		if (result) {
+			lock_release(sfs->sfs_freemaplock);
 			vfs_biglock_release();
 			return result;
 		}
@@ -169,12 +192,14 @@ sfs_sync(struct fs *fs)
 	if (sfs->sfs_superdirty) {
 		result = sfs_wblock(sfs, &sfs->sfs_super, SFS_SB_LOCATION);
 		if (result) {
+			lock_release(sfs->sfs_freemaplock);
 			vfs_biglock_release();
 			return result;
 		}
 		sfs->sfs_superdirty = false;
 	}
 
+	lock_release(sfs->sfs_freemaplock);
 	vfs_biglock_release();
 	return 0;
 }
@@ -189,13 +214,9 @@ const char *
 sfs_getvolname(struct fs *fs)
 {
 	struct sfs_fs *sfs = fs->fs_data;
-	const char *ret;
-
-	vfs_biglock_acquire();
-	ret = sfs->sfs_super.sp_volname;
-	vfs_biglock_release();
 
-	return ret;
+	/* The volume name doesn't change after mount; no lock needed. */
+	return sfs->sfs_super.sp_volname;
 }
 
 /*
@@ -210,12 +231,19 @@ sfs_unmount(struct fs *fs)
 	struct sfs_fs *sfs = fs->fs_data;
 
 	vfs_biglock_acquire();
+	lock_acquire(sfs->sfs_vnlock);
 	
-	/* Do we have any files open? If so, can't unmount. */
+	/*
+	 * Do we have any files open? If so, can't unmount. If not,
+	 * nothing can load one, because the VFS layer holds its device
+	 * list lock and that's the only way in to us without a vnode.
+	 */
 	if (vnodearray_num(sfs->sfs_vnodes) > 0) {
+		lock_release(sfs->sfs_vnlock);
 		vfs_biglock_release();
 		return EBUSY;
 	}
+	lock_release(sfs->sfs_vnlock);
 
 	/* We should have just had sfs_sync called. */
 	KASSERT(sfs->sfs_superdirty == false);
@@ -224,6 +252,8 @@ sfs_unmount(struct fs *fs)
 	/* Once we start nuking stuff we can't fail. */
 	vnodearray_destroy(sfs->sfs_vnodes);
 	bitmap_destroy(sfs->sfs_freemap);
+	lock_destroy(sfs->sfs_vnlock);
+	lock_destroy(sfs->sfs_freemaplock);
 	
 	/* The vfs layer takes care of the device for us */
 	(void)sfs->sfs_device;
@@ -297,12 +327,31 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 		return ENOMEM;
 	}
 
+	/* Create locks */
+	sfs->sfs_vnlock = lock_create("sfs_vnlock");
+	if (sfs->sfs_vnlock == NULL) {
+		vnodearray_destroy(sfs->sfs_vnodes);
+		kfree(sfs);
+		vfs_biglock_release();
+		return ENOMEM;
+	}
+	sfs->sfs_freemaplock = lock_create("sfs_freemaplock");
+	if (sfs->sfs_freemaplock == NULL) {
+		lock_destroy(sfs->sfs_vnlock);
+		vnodearray_destroy(sfs->sfs_vnodes);
+		kfree(sfs);
+		vfs_biglock_release();
+		return ENOMEM;
+	}
+
 	/* Set the device so we can use sfs_rblock() */
 	sfs->sfs_device = dev;
 
 	/* Load superblock */
 	result = sfs_rblock(sfs, &sfs->sfs_super, SFS_SB_LOCATION);
 	if (result) {
+		lock_destroy(sfs->sfs_freemaplock);
+		lock_destroy(sfs->sfs_vnlock);
 		vnodearray_destroy(sfs->sfs_vnodes);
 		kfree(sfs);
 		vfs_biglock_release();
@@ -316,6 +365,8 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 			"(0x%x, should be 0x%x)\n", 
 			sfs->sfs_super.sp_magic,
 			SFS_MAGIC);
+		lock_destroy(sfs->sfs_freemaplock);
+		lock_destroy(sfs->sfs_vnlock);
 		vnodearray_destroy(sfs->sfs_vnodes);
 		kfree(sfs);
 		vfs_biglock_release();
@@ -333,6 +384,8 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	/* Load free space bitmap */
 	sfs->sfs_freemap = bitmap_create(SFS_FS_BITMAPSIZE(sfs));
 	if (sfs->sfs_freemap == NULL) {
+		lock_destroy(sfs->sfs_freemaplock);
+		lock_destroy(sfs->sfs_vnlock);
 		vnodearray_destroy(sfs->sfs_vnodes);
 		kfree(sfs);
 		vfs_biglock_release();
@@ -341,6 +394,8 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	result = sfs_mapio(sfs, UIO_READ);
 	if (result) {
 		bitmap_destroy(sfs->sfs_freemap);
+		lock_destroy(sfs->sfs_freemaplock);
+		lock_destroy(sfs->sfs_vnlock);
 		vnodearray_destroy(sfs->sfs_vnodes);
 		kfree(sfs);
 		vfs_biglock_release();
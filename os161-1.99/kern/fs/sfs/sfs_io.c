@@ -50,7 +50,9 @@ sfs_rwblock(struct sfs_fs *sfs, struct uio *uio)
 	int result;
 	int tries=0;
 
+#if OPT_VFSBIGLOCK
 	KASSERT(vfs_biglock_do_i_hold());
+#endif
 
 	DEBUG(DB_SFS, "sfs: %s %llu\n", 
 	      uio->uio_rw == UIO_READ ? "read" : "write",
@@ -49,6 +49,9 @@
 static int sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int type,
 			 struct sfs_vnode **ret);
 
+/* Below, with sfs_truncate */
+static int sfs_dotruncate(struct sfs_vnode *sv, off_t len);
+
 ////////////////////////////////////////////////////////////
 //
 // Simple stuff
@@ -68,6 +71,8 @@ static
 int
 sfs_sync_inode(struct sfs_vnode *sv)
 {
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+
 	if (sv->sv_dirty) {
 		struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
 		int result = sfs_wblock(sfs, &sv->sv_i, sv->sv_ino);
@@ -92,11 +97,14 @@ sfs_balloc(struct sfs_fs *sfs, uint32_t *diskblock)
 {
 	int result;
 
+	lock_acquire(sfs->sfs_freemaplock);
 	result = bitmap_alloc(sfs->sfs_freemap, diskblock);
 	if (result) {
+		lock_release(sfs->sfs_freemaplock);
 		return result;
 	}
 	sfs->sfs_freemapdirty = true;
+	lock_release(sfs->sfs_freemaplock);
 
 	if (*diskblock >= sfs->sfs_super.sp_nblocks) {
 		panic("sfs: balloc: invalid block %u\n", *diskblock);
@@ -113,8 +121,10 @@ static
 void
 sfs_bfree(struct sfs_fs *sfs, uint32_t diskblock)
 {
+	lock_acquire(sfs->sfs_freemaplock);
 	bitmap_unmark(sfs->sfs_freemap, diskblock);
 	sfs->sfs_freemapdirty = true;
+	lock_release(sfs->sfs_freemaplock);
 }
 
 /*
@@ -124,11 +134,16 @@ static
 int
 sfs_bused(struct sfs_fs *sfs, uint32_t diskblock)
 {
+	int ret;
+
 	if (diskblock >= sfs->sfs_super.sp_nblocks) {
 		panic("sfs: sfs_bused called on out of range block %u\n", 
 		      diskblock);
 	}
-	return bitmap_isset(sfs->sfs_freemap, diskblock);
+	lock_acquire(sfs->sfs_freemaplock);
+	ret = bitmap_isset(sfs->sfs_freemap, diskblock);
+	lock_release(sfs->sfs_freemaplock);
+	return ret;
 }
 
 ////////////////////////////////////////////////////////////
@@ -140,28 +155,22 @@ sfs_bused(struct sfs_fs *sfs, uint32_t diskblock)
  * the disk) given a file and the logical block number within that
  * file. If DOALLOC is set, and no such block exists, one will be
  * allocated.
+ *
+ * Must hold sv->sv_lock.
  */
 static
 int
 sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, int doalloc,
 	 uint32_t *diskblock)
 {
-	/*
-	 * I/O buffer for handling indirect blocks.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static uint32_t idbuf[SFS_DBPERIDB];
-
 	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	uint32_t *idbuf;
 	uint32_t block;
 	uint32_t idblock;
 	uint32_t idnum, idoff;
 	int result;
 
-	KASSERT(sizeof(idbuf)==SFS_BLOCKSIZE);
+	KASSERT(lock_do_i_hold(sv->sv_lock));
 
 	/*
 	 * If the block we want is one of the direct blocks...
@@ -229,7 +238,17 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, int doalloc,
 		*diskblock = 0;
 		return 0;
 	}
-	else if (idblock==0) {
+
+	/*
+	 * I/O buffer for handling the indirect block. In real life
+	 * this would come from the disk buffer cache.
+	 */
+	idbuf = kmalloc(SFS_BLOCKSIZE);
+	if (idbuf == NULL) {
+		return ENOMEM;
+	}
+
+	if (idblock==0) {
 		/*
 		 * There's no indirect block allocated, but we need to
 		 * allocate a block whose number needs to be stored in
@@ -238,7 +257,7 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, int doalloc,
 		 */
 		result = sfs_balloc(sfs, &idblock);
 		if (result) {
-			return result;
+			goto out;
 		}
 
 		/* Remember the block we just allocated */
@@ -248,7 +267,7 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, int doalloc,
 		sv->sv_dirty = true;
 
 		/* Clear the indirect block buffer */
-		bzero(idbuf, sizeof(idbuf));
+		bzero(idbuf, SFS_BLOCKSIZE);
 	}
 	else {
 		/*
@@ -256,7 +275,7 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, int doalloc,
 		 */
 		result = sfs_rblock(sfs, idbuf, idblock);
 		if (result) {
-			return result;
+			goto out;
 		}
 	}
 
@@ -267,7 +286,7 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, int doalloc,
 	if (block==0 && doalloc) {
 		result = sfs_balloc(sfs, &block);
 		if (result) {
-			return result;
+			goto out;
 		}
 
 		/* Remember the block we allocated */
@@ -276,7 +295,7 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, int doalloc,
 		/* The indirect block is now dirty; write it back */
 		result = sfs_wblock(sfs, idbuf, idblock);
 		if (result) {
-			return result;
+			goto out;
 		}
 	}
 
@@ -286,7 +305,11 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, int doalloc,
 		      block, fileblock, sv->sv_ino);
 	}
 	*diskblock = block;
-	return 0;
+	result = 0;
+
+ out:
+	kfree(idbuf);
+	return result;
 }
 
 ////////////////////////////////////////////////////////////
@@ -308,16 +331,8 @@ int
 sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	      uint32_t skipstart, uint32_t len)
 {
-	/*
-	 * I/O buffer for handling partial sectors.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static char iobuf[SFS_BLOCKSIZE];
-
 	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	char *iobuf;
 	uint32_t diskblock;
 	uint32_t fileblock;
 	int result;
@@ -336,13 +351,23 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 		return result;
 	}
 
+	/*
+	 * I/O buffer for handling partial sectors. This is per-call
+	 * so that I/O on different files can proceed at once; in real
+	 * life it would come from the disk buffer cache.
+	 */
+	iobuf = kmalloc(SFS_BLOCKSIZE);
+	if (iobuf == NULL) {
+		return ENOMEM;
+	}
+
 	if (diskblock == 0) {
 		/*
 		 * There was no block mapped at this point in the file.
 		 * Zero the buffer.
 		 */
 		KASSERT(uio->uio_rw == UIO_READ);
-		bzero(iobuf, sizeof(iobuf));
+		bzero(iobuf, SFS_BLOCKSIZE);
 	}
 	else {
 		/*
@@ -350,7 +375,7 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 		 */
 		result = sfs_rblock(sfs, iobuf, diskblock);
 		if (result) {
-			return result;
+			goto out;
 		}
 	}
 
@@ -359,7 +384,7 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	 */
 	result = uiomove(iobuf+skipstart, len, uio);
 	if (result) {
-		return result;
+		goto out;
 	}
 
 	/*
@@ -368,11 +393,13 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	if (uio->uio_rw == UIO_WRITE) {
 		result = sfs_wblock(sfs, iobuf, diskblock);
 		if (result) {
-			return result;
+			goto out;
 		}
 	}
 
-	return 0;
+ out:
+	kfree(iobuf);
+	return result;
 }
 
 /*
@@ -442,6 +469,7 @@ sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 
 /*
  * Do I/O of a whole region of data, whether or not it's block-aligned.
+ * Must hold sv->sv_lock.
  */
 static
 int
@@ -452,6 +480,8 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 	int result = 0;
 	uint32_t extraresid = 0;
 
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+
 	/*
 	 * If reading, check for EOF. If we can read a partial area,
 	 * remember how much extra there was in EXTRARESID so we can
@@ -752,7 +782,7 @@ sfs_dir_unlink(struct sfs_vnode *sv, int slot)
 
 /*
  * Look for a name in a directory and hand back a vnode for the
- * file, if there is one.
+ * file, if there is one. Must hold the directory's sv_lock.
  */
 static
 int
@@ -894,26 +924,36 @@ sfs_reclaim(struct vnode *v)
 	int result;
 
 	vfs_biglock_acquire();
+	lock_acquire(sv->sv_lock);
+	lock_acquire(sfs->sfs_vnlock);
 
 	/*
 	 * Make sure someone else hasn't picked up the vnode since the
-	 * decision was made to reclaim it. (You must also synchronize
-	 * this with sfs_loadvnode.)
+	 * decision was made to reclaim it. sfs_loadvnode only hands
+	 * out references while holding sfs_vnlock, so once we have it
+	 * the count can't go up behind our back.
 	 */
+	spinlock_acquire(&v->vn_countlock);
 	if (v->vn_refcount != 1) {
 
 		/* consume the reference VOP_DECREF gave us */
 		KASSERT(v->vn_refcount>1);
 		v->vn_refcount--;
 
+		spinlock_release(&v->vn_countlock);
+		lock_release(sfs->sfs_vnlock);
+		lock_release(sv->sv_lock);
 		vfs_biglock_release();
 		return EBUSY;
 	}
+	spinlock_release(&v->vn_countlock);
 
 	/* If there are no on-disk references to the file either, erase it. */
 	if (sv->sv_i.sfi_linkcount==0) {
-		result = VOP_TRUNCATE(&sv->sv_v, 0);
+		result = sfs_dotruncate(sv, 0);
 		if (result) {
+			lock_release(sfs->sfs_vnlock);
+			lock_release(sv->sv_lock);
 			vfs_biglock_release();
 			return result;
 		}
@@ -922,6 +962,8 @@ sfs_reclaim(struct vnode *v)
 	/* Sync the inode to disk */
 	result = sfs_sync_inode(sv);
 	if (result) {
+		lock_release(sfs->sfs_vnlock);
+		lock_release(sv->sv_lock);
 		vfs_biglock_release();
 		return result;
 	}
@@ -948,6 +990,11 @@ sfs_reclaim(struct vnode *v)
 	}
 	vnodearray_remove(sfs->sfs_vnodes, ix);
 
+	/* Nobody else can find it now, so the lock can go too. */
+	lock_release(sfs->sfs_vnlock);
+	lock_release(sv->sv_lock);
+	lock_destroy(sv->sv_lock);
+
 	VOP_CLEANUP(&sv->sv_v);
 
 	vfs_biglock_release();
@@ -972,7 +1019,9 @@ sfs_read(struct vnode *v, struct uio *uio)
 	KASSERT(uio->uio_rw==UIO_READ);
 
 	vfs_biglock_acquire();
+	lock_acquire(sv->sv_lock);
 	result = sfs_io(sv, uio);
+	lock_release(sv->sv_lock);
 	vfs_biglock_release();
 
 	return result;
@@ -991,7 +1040,9 @@ sfs_write(struct vnode *v, struct uio *uio)
 	KASSERT(uio->uio_rw==UIO_WRITE);
 
 	vfs_biglock_acquire();
+	lock_acquire(sv->sv_lock);
 	result = sfs_io(sv, uio);
+	lock_release(sv->sv_lock);
 	vfs_biglock_release();
 
 	return result;
@@ -1033,7 +1084,9 @@ sfs_stat(struct vnode *v, struct stat *statbuf)
 		return result;
 	}
 
+	lock_acquire(sv->sv_lock);
 	statbuf->st_size = sv->sv_i.sfi_size;
+	lock_release(sv->sv_lock);
 
 	/* We don't support these yet; you get to implement them */
 	statbuf->st_nlink = 0;
@@ -1045,7 +1098,8 @@ sfs_stat(struct vnode *v, struct stat *statbuf)
 }
 
 /*
- * Return the type of the file (types as per kern/stat.h)
+ * Return the type of the file (types as per kern/stat.h). The type
+ * never changes once the vnode is loaded, so this needs no sv_lock.
  */
 static
 int
@@ -1103,7 +1157,9 @@ sfs_fsync(struct vnode *v)
 	int result;
 
 	vfs_biglock_acquire();
+	lock_acquire(sv->sv_lock);
 	result = sfs_sync_inode(sv);
+	lock_release(sv->sv_lock);
 	vfs_biglock_release();
 
 	return result;
@@ -1121,23 +1177,15 @@ sfs_mmap(struct vnode *v   /* add stuff as needed */)
 }
 
 /*
- * Called for ftruncate() and from sfs_reclaim.
+ * Truncate a file. Must hold sv->sv_lock. Called from sfs_truncate
+ * and sfs_reclaim.
  */
 static
 int
-sfs_truncate(struct vnode *v, off_t len)
+sfs_dotruncate(struct sfs_vnode *sv, off_t len)
 {
-	/*
-	 * I/O buffer for handling the indirect block.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static uint32_t idbuf[SFS_DBPERIDB];
-
-	struct sfs_vnode *sv = v->vn_data;
 	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	uint32_t *idbuf;
 
 	/* Length in blocks (divide rounding up) */
 	uint32_t blocklen = DIVROUNDUP(len, SFS_BLOCKSIZE);
@@ -1147,9 +1195,7 @@ sfs_truncate(struct vnode *v, off_t len)
 	int result;
 	int hasnonzero, iddirty;
 
-	KASSERT(sizeof(idbuf)==SFS_BLOCKSIZE);
-
-	vfs_biglock_acquire();
+	KASSERT(lock_do_i_hold(sv->sv_lock));
 
 	/*
 	 * Go through the direct blocks. Discard any that are
@@ -1176,10 +1222,16 @@ sfs_truncate(struct vnode *v, off_t len)
 	if (blocklen < highblock && idblock != 0) {
 		/* We're past the proposed EOF; may need to free stuff */
 
+		/* I/O buffer for the indirect block; see sfs_bmap. */
+		idbuf = kmalloc(SFS_BLOCKSIZE);
+		if (idbuf == NULL) {
+			return ENOMEM;
+		}
+
 		/* Read the indirect block */
 		result = sfs_rblock(sfs, idbuf, idblock);
 		if (result) {
-			vfs_biglock_release();
+			kfree(idbuf);
 			return result;
 		}
 		
@@ -1208,10 +1260,11 @@ sfs_truncate(struct vnode *v, off_t len)
 			/* The indirect block is dirty; write it back */
 			result = sfs_wblock(sfs, idbuf, idblock);
 			if (result) {
-				vfs_biglock_release();
+				kfree(idbuf);
 				return result;
 			}
 		}
+		kfree(idbuf);
 	}
 
 	/* Set the file size */
@@ -1220,10 +1273,28 @@ sfs_truncate(struct vnode *v, off_t len)
 	/* Mark the inode dirty */
 	sv->sv_dirty = true;
 
-	vfs_biglock_release();
 	return 0;
 }
 
+/*
+ * Called for ftruncate().
+ */
+static
+int
+sfs_truncate(struct vnode *v, off_t len)
+{
+	struct sfs_vnode *sv = v->vn_data;
+	int result;
+
+	vfs_biglock_acquire();
+	lock_acquire(sv->sv_lock);
+	result = sfs_dotruncate(sv, len);
+	lock_release(sv->sv_lock);
+	vfs_biglock_release();
+
+	return result;
+}
+
 /*
  * Get the full pathname for a file. This only needs to work on directories.
  * Since we don't support subdirectories, assume it's the root directory
@@ -1260,16 +1331,19 @@ sfs_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
 	int result;
 
 	vfs_biglock_acquire();
+	lock_acquire(sv->sv_lock);
 
 	/* Look up the name */
 	result = sfs_dir_findname(sv, name, &ino, NULL, NULL);
 	if (result!=0 && result!=ENOENT) {
+		lock_release(sv->sv_lock);
 		vfs_biglock_release();
 		return result;
 	}
 
 	/* If it exists and we didn't want it to, fail */
 	if (result==0 && excl) {
+		lock_release(sv->sv_lock);
 		vfs_biglock_release();
 		return EEXIST;
 	}
@@ -1278,10 +1352,12 @@ sfs_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
 		/* We got a file; load its vnode and return */
 		result = sfs_loadvnode(sfs, ino, SFS_TYPE_INVAL, &newguy);
 		if (result) {
+			lock_release(sv->sv_lock);
 			vfs_biglock_release();
 			return result;
 		}
 		*ret = &newguy->sv_v;
+		lock_release(sv->sv_lock);
 		vfs_biglock_release();
 		return 0;
 	}
@@ -1289,6 +1365,7 @@ sfs_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
 	/* Didn't exist - create it */
 	result = sfs_makeobj(sfs, SFS_TYPE_FILE, &newguy);
 	if (result) {
+		lock_release(sv->sv_lock);
 		vfs_biglock_release();
 		return result;
 	}
@@ -1299,19 +1376,23 @@ sfs_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
 	/* Link it into the directory */
 	result = sfs_dir_link(sv, name, newguy->sv_ino, NULL);
 	if (result) {
+		lock_release(sv->sv_lock);
 		VOP_DECREF(&newguy->sv_v);
 		vfs_biglock_release();
 		return result;
 	}
 
 	/* Update the linkcount of the new file */
+	lock_acquire(newguy->sv_lock);
 	newguy->sv_i.sfi_linkcount++;
 
 	/* and consequently mark it dirty. */
 	newguy->sv_dirty = true;
+	lock_release(newguy->sv_lock);
 
 	*ret = &newguy->sv_v;
 	
+	lock_release(sv->sv_lock);
 	vfs_biglock_release();
 	return 0;
 }
@@ -1332,18 +1413,27 @@ sfs_link(struct vnode *dir, const char *name, struct vnode *file)
 	KASSERT(file->vn_fs == dir->vn_fs);
 
 	vfs_biglock_acquire();
+	lock_acquire(sv->sv_lock);
 
 	/* Just create a link */
 	result = sfs_dir_link(sv, name, f->sv_ino, NULL);
 	if (result) {
+		lock_release(sv->sv_lock);
 		vfs_biglock_release();
 		return result;
 	}
 
 	/* and update the link count, marking the inode dirty */
+	if (f != sv) {
+		lock_acquire(f->sv_lock);
+	}
 	f->sv_i.sfi_linkcount++;
 	f->sv_dirty = true;
+	if (f != sv) {
+		lock_release(f->sv_lock);
+	}
 
+	lock_release(sv->sv_lock);
 	vfs_biglock_release();
 	return 0;
 }
@@ -1361,10 +1451,12 @@ sfs_remove(struct vnode *dir, const char *name)
 	int result;
 
 	vfs_biglock_acquire();
+	lock_acquire(sv->sv_lock);
 
 	/* Look for the file and fetch a vnode for it. */
 	result = sfs_lookonce(sv, name, &victim, &slot);
 	if (result) {
+		lock_release(sv->sv_lock);
 		vfs_biglock_release();
 		return result;
 	}
@@ -1373,11 +1465,15 @@ sfs_remove(struct vnode *dir, const char *name)
 	result = sfs_dir_unlink(sv, slot);
 	if (result==0) {
 		/* If we succeeded, decrement the link count. */
+		lock_acquire(victim->sv_lock);
 		KASSERT(victim->sv_i.sfi_linkcount > 0);
 		victim->sv_i.sfi_linkcount--;
 		victim->sv_dirty = true;
+		lock_release(victim->sv_lock);
 	}
 
+	lock_release(sv->sv_lock);
+
 	/* Discard the reference that sfs_lookonce got us */
 	VOP_DECREF(&victim->sv_v);
 
@@ -1406,9 +1502,12 @@ sfs_rename(struct vnode *d1, const char *n1,
 	KASSERT(d1==d2);
 	KASSERT(sv->sv_ino == SFS_ROOT_LOCATION);
 
+	lock_acquire(sv->sv_lock);
+
 	/* Look up the old name of the file and get its inode and slot number*/
 	result = sfs_lookonce(sv, n1, &g1, &slot1);
 	if (result) {
+		lock_release(sv->sv_lock);
 		vfs_biglock_release();
 		return result;
 	}
@@ -1430,8 +1529,10 @@ sfs_rename(struct vnode *d1, const char *n1,
 	}
 	
 	/* Increment the link count, and mark inode dirty */
+	lock_acquire(g1->sv_lock);
 	g1->sv_i.sfi_linkcount++;
 	g1->sv_dirty = true;
+	lock_release(g1->sv_lock);
 
 	/* Unlink the old slot */
 	result = sfs_dir_unlink(sv, slot1);
@@ -1443,9 +1544,13 @@ sfs_rename(struct vnode *d1, const char *n1,
 	 * Decrement the link count again, and mark the inode dirty again,
 	 * in case it's been synced behind our back.
 	 */
+	lock_acquire(g1->sv_lock);
 	KASSERT(g1->sv_i.sfi_linkcount>0);
 	g1->sv_i.sfi_linkcount--;
 	g1->sv_dirty = true;
+	lock_release(g1->sv_lock);
+
+	lock_release(sv->sv_lock);
 
 	/* Let go of the reference to g1 */
 	VOP_DECREF(&g1->sv_v);
@@ -1464,8 +1569,11 @@ sfs_rename(struct vnode *d1, const char *n1,
 			strerror(result2));
 		panic("sfs: rename: Cannot recover\n");
 	}
+	lock_acquire(g1->sv_lock);
 	g1->sv_i.sfi_linkcount--;
+	lock_release(g1->sv_lock);
  puke:
+	lock_release(sv->sv_lock);
 	/* Let go of the reference to g1 */
 	VOP_DECREF(&g1->sv_v);
 	vfs_biglock_release();
@@ -1527,7 +1635,9 @@ sfs_lookup(struct vnode *v, char *path, struct vnode **ret)
 		return ENOTDIR;
 	}
 	
+	lock_acquire(sv->sv_lock);
 	result = sfs_lookonce(sv, path, &final, NULL);
+	lock_release(sv->sv_lock);
 	if (result) {
 		vfs_biglock_release();
 		return result;
@@ -1644,7 +1754,8 @@ static const struct vnode_ops sfs_dirops = {
 
 /*
  * Function to load a inode into memory as a vnode, or dig up one
- * that's already resident.
+ * that's already resident. Takes sfs_vnlock, which is what keeps
+ * this from racing with sfs_reclaim.
  */
 static
 int
@@ -1657,6 +1768,8 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	unsigned i, num;
 	int result;
 
+	lock_acquire(sfs->sfs_vnlock);
+
 	/* Look in the vnodes table */
 	num = vnodearray_num(sfs->sfs_vnodes);
 
@@ -1678,6 +1791,7 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 			KASSERT(forcetype==SFS_TYPE_INVAL);
 
 			VOP_INCREF(&sv->sv_v);
+			lock_release(sfs->sfs_vnlock);
 			*ret = sv;
 			return 0;
 		}
@@ -1687,6 +1801,14 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 
 	sv = kmalloc(sizeof(struct sfs_vnode));
 	if (sv==NULL) {
+		lock_release(sfs->sfs_vnlock);
+		return ENOMEM;
+	}
+
+	sv->sv_lock = lock_create("sfs_vnode");
+	if (sv->sv_lock == NULL) {
+		kfree(sv);
+		lock_release(sfs->sfs_vnlock);
 		return ENOMEM;
 	}
 
@@ -1699,7 +1821,9 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	/* Read the block the inode is in */
 	result = sfs_rblock(sfs, &sv->sv_i, ino);
 	if (result) {
+		lock_destroy(sv->sv_lock);
 		kfree(sv);
+		lock_release(sfs->sfs_vnlock);
 		return result;
 	}
 
@@ -1736,7 +1860,9 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	/* Call the common vnode initializer */
 	result = VOP_INIT(&sv->sv_v, ops, &sfs->sfs_absfs, sv);
 	if (result) {
+		lock_destroy(sv->sv_lock);
 		kfree(sv);
+		lock_release(sfs->sfs_vnlock);
 		return result;
 	}
 
@@ -1747,10 +1873,14 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	result = vnodearray_add(sfs->sfs_vnodes, &sv->sv_v, NULL);
 	if (result) {
 		VOP_CLEANUP(&sv->sv_v);
+		lock_destroy(sv->sv_lock);
 		kfree(sv);
+		lock_release(sfs->sfs_vnlock);
 		return result;
 	}
 
+	lock_release(sfs->sfs_vnlock);
+
 	/* Hand it back */
 	*ret = sv;
 	return 0;
@@ -36,6 +36,7 @@
 
 
 #include <vm.h>
+#include "opt-dumbvm.h"
 
 struct vnode;
 
@@ -43,10 +44,9 @@ struct vnode;
 /* 
  * Address space - data structure associated with the virtual memory
  * space of a process.
- *
- * You write this.
  */
 
+#if OPT_DUMBVM
 struct addrspace {
   vaddr_t as_vbase1;
   paddr_t as_pbase1;
@@ -56,6 +56,58 @@ struct addrspace {
   size_t as_npages2;
   paddr_t as_stackpbase;
 };
+#else
+/*
+ * With the paged VM system, an address space is a list of regions,
+ * each a range of pages with the same permissions, and a page table
+ * saying where the pages that have been touched are. Pages are only
+ * given memory when first touched.
+ *
+ * A region may be backed in part by a file (the executable): pages
+ * holding any of the bytes from RG_FILEVADDR up to RG_FILEVADDR +
+ * RG_FILESIZE are read in from the file when first touched, and the
+ * rest of the region is zero-filled.
+ *
+ * as_lock protects all of it. vm_fault takes it, so it must not be
+ * held across anything that might touch user memory. Nor is it held
+ * while a page is read in from the file: the page's PTE is marked
+ * PTE_BUSY meanwhile, and anyone else who wants it waits on
+ * as_busycv.
+ */
+struct region {
+	vaddr_t rg_base;		/* First address (page aligned) */
+	size_t rg_npages;		/* Length in pages */
+	bool rg_writeable;		/* Writes allowed */
+	struct vnode *rg_vnode;		/* File backing it, or NULL */
+	vaddr_t rg_filevaddr;		/* Where the file's data goes */
+	off_t rg_fileoff;		/* ...where it is in the file */
+	size_t rg_filesize;		/* ...and how much there is */
+	struct region *rg_next;
+};
+
+struct addrspace {
+	struct region *as_regions;	/* Regions, in no particular order */
+	struct pagetable *as_pt;	/* Page table */
+	struct lock *as_lock;
+	struct cv *as_busycv;		/* Wait here for PTE_BUSY pages */
+	bool as_loading;		/* Loading; ignore read-only regions */
+};
+
+/* Size of the user stack region; only pages used get memory */
+#define VM_STACKPAGES	1024
+
+/*
+ * as_findregion - find the region of AS containing VADDR, or NULL.
+ *                 Call with as_lock held.
+ *
+ * as_define_file - back the region containing VADDR with FILESIZE
+ *                  bytes of V starting at OFFSET, to appear at VADDR.
+ *                  Takes a reference to V.
+ */
+struct region *as_findregion(struct addrspace *as, vaddr_t vaddr);
+int as_define_file(struct addrspace *as, vaddr_t vaddr, struct vnode *v,
+		   off_t offset, size_t filesize);
+#endif
 
 /*
  * Functions in addrspace.c:
@@ -35,14 +35,17 @@
 /*
  * Time-related definitions.
  *
- * hardclock() is called on every CPU HZ times a second, possibly only
- * when the CPU is not idle, for scheduling.
+ * hardclock() is called on every CPU HZ times a second, but only when
+ * the CPU is not idle, for scheduling. An idle CPU stops its periodic
+ * tick and only takes timer interrupts for pending timeouts.
  *
- * timerclock() is called on one CPU once a second to allow simple
- * timed operations. (This is a fairly simpleminded interface.)
+ * Each CPU also has a timer wheel of timeouts (below), which run off
+ * the same one-shot hardware timer, so they can fire between
+ * hardclocks.
  *
  * gettime() may be used to fetch the current time of day.
  * getinterval() computes the time from time1 to time2.
+ * clock_getns() returns the current time in nanoseconds.
  *
  * XXX we have struct timespec now, let's use it.
  */
@@ -56,10 +59,54 @@
 #define HZ  100
 #endif
 
-void hardclock_bootstrap(void);
+struct timerwheel;	/* Opaque; one per cpu. */
+
+/*
+ * A timeout: call to_func(to_arg) once clock_getns() has reached
+ * to_deadline. The structure belongs to the caller, who must keep it
+ * around until it has fired or been cancelled.
+ */
+struct timeout {
+	struct timeout *to_next;	/* Link in wheel slot */
+	struct timeout **to_pprev;	/* Back link in wheel slot */
+	uint64_t to_deadline;		/* When to fire, in ns */
+	void (*to_func)(void *);	/* Callback */
+	void *to_arg;			/* Argument for callback */
+	struct cpu *volatile to_cpu;	/* Wheel we're on, or NULL */
+};
+
+/*
+ * timeout_init prepares a timeout with its callback.
+ *
+ * timeout_add schedules it on the current cpu's wheel. The callback
+ * runs on that cpu from the timer interrupt, with no locks held, so
+ * it must not sleep. A timeout may be added again once it has fired.
+ *
+ * timeout_cancel removes a pending timeout. It returns true if the
+ * timeout was pending, and false if it had already fired (or was
+ * never added).
+ */
+void timeout_init(struct timeout *to, void (*func)(void *), void *arg);
+void timeout_add(struct timeout *to, uint64_t deadline);
+bool timeout_cancel(struct timeout *to);
+
+/*
+ * Machine-independent timer interface used by the platform code and
+ * the scheduler.
+ *
+ * timerwheel_create sets up a cpu's timer wheel (from cpu_create).
+ * clock_start starts the current cpu's timer once the real-time
+ * clock is available; clock_interrupt is called by the platform code
+ * whenever the cpu's timer goes off. clock_idle and clock_unidle
+ * bracket the idle loop, to turn the periodic tick off and on.
+ */
+struct timerwheel *timerwheel_create(void);
+void clock_start(void);
+void clock_interrupt(void);
+void clock_idle(void);
+void clock_unidle(void);
 
 void hardclock(void);
-void timerclock(void);
 
 void gettime(time_t *seconds, uint32_t *nanoseconds);
 
@@ -67,18 +114,18 @@ void getinterval(time_t secs1, uint32_t nsecs,
                  time_t secs2, uint32_t nsecs2,
                  time_t *rsecs, uint32_t *rnsecs);
 
+uint64_t clock_getns(void);
+
 /*
  * clocksleep() suspends execution for the requested number of seconds,
  * like userlevel sleep(3). (Don't confuse it with wchan_sleep.)
- *
- *  this will be more efficient than clocknap() for longer sleeps
  */
 void clocksleep(int seconds);
 
 /*
  * clocknap() suspends execution for the requested number of timer ticks
  *
- * the timer ticks every LT_GRANULARITY usec (see kern/dev/ltimer.h)
+ * a tick is LT_GRANULARITY usec (see kern/dev/ltimer.h)
  *
  */
 void clocknap(int ticks);
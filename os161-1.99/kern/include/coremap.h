@@ -0,0 +1,82 @@
+/*
+ * Coremap: the physical page allocator.
+ *
+ * There's one entry per physical page of RAM, saying what the page is
+ * being used for. Memory the kernel took before the coremap was set
+ * up (the kernel image and early allocations) is marked fixed and is
+ * never freed.
+ *
+ * Single pages are taken off, and put back on, a free list, so those
+ * are constant-time. Multi-page requests, which need physically
+ * contiguous pages, search the coremap for a run of free ones.
+ *
+ * When memory runs out, the paged VM evicts user pages to swap. They
+ * are chosen by the clock algorithm: a hand sweeps the coremap,
+ * passing over pages used since it last came by and clearing their
+ * referenced bits, and takes the first one that hasn't been. MIPS
+ * has no hardware referenced bit, so "used" means loaded into the
+ * TLB by vm_fault; since every context switch flushes the TLB, pages
+ * in use get loaded again often. Only pages with a known single owner
+ * can be evicted; shared (copy-on-write) pages stay put.
+ *
+ * coremap_bootstrap - take over the rest of RAM from ram.c. Until
+ *                     this is called, coremap_alloc uses ram_stealmem.
+ * coremap_alloc     - allocate NPAGES contiguous pages for kernel
+ *                     (CM_KERNEL) or user (CM_USER) use. Returns their
+ *                     physical address, or 0 if there isn't room.
+ * coremap_free      - free the pages allocated together starting at PA.
+ *                     If they're shared, just drop one reference.
+ * coremap_share     - add a reference to the user page(s) at PA, for
+ *                     copy-on-write. They're freed when the last
+ *                     reference is.
+ * coremap_touch     - note that AS has just mapped its user page PA at
+ *                     VADDR. Returns true if AS is the page's only user,
+ *                     in which case it's remembered as the owner, and
+ *                     false if the page is shared. Call with AS's
+ *                     as_lock held.
+ * coremap_victim    - choose a user page to evict (paged VM only).
+ *                     Returns it pinned, with its owner's address space
+ *                     and vaddr, and that address space's as_lock held;
+ *                     *LOCKEDP says whether we locked it or the caller
+ *                     already had it. Returns 0 if nothing can go.
+ * coremap_pin       - mark a user page as not to be moved or taken away,
+ * coremap_unpin       e.g. while doing I/O on it. Kernel pages never
+ *                     move. Pins nest; each pin needs its own unpin.
+ * coremap_getstats  - get the number of pages in each state.
+ * coremap_printstats - print those.
+ */
+
+#ifndef _COREMAP_H_
+#define _COREMAP_H_
+
+/* Page states */
+#define CM_FREE		0	/* Available */
+#define CM_FIXED	1	/* Taken before the coremap existed */
+#define CM_KERNEL	2	/* Kernel (alloc_kpages) */
+#define CM_USER		3	/* User (address space) page */
+
+struct addrspace;
+
+struct coremapstats {
+	unsigned cms_total;		/* Pages of RAM */
+	unsigned cms_free;		/* CM_FREE */
+	unsigned cms_fixed;		/* CM_FIXED */
+	unsigned cms_kernel;		/* CM_KERNEL */
+	unsigned cms_user;		/* CM_USER */
+	unsigned cms_pinned;		/* ...of which pinned */
+	unsigned cms_shared;		/* ...of which shared */
+};
+
+void coremap_bootstrap(void);
+paddr_t coremap_alloc(unsigned npages, int state);
+void coremap_free(paddr_t pa);
+void coremap_share(paddr_t pa);
+bool coremap_touch(paddr_t pa, struct addrspace *as, vaddr_t vaddr);
+paddr_t coremap_victim(struct addrspace **asp, vaddr_t *vaddrp,
+		       bool *lockedp);
+void coremap_pin(paddr_t pa);
+void coremap_unpin(paddr_t pa);
+void coremap_getstats(struct coremapstats *cms);
+void coremap_printstats(void);
+
+#endif /* _COREMAP_H_ */
@@ -34,6 +34,8 @@
 #include <spinlock.h>
 #include <threadlist.h>
 #include <machine/vm.h>  /* for TLBSHOOTDOWN_MAX */
+#include "opt-splstat.h"
+#include "opt-splwatch.h"
 
 
 /*
@@ -46,6 +48,10 @@
  * a pointer with a fixed address and a per-cpu mapping in the MMU.
  */
 
+/* Sizes of the per-cpu interrupt counters */
+#define CPU_NIRQSLOTS	32	/* system bus slots */
+#define CPU_NIPITYPES	4	/* IPI_* codes, below */
+
 struct cpu {
 	/*
 	 * Fixed after allocation.
@@ -53,19 +59,53 @@ struct cpu {
 	struct cpu *c_self;		/* Canonical address of this struct */
 	unsigned c_number;		/* This cpu's cpu number */
 	unsigned c_hardware_number;	/* Hardware-defined cpu number */
+	struct timerwheel *c_timerwheel; /* Timeouts (see clock.c) */
+	struct workqueue *c_workqueue;	/* Deferred work (workqueue.c) */
 
 	/*
 	 * Accessed only by this cpu.
 	 */
 	struct thread *c_curthread;	/* Current thread on cpu */
 	struct threadlist c_zombies;	/* List of exited threads */
+	struct threadlist c_threadcache; /* Dead threads kept for reuse */
+	unsigned c_tcachehits;		/* Forks that reused a cached thread */
+	unsigned c_tcachemisses;	/* Forks that had to kmalloc one */
+	unsigned c_rtmisses;		/* Real-time deadlines missed */
+	unsigned c_rtthrottles;		/* Real-time budgets used up */
+	unsigned c_rcuqs;		/* RCU quiescent states (see rcu.c) */
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
+	unsigned c_idleclocks;		/* hardclocks skipped while idle */
+	unsigned c_steals;		/* Threads stolen from other cpus */
+	unsigned c_demotions;		/* MLFQ demotions */
+	unsigned c_boosts;		/* MLFQ priority boosts */
+	unsigned c_migrations;		/* Threads pushed to other cpus */
+	unsigned c_volswitches;		/* Switches by blocking or yielding */
+	unsigned c_involswitches;	/* Switches by preemption */
+	unsigned c_irqs[CPU_NIRQSLOTS];	/* Device interrupts, by bus slot */
+	unsigned c_timerirqs;		/* Timer interrupts */
+	unsigned c_ipis[CPU_NIPITYPES];	/* IPIs received, by type */
+	uint64_t c_idlens;		/* Time spent idle */
+	uint64_t c_statstart;		/* When the counters were reset */
+	unsigned c_statclocks;		/* c_hardclocks at that time */
+#if OPT_SPLSTAT
+	uint64_t c_splhighns;		/* Time spent at splhigh */
+	uint64_t c_splhighstart;	/* When it went high, or 0 */
+#endif
+#if OPT_SPLWATCH
+	uint64_t c_splwstart;		/* When it went high, or 0 */
+	const void *c_splwsite;		/* ...and from where */
+	int c_splwpendkind;		/* Warning not yet printed: kind */
+	const void *c_splwpendsite;	/* ...call site */
+	uint64_t c_splwpendns;		/* ...and hold time, or 0 if none */
+#endif
 
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the runqueue lock.
 	 */
 	bool c_isidle;			/* True if this cpu is idle */
+	bool c_needresched;		/* Curthread should yield soon */
+	unsigned c_rtutil;		/* Committed to real-time threads */
 	struct threadlist c_runqueue;	/* Run queue for this cpu */
 	struct spinlock c_runqueue_lock;
 
@@ -109,6 +149,13 @@ void cpu_machdep_init(struct cpu *);
 /*ASMLINKAGE*/ void cpu_start_secondary(void);
 void cpu_hatch(unsigned software_number);
 
+/*
+ * Number of cpus, and the cpu with software number N, for setting
+ * things up on every cpu. Valid once thread_start_cpus has returned.
+ */
+unsigned cpu_count(void);
+struct cpu *cpu_bynumber(unsigned n);
+
 /*
  * Return a string describing the CPU type.
  */
@@ -152,6 +199,9 @@ void cpu_halt(void);
  * ipi_send sends an IPI to one CPU.
  * ipi_broadcast sends an IPI to all CPUs except the current one.
  * ipi_tlbshootdown is like ipi_send but carries TLB shootdown data.
+ * ipi_tlbshootdown_allcpus does a shootdown on every CPU, including
+ *    the current one, and waits until all of them have done it. It
+ *    may yield, so it must be called with interrupts on.
  *
  * interprocessor_interrupt is called on the target CPU when an IPI is
  * received.
@@ -166,8 +216,16 @@ void cpu_halt(void);
 void ipi_send(struct cpu *target, int code);
 void ipi_broadcast(int code);
 void ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping);
+void ipi_tlbshootdown_allcpus(const struct tlbshootdown *mapping);
 
 void interprocessor_interrupt(void);
 
+/*
+ * Print and reset per-cpu statistics (for the cpustat menu command).
+ * Times are in ns, measured with clock_getns.
+ */
+void cpu_printstats(void);
+void cpu_resetstats(void);
+
 
 #endif /* _CPU_H_ */
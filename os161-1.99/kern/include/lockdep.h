@@ -0,0 +1,44 @@
+/*
+ * Lock order checking.
+ *
+ * Only built with the lockdep kernel option. Locks and CVs are
+ * grouped into classes by name, and every time a thread takes a lock
+ * (or waits on a CV) while holding others, the order between their
+ * classes is recorded. The first time an order shows up that closes a
+ * cycle - A before B somewhere, B before A somewhere else - it is
+ * reported, with where each lock in the cycle was acquired, whether
+ * or not the deadlock actually happens this time.
+ *
+ * A CV wait counts as acquiring the CV while holding everything else
+ * the waiter holds, and a signal or broadcast counts as the CV being
+ * held while acquiring each lock the signaller holds; a thread that
+ * sleeps on a CV while holding a lock its signaller needs is a cycle.
+ * The CV's own lock is let go of during the wait, so it's left out.
+ *
+ * Locks of the same class nest freely: they're typically per-object
+ * locks taken in some order we can't see from their names.
+ *
+ * The lock code calls these; nothing else should need to.
+ *
+ * lockdep_class   - find or create the class for a lock (ISCV false)
+ *                   or CV (ISCV true) named NAME.
+ * lockdep_acquire - about to acquire a lock, or wait on a CV, of class
+ *                   CL while holding curthread's t_heldlocks except
+ *                   SKIP. WHERE is the caller's address.
+ * lockdep_signal  - about to signal or broadcast a CV of class CL,
+ *                   likewise.
+ */
+
+#ifndef _LOCKDEP_H_
+#define _LOCKDEP_H_
+
+struct lock;
+
+/* Class for things we ran out of room to track; never checked */
+#define LOCKDEP_NOCLASS	(-1)
+
+int lockdep_class(const char *name, bool iscv);
+void lockdep_acquire(int cl, struct lock *skip, const void *where);
+void lockdep_signal(int cl, struct lock *skip, const void *where);
+
+#endif /* _LOCKDEP_H_ */
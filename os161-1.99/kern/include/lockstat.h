@@ -0,0 +1,43 @@
+/*
+ * Lock contention statistics.
+ *
+ * Only built with the lockstat kernel option. Statistics are kept per
+ * lock class rather than per lock: sleep locks are grouped by name,
+ * and spinlocks by the place that initialized them (or, for statically
+ * initialized spinlocks, by the lock itself). That way a class
+ * outlives any one lock and nothing needs unregistering on destroy.
+ *
+ * The lock code calls these; nothing else should need to.
+ *
+ * lockstat_bootstrap  - called at boot once the clock is attached;
+ *                       wait and hold times are only measured after
+ *                       this.
+ * lockstat_class      - find or create the class for a lock. NAME is
+ *                       the lock's name, or NULL for a spinlock, in
+ *                       which case KEY identifies the class.
+ * lockstat_now        - timestamp for the calls below (0 if the clock
+ *                       isn't available yet).
+ * lockstat_acquired   - record an acquire. CONTENDED says whether the
+ *                       lock was held when we got there; WAITSTART is
+ *                       lockstat_now() from then and NOW from after
+ *                       getting the lock.
+ * lockstat_released   - record a release of a lock acquired at STAMP.
+ * lockstat_print      - print the N classes with the most wait time.
+ * lockstat_reset      - zero all the counters.
+ */
+
+#ifndef _LOCKSTAT_H_
+#define _LOCKSTAT_H_
+
+struct lockstat;	/* Opaque. */
+
+void lockstat_bootstrap(void);
+struct lockstat *lockstat_class(const char *name, const void *key);
+uint64_t lockstat_now(void);
+void lockstat_acquired(struct lockstat *ls, bool contended,
+		       uint64_t waitstart, uint64_t now);
+void lockstat_released(struct lockstat *ls, uint64_t stamp);
+void lockstat_print(unsigned n);
+void lockstat_reset(void);
+
+#endif /* _LOCKSTAT_H_ */
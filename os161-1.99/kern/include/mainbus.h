@@ -52,6 +52,12 @@ void mainbus_interrupt(struct trapframe *);
 /* XXX this interface is not adequately MI */
 size_t mainbus_ramsize(void);
 
+/*
+ * Set the current cpu's timer to interrupt once, NSECS nanoseconds
+ * from now. (Low-level; see clock.c.)
+ */
+void mainbus_settimer(uint64_t nsecs);
+
 /* Switch on an inter-processor interrupt. (Low-level.) */
 void mainbus_send_ipi(struct cpu *target);
 
@@ -0,0 +1,23 @@
+/*
+ * Memory barriers, for code that shares data between cpus without
+ * locks (see <seqlock.h> and <rcu.h>). Locks imply all the ordering
+ * they need on their own.
+ *
+ * membar_load_load    - earlier loads happen before later loads.
+ * membar_store_store  - earlier stores happen before later stores.
+ * membar_any_any      - everything before happens before everything
+ *                       after.
+ *
+ * The processors System/161 simulates don't reorder memory accesses
+ * among themselves, so all these have to do is keep the compiler from
+ * doing it.
+ */
+
+#ifndef _MEMBAR_H_
+#define _MEMBAR_H_
+
+#define membar_load_load()	__asm volatile("" ::: "memory")
+#define membar_store_store()	__asm volatile("" ::: "memory")
+#define membar_any_any()	__asm volatile("" ::: "memory")
+
+#endif /* _MEMBAR_H_ */
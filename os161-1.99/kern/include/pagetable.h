@@ -0,0 +1,55 @@
+/*
+ * Page tables for user address spaces.
+ *
+ * Two levels: the top 10 bits of a virtual address pick an entry in
+ * the directory, which points to a page of PTEs covering 4M (or is
+ * NULL if nothing in that 4M has been touched), and the next 10 bits
+ * pick the PTE. Only user space is covered, so the directory has
+ * half the usual 1024 entries.
+ *
+ * A PTE holds a physical page address and flag bits in the low 12
+ * bits; a zero PTE means the page has never been touched. A page that
+ * has been evicted has PTE_SWAPPED instead of PTE_PRESENT, and its
+ * swap slot where the page address would be. A page being read in
+ * from the executable has PTE_BUSY instead; whoever finds one waits
+ * on the address space's as_busycv until it's done.
+ *
+ * pt_create  - make an empty page table. Returns NULL if out of memory.
+ * pt_destroy - free the page table itself. Freeing the pages it maps
+ *              is up to the caller.
+ * pt_lookup  - find the PTE for VADDR. If its page of PTEs doesn't
+ *              exist, makes it if CREATE is true and returns NULL
+ *              otherwise (or if out of memory).
+ */
+
+#ifndef _PAGETABLE_H_
+#define _PAGETABLE_H_
+
+#include <vm.h>
+
+typedef uint32_t pte_t;
+
+#define PTE_FRAME	0xfffff000	/* Physical page, if PTE_PRESENT */
+#define PTE_PRESENT	0x00000001	/* Page is in memory */
+#define PTE_BUSY	0x00000002	/* Page is being read in */
+#define PTE_COW		0x00000004	/* Shared; copy before writing */
+#define PTE_SWAPPED	0x00000008	/* Page is in swap */
+
+#define PTE_TOSLOT(pte)		((pte) >> PT_PTESHIFT)
+#define PTE_FROMSLOT(slot)	(((pte_t)(slot) << PT_PTESHIFT) | PTE_SWAPPED)
+
+#define PT_PTESHIFT	12			/* Bits of page offset */
+#define PT_DIRSHIFT	22			/* ...plus PTE index */
+#define PT_NPTES	1024			/* PTEs per page of them */
+#define PT_NDIR		(USERSPACETOP >> PT_DIRSHIFT)
+#define PT_DIRSIZE	(1 << PT_DIRSHIFT)	/* Bytes covered by one */
+
+struct pagetable {
+	pte_t *pt_dir[PT_NDIR];
+};
+
+struct pagetable *pt_create(void);
+void pt_destroy(struct pagetable *pt);
+pte_t *pt_lookup(struct pagetable *pt, vaddr_t vaddr, bool create);
+
+#endif /* _PAGETABLE_H_ */
@@ -0,0 +1,71 @@
+/*
+ * Read-copy-update.
+ *
+ * For structures that are looked up far more often than they change.
+ * Readers take no locks and do no atomic operations; they bracket
+ * their lookups with rcu_read_lock and rcu_read_unlock, and load
+ * pointers to shared objects with rcu_dereference. Writers, which
+ * must exclude each other by some other means, build the new version
+ * of an object, publish it with rcu_assign_pointer, and then call
+ * rcu_synchronize before freeing the old one. rcu_synchronize waits
+ * until every reader that might still see the old version is done.
+ *
+ * This is quiescent-state based: a cpu that has switched threads, or
+ * taken a clock tick outside a read section, or is idle, can't be in
+ * the middle of a reader that started earlier. So readers may not
+ * sleep or yield; a read section only counts in curthread's
+ * t_rcunest, and hardclock won't preempt a thread while it's nonzero.
+ * Read sections nest. They may not be used in interrupt handlers: an
+ * idle cpu counts as quiescent, even if it's taking an interrupt.
+ *
+ * rcu_synchronize sleeps, so it can't be called from an interrupt
+ * handler, with a spinlock held, or inside a read section. Until
+ * rcu_bootstrap is called, from boot() once the other cpus are up,
+ * only the boot cpu is running, so it returns at once.
+ */
+
+#ifndef _RCU_H_
+#define _RCU_H_
+
+#include <cdefs.h>
+#include <membar.h>
+#include <thread.h>
+#include <current.h>
+
+/* Inlining support - for making sure an out-of-line copy gets built */
+#ifndef RCU_INLINE
+#define RCU_INLINE INLINE
+#endif
+
+/* Load a pointer P that writers update with rcu_assign_pointer. */
+#define rcu_dereference(p)	(*(__typeof__(p) volatile *)&(p))
+
+/* Publish V in P, after whatever was stored to it beforehand. */
+#define rcu_assign_pointer(p, v) \
+	do { membar_store_store(); (p) = (v); } while (0)
+
+void rcu_bootstrap(void);
+void rcu_synchronize(void);
+
+RCU_INLINE void rcu_read_lock(void);
+RCU_INLINE void rcu_read_unlock(void);
+
+RCU_INLINE
+void
+rcu_read_lock(void)
+{
+	KASSERT(!curthread->t_in_interrupt);
+	curthread->t_rcunest++;
+	membar_any_any();
+}
+
+RCU_INLINE
+void
+rcu_read_unlock(void)
+{
+	membar_any_any();
+	KASSERT(curthread->t_rcunest > 0);
+	curthread->t_rcunest--;
+}
+
+#endif /* _RCU_H_ */
@@ -0,0 +1,70 @@
+/*
+ * Sequence locks.
+ *
+ * For data that is read much more often than it's written and is
+ * small enough to copy out. Writers serialize on a spinlock and bump
+ * a sequence number before and after each update, so it's odd while
+ * an update is in progress. Readers take no lock and do no atomic
+ * operations: they note the sequence number, read the data, and try
+ * again if the number changed meanwhile:
+ *
+ *	do {
+ *		seq = seqlock_read_begin(&sl);
+ *		... copy the data ...
+ *	} while (seqlock_read_retry(&sl, seq));
+ *
+ * A reader can see the data half-updated before it retries, so it
+ * mustn't follow pointers out of it or act on it until it's done.
+ */
+
+#ifndef _SEQLOCK_H_
+#define _SEQLOCK_H_
+
+#include <cdefs.h>
+#include <spinlock.h>
+#include <membar.h>
+
+/* Inlining support - for making sure an out-of-line copy gets built */
+#ifndef SEQLOCK_INLINE
+#define SEQLOCK_INLINE INLINE
+#endif
+
+struct seqlock {
+	struct spinlock sl_lock;	/* Serializes writers */
+	volatile unsigned sl_seq;	/* Odd during a write */
+};
+
+#define SEQLOCK_INITIALIZER	{ SPINLOCK_INITIALIZER, 0 }
+
+void seqlock_init(struct seqlock *sl);
+void seqlock_cleanup(struct seqlock *sl);
+
+void seqlock_write_begin(struct seqlock *sl);
+void seqlock_write_end(struct seqlock *sl);
+
+SEQLOCK_INLINE unsigned seqlock_read_begin(const struct seqlock *sl);
+SEQLOCK_INLINE bool seqlock_read_retry(const struct seqlock *sl,
+				       unsigned seq);
+
+SEQLOCK_INLINE
+unsigned
+seqlock_read_begin(const struct seqlock *sl)
+{
+	unsigned seq;
+
+	while ((seq = sl->sl_seq) & 1) {
+		/* A write is in progress; wait it out */
+	}
+	membar_load_load();
+	return seq;
+}
+
+SEQLOCK_INLINE
+bool
+seqlock_read_retry(const struct seqlock *sl, unsigned seq)
+{
+	membar_load_load();
+	return sl->sl_seq != seq;
+}
+
+#endif /* _SEQLOCK_H_ */
@@ -48,11 +48,21 @@
  */
 #include <kern/sfs.h>
 
+/*
+ * Locking: sv_lock protects a vnode's inode and, for the directory,
+ * its contents; sfs_vnlock protects sfs_vnodes; sfs_freemaplock
+ * protects sfs_freemap, sfs_freemapdirty, and sfs_superdirty. The
+ * sfs_super contents other than the dirty flag don't change after
+ * mount. The order is: the directory's sv_lock, a file's sv_lock,
+ * sfs_vnlock, sfs_freemaplock. (There are no subdirectories, so
+ * there's never more than one directory lock to take.)
+ */
 struct sfs_vnode {
 	struct vnode sv_v;              /* abstract vnode structure */
 	struct sfs_inode sv_i;		/* on-disk inode */
 	uint32_t sv_ino;                /* inode number */
 	bool sv_dirty;                  /* true if sv_i modified */
+	struct lock *sv_lock;           /* lock for sv_i and sv_dirty */
 };
 
 struct sfs_fs {
@@ -63,6 +73,8 @@ struct sfs_fs {
 	struct vnodearray *sfs_vnodes;  /* vnodes loaded into memory */
 	struct bitmap *sfs_freemap;     /* blocks in use are marked 1 */
 	bool sfs_freemapdirty;          /* true if freemap modified */
+	struct lock *sfs_vnlock;        /* lock for sfs_vnodes */
+	struct lock *sfs_freemaplock;   /* lock for the free block map */
 };
 
 /*
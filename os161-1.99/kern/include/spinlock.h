@@ -36,6 +36,9 @@
  */
 
 #include <cdefs.h>
+#include "opt-ticketlock.h"
+#include "opt-lockstat.h"
+#include "opt-splwatch.h"
 
 /* Inlining support - for making sure an out-of-line copy gets built */
 #ifndef SPINLOCK_INLINE
@@ -54,15 +57,73 @@
  * malloc'd; however, code that uses spinlocks should not look inside
  * the structure directly but always use the spinlock API functions.
  */
+#if OPT_LOCKSTAT
+#define SPINLOCK_STAT_INITIALIZER	, NULL, 0
+#else
+#define SPINLOCK_STAT_INITIALIZER
+#endif
+#if OPT_SPLWATCH
+#define SPINLOCK_WATCH_INITIALIZER	, 0, NULL
+#else
+#define SPINLOCK_WATCH_INITIALIZER
+#endif
+
+#if OPT_TICKETLOCK
+/*
+ * With the ticketlock option, spinlocks are FIFO ticket locks: each
+ * acquirer atomically takes the next ticket from lk_next and waits
+ * until lk_serving reaches it. Waiters are served in arrival order,
+ * so no CPU can be starved, and while waiting they only read
+ * lk_serving instead of hammering the lock word with atomic ops.
+ */
+struct spinlock {
+	volatile spinlock_data_t lk_next; /* Next ticket to hand out. */
+	volatile spinlock_data_t lk_serving; /* Ticket holding the lock. */
+	struct cpu *lk_holder;		/* CPU holding this lock. */
+#if OPT_LOCKSTAT
+	struct lockstat *lk_stat;	/* Statistics class. */
+	uint64_t lk_stamp;		/* When acquired. */
+#endif
+#if OPT_SPLWATCH
+	uint64_t lk_wstart;		/* When acquired, for splwatch. */
+	const void *lk_wsite;		/* Where acquired. */
+#endif
+};
+
+#define SPINLOCK_INITIALIZER	\
+	{ SPINLOCK_DATA_INITIALIZER, SPINLOCK_DATA_INITIALIZER, NULL \
+	  SPINLOCK_STAT_INITIALIZER SPINLOCK_WATCH_INITIALIZER }
+#else
 struct spinlock {
 	volatile spinlock_data_t lk_lock; /* The memory word where we spin. */
 	struct cpu *lk_holder;		/* CPU holding this lock. */
+#if OPT_LOCKSTAT
+	struct lockstat *lk_stat;	/* Statistics class. */
+	uint64_t lk_stamp;		/* When acquired. */
+#endif
+#if OPT_SPLWATCH
+	uint64_t lk_wstart;		/* When acquired, for splwatch. */
+	const void *lk_wsite;		/* Where acquired. */
+#endif
 };
 
 /*
  * Initializer for cases where a spinlock needs to be static or global.
  */
-#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, NULL }
+#define SPINLOCK_INITIALIZER	\
+	{ SPINLOCK_DATA_INITIALIZER, NULL SPINLOCK_STAT_INITIALIZER \
+	  SPINLOCK_WATCH_INITIALIZER }
+#endif
+
+/*
+ * With the lockstat option each spinlock also carries a pointer to
+ * its statistics class (see <lockstat.h>) and the time it was taken.
+ * The initializers leave these zero; statically initialized spinlocks
+ * are given a class the first time they're acquired.
+ *
+ * Likewise with the splwatch option each spinlock carries the time it
+ * was taken and where from, to time the hold (see <splwatch.h>).
+ */
 
 /*
  * Spinlock functions.
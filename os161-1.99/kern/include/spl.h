@@ -31,6 +31,8 @@
 #define _SPL_H_
 
 #include <cdefs.h>
+#include "opt-splstat.h"
+#include "opt-splwatch.h"
 
 /*
  * Machine-independent interface to interrupt enable/disable.
@@ -84,6 +86,31 @@ int splx(int);
 void splraise(int oldipl, int newipl);
 void spllower(int oldipl, int newipl);
 
+#if OPT_SPLSTAT
+/*
+ * With the splstat option, the time each cpu spends at splhigh is
+ * accumulated in c_splhighns. splstat_bootstrap starts the timing
+ * once the clock is attached; thread_switch calls splstat_switch
+ * just before switching to NEXT.
+ */
+struct thread;
+void splstat_bootstrap(void);
+void splstat_switch(struct thread *next);
+#endif
+
+#if OPT_SPLWATCH
+/*
+ * With the splwatch option, each stretch at splhigh is timed and
+ * charged to where it started (see <splwatch.h>). splwatch_site
+ * tells the spl code that WHERE, rather than its own caller, is the
+ * place to charge if this raise is the outermost one; thread_switch
+ * calls splwatch_switch just before switching to NEXT.
+ */
+struct thread;
+void splwatch_site(const void *where);
+void splwatch_switch(struct thread *next);
+#endif
+
 ////////////////////////////////////////////////////////////
 
 /* Inlining support - for making sure an out-of-line copy gets built */
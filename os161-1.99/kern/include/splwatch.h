@@ -0,0 +1,52 @@
+/*
+ * Interrupts-off watchdog.
+ *
+ * Only built with the splwatch kernel option. Every stretch of time a
+ * cpu spends at splhigh, and every spinlock hold, is timed and charged
+ * to the place it started: the caller of splhigh()/splx() or of
+ * spinlock_acquire. For each such call site we keep the number of
+ * holds and the total and worst hold time, and the splwatch menu
+ * command prints the worst offenders.
+ *
+ * A hold longer than the limit (splwatch_setlimit) either panics on
+ * the spot or prints a warning. Warnings are only printed when a site
+ * beats its own previous worst, and are put off until interrupts are
+ * back on and no spinlocks are held at all, so that printing them
+ * isn't itself another long hold.
+ *
+ * The spl and spinlock code call these:
+ *
+ * splwatch_bootstrap - called at boot once the clock is attached;
+ *                      nothing is timed before this.
+ * splwatch_now       - timestamp for splwatch_held (0 if the clock
+ *                      isn't available yet).
+ * splwatch_held      - record a hold of kind KIND (SPLWATCH_*) that
+ *                      started at START at call site WHERE, and ended
+ *                      now.
+ * splwatch_report    - print any warning splwatch_held put off, if
+ *                      no spinlocks are held and interrupts are on.
+ *
+ * and the menu code calls these:
+ *
+ * splwatch_print     - print the N sites with the worst single hold.
+ * splwatch_reset     - forget all sites.
+ * splwatch_setlimit  - set the limit to NS nanoseconds (0 for none)
+ *                      and whether going past it panics.
+ */
+
+#ifndef _SPLWATCH_H_
+#define _SPLWATCH_H_
+
+/* Kinds of hold */
+#define SPLWATCH_SPL		0	/* At splhigh */
+#define SPLWATCH_SPINLOCK	1	/* Holding a spinlock */
+
+void splwatch_bootstrap(void);
+uint64_t splwatch_now(void);
+void splwatch_held(int kind, const void *where, uint64_t start);
+void splwatch_report(void);
+void splwatch_print(unsigned n);
+void splwatch_reset(void);
+void splwatch_setlimit(uint64_t ns, bool dopanic);
+
+#endif /* _SPLWATCH_H_ */
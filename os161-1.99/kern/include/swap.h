@@ -0,0 +1,29 @@
+/*
+ * Swap space for the paged VM system.
+ *
+ * When memory runs out, user pages are written out to page-sized
+ * slots on a raw disk device, SWAP_DEVICE, and their PTEs are set to
+ * point at the slot (PTE_SWAPPED). A bitmap records which slots are
+ * in use. If the device isn't there, there's no swap, and running out
+ * of memory fails the allocation as it always did.
+ *
+ * swap_bootstrap - open the swap device. Called once at boot.
+ * swap_getpage   - like coremap_alloc(1, STATE), but if memory is full,
+ *                  evict a user page to swap to make room. Doesn't try
+ *                  unless the caller could sleep (no spinlocks held).
+ *                  Returns 0 if there's no page to be had.
+ * swap_read      - read SLOT into the page at PA.
+ * swap_free      - give back SLOT.
+ */
+
+#ifndef _SWAP_H_
+#define _SWAP_H_
+
+#define SWAP_DEVICE	"lhd0raw:"
+
+void swap_bootstrap(void);
+paddr_t swap_getpage(int state);
+int swap_read(unsigned slot, paddr_t pa);
+void swap_free(unsigned slot);
+
+#endif /* _SWAP_H_ */
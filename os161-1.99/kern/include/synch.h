@@ -36,6 +36,8 @@
 
 
 #include <spinlock.h>
+#include <thread.h>		/* for SCHED_NLEVELS */
+#include "opt-lockdep.h"
 
 /*
  * Dijkstra-style semaphore.
@@ -47,7 +49,10 @@ struct semaphore {
         char *sem_name;
 	struct wchan *sem_wchan;
 	struct spinlock sem_lock;
-        volatile int sem_count;
+	/* Changed only atomically; see P() and V() */
+	volatile spinlock_data_t sem_count;
+	/* Threads in P's slow path; protected by sem_lock */
+	volatile unsigned sem_nwaiters;
 };
 
 struct semaphore *sem_create(const char *name, int initial_count);
@@ -58,6 +63,10 @@ void sem_destroy(struct semaphore *);
  *     P (proberen): decrement count. If the count is 0, block until
  *                   the count is 1 again before decrementing.
  *     V (verhogen): increment count.
+ *
+ * When P doesn't have to wait and V has nobody to wake, neither takes
+ * any lock; the count is updated with an atomic compare-and-swap or
+ * fetch-and-add.
  */
 void P(struct semaphore *);
 void V(struct semaphore *);
@@ -74,14 +83,29 @@ void V(struct semaphore *);
  */
 struct lock {
         char *lk_name;
-
-        // add what you need here
-        // (don't forget to mark things volatile as needed)
-	bool *held;
-        struct wchan *wc;
-        struct spinlock *spin;
-	struct thread *owner;
-	struct cpu *lk_holder;
+	struct wchan *lk_wchan;
+	struct spinlock lk_lock;
+	/* NULL if the lock is free; protected by lk_lock */
+	struct thread *volatile lk_owner;
+
+	/* Adaptive-acquire statistics; protected by lk_lock */
+	unsigned lk_spinhits;		/* acquired after spinning */
+	unsigned lk_sleeps;		/* had to go to sleep */
+
+	/* Priority inheritance; protected by lock_pilock */
+	unsigned lk_piwaiters[SCHED_NLEVELS]; /* sleepers, by level */
+	unsigned lk_npiwaiters;		/* total; stable under lk_lock */
+	struct lock *lk_nextheld;	/* owner's t_heldlocks list */
+#if OPT_LOCKSTAT
+	/* Contention statistics (see <lockstat.h>) */
+	struct lockstat *lk_stat;	/* class, by name */
+	uint64_t lk_stamp;		/* when acquired; owner only */
+#endif
+#if OPT_LOCKDEP
+	/* Lock order checking (see <lockdep.h>) */
+	int lk_ldclass;			/* class, by name */
+	const void *lk_ldwhere;		/* where acquired; owner only */
+#endif
 };
 
 struct lock *lock_create(const char *name);
@@ -91,15 +115,38 @@ void lock_acquire(struct lock *);
  * Operations:
  *    lock_acquire - Get the lock. Only one thread can hold the lock at the
  *                   same time.
+ *    lock_tryacquire - Get the lock if nobody has it, and return true;
+ *                   otherwise return false at once. Never sleeps, so
+ *                   it can be used while holding a spinlock.
  *    lock_release - Free the lock. Only the thread holding the lock may do
  *                   this.
  *    lock_do_i_hold - Return true if the current thread holds the lock; 
  *                   false otherwise.
  *
- * These operations must be atomic. You get to write them.
+ * These operations must be atomic.
+ *
+ * lock_acquire is adaptive: if the lock is held by a thread that is
+ * currently running on another CPU, the caller spins for up to
+ * LOCK_SPIN_LIMIT polls waiting for it to be released before giving
+ * up and sleeping. Most critical sections are much shorter than a
+ * context switch, so this usually avoids one. Setting LOCK_SPIN_LIMIT
+ * to 0 gets plain sleep-only locks.
+ *
+ * lk_spinhits and lk_sleeps count how often contended acquires were
+ * satisfied by spinning and how often they slept, respectively.
+ * lock_printstats prints them.
+ *
+ * Locks do priority inheritance: a thread that goes to sleep waiting
+ * for a lock lends its scheduling level to the owner, and onward to
+ * the owner of whatever lock that owner is waiting for, and so on.
+ * The owner gives it back when it releases the lock.
  */
+#define LOCK_SPIN_LIMIT  1000
+
+bool lock_tryacquire(struct lock *);
 void lock_release(struct lock *);
 bool lock_do_i_hold(struct lock *);
+void lock_printstats(struct lock *);
 void lock_destroy(struct lock *);
 
 
@@ -119,8 +166,10 @@ void lock_destroy(struct lock *);
 
 struct cv {
         char *cv_name;
-        // add what you need here
-        // (don't forget to mark things volatile as needed)
+	struct wchan *cv_wchan;
+#if OPT_LOCKDEP
+	int cv_ldclass;			/* Lock order class (<lockdep.h>) */
+#endif
 };
 
 struct cv *cv_create(const char *name);
@@ -137,11 +186,69 @@ void cv_destroy(struct cv *);
  * in. Note that under normal circumstances the same lock should be used
  * on all operations with any particular CV.
  *
- * These operations must be atomic. You get to write them.
+ * These operations must be atomic.
+ *
+ * cv_broadcast does wait morphing: rather than waking all the waiters
+ * at once only to have all but one go right back to sleep on the
+ * lock, it moves them onto the lock's wait channel, so each is woken
+ * in turn as the lock is released. Threads moved this way do not
+ * lend their priority to the lock's owner.
  */
 void cv_wait(struct cv *cv, struct lock *lock);
 void cv_signal(struct cv *cv, struct lock *lock);
 void cv_broadcast(struct cv *cv, struct lock *lock);
 
 
+/*
+ * Reader-writer lock.
+ *
+ * Any number of readers may hold the lock at once, or one writer.
+ * Writers take precedence: once a writer is waiting, new readers
+ * wait behind it, so a steady stream of readers can't starve
+ * writers out.
+ *
+ * The name field is for easier debugging. A copy of the name is
+ * made internally.
+ */
+struct rwlock {
+	char *rw_name;
+	struct wchan *rw_readwchan;	/* readers wait here */
+	struct wchan *rw_writewchan;	/* writers (and upgraders) wait here */
+	struct spinlock rw_lock;	/* protects the fields below */
+	volatile unsigned rw_readers;	/* # of threads holding for read */
+	volatile unsigned rw_waitingwriters; /* # of writers waiting */
+	struct thread *volatile rw_writer; /* holder for write, or NULL */
+	struct thread *volatile rw_upgrader; /* reader waiting to upgrade */
+};
+
+struct rwlock *rwlock_create(const char *name);
+void rwlock_destroy(struct rwlock *);
+
+/*
+ * Operations:
+ *    rwlock_acquire_read  - Get the lock for reading. Blocks while a
+ *                           writer holds or is waiting for the lock.
+ *    rwlock_release_read  - Give up a read hold.
+ *    rwlock_acquire_write - Get the lock for writing. Blocks until
+ *                           there are no other holders.
+ *    rwlock_release_write - Give up a write hold.
+ *    rwlock_upgrade       - Turn a read hold into a write hold, without
+ *                           letting any other writer in between. Only
+ *                           one reader can be upgrading at a time; if
+ *                           another already is, this fails and returns
+ *                           false, and the caller still holds the lock
+ *                           for reading. Returns true on success.
+ *    rwlock_downgrade     - Turn a write hold into a read hold, without
+ *                           letting any other writer in between.
+ *
+ * These operations are atomic.
+ */
+void rwlock_acquire_read(struct rwlock *);
+void rwlock_release_read(struct rwlock *);
+void rwlock_acquire_write(struct rwlock *);
+void rwlock_release_write(struct rwlock *);
+bool rwlock_upgrade(struct rwlock *);
+void rwlock_downgrade(struct rwlock *);
+
+
 #endif /* _SYNCH_H_ */
@@ -57,6 +57,11 @@ void enter_new_process(int argc, userptr_t argv, vaddr_t stackptr,
 
 int sys_reboot(int code);
 int sys___time(userptr_t user_seconds, userptr_t user_nanoseconds);
+int sys_futex_wait(userptr_t addr, int expected);
+int sys_futex_wake(userptr_t addr, int count, int *retval);
+
+/* Set up the futex hash table. */
+void futex_bootstrap(void);
 
 #if OPT_A2
 int sys_fork();
@@ -60,6 +60,13 @@ int threadtest3(int, char **);
 int semtest(int, char **);
 int locktest(int, char **);
 int cvtest(int, char **);
+int rwlocktest(int, char **);
+int pitest(int, char **);
+int cvpitest(int, char **);
+int rttest(int, char **);
+int rcubench(int, char **);
+int wqtest(int, char **);
+int spinlockstress(int, char **);
 
 #ifdef UW
 /* Another thread and synchronization test */
@@ -39,6 +39,7 @@
 #include <array.h>
 #include <spinlock.h>
 #include <threadlist.h>
+#include "opt-splwatch.h"
 
 struct cpu;
 
@@ -56,6 +57,17 @@ struct cpu;
 #define SAME_STACK(p1, p2)     (((p1) & STACK_MASK) == ((p2) & STACK_MASK))
 
 
+/* Thread names shorter than this are kept in the thread itself */
+#define THREAD_NAMELEN 32
+
+/* Number of scheduling levels; see thread.c */
+#define SCHED_NLEVELS 4
+
+/* Effective scheduling level, taking inheritance into account */
+#define thread_effpri(t) \
+	((t)->t_inheritpri < (t)->t_priority ? \
+	 (t)->t_inheritpri : (t)->t_priority)
+
 /* States a thread can be in. */
 typedef enum {
 	S_RUN,		/* running */
@@ -71,6 +83,7 @@ struct thread {
 	 * debugger is messed up.
 	 */
 	char *t_name;			/* Name of this thread */
+	char t_namebuf[THREAD_NAMELEN];	/* Storage for short names */
 	const char *t_wchan_name;	/* Name of wait channel, if sleeping */
 	threadstate_t t_state;		/* State this thread is in */
 
@@ -100,6 +113,72 @@ struct thread {
 	bool t_in_interrupt;		/* Are we in an interrupt? */
 	int t_curspl;			/* Current spl*() state */
 	int t_iplhigh_count;		/* # of times IPL has been raised */
+	unsigned t_rcunest;		/* RCU read sections we're in */
+#if OPT_SPLWATCH
+	bool t_splwreport;		/* Printing a splwatch warning */
+#endif
+
+	/*
+	 * Scheduler fields. Protected by the runqueue lock of t_cpu,
+	 * except that a running thread's own cpu may update them from
+	 * schedule() without it.
+	 *
+	 * t_priority is the MLFQ level: 0 is the highest priority.
+	 * t_quantum is how many more hardclocks the thread may run
+	 * before being demoted one level.
+	 *
+	 * t_runticks and t_waitticks are sampled by schedule() once
+	 * per hardclock: they count ticks in which the thread was
+	 * running, and ticks in which it was runnable but waiting on a
+	 * run queue, respectively.
+	 */
+	int t_priority;			/* Scheduling level */
+	unsigned t_quantum;		/* Hardclocks left in quantum */
+	unsigned t_runticks;		/* Hardclocks spent running */
+	unsigned t_waitticks;		/* Hardclocks spent runnable */
+
+	/*
+	 * Priority inheritance (see synch.c). t_inheritpri is the best
+	 * level of any thread waiting on a lock we hold, directly or
+	 * through a chain of lock owners, or SCHED_NLEVELS if none.
+	 * The scheduler uses the better of it and t_priority.
+	 *
+	 * t_inheritpri, t_blockedon and t_waitpri are protected by
+	 * lock_pilock (t_inheritpri also by the runqueue lock of t_cpu,
+	 * for writing). t_heldlocks is only used by the thread itself.
+	 */
+	int t_inheritpri;		/* Inherited level */
+	struct lock *t_blockedon;	/* Lock we're asleep waiting for */
+	int t_waitpri;			/* Level we're waiting on it at */
+	struct lock *t_heldlocks;	/* Locks we hold */
+
+	/*
+	 * Cache affinity, for thread migration. Times are in
+	 * hardclocks of the cpu concerned: t_lastran is t_lastcpu's
+	 * count when the thread last stopped running there, and
+	 * t_lastmoved is t_cpu's count when the thread was moved to
+	 * it. Set under the run queue lock of the cpu concerned.
+	 */
+	bool t_bound;			/* Never move off t_cpu */
+	struct cpu *t_lastcpu;		/* Cpu we last ran on */
+	unsigned t_lastran;		/* When we last ran there */
+	unsigned t_lastmoved;		/* When we were moved to t_cpu */
+
+	/*
+	 * Real-time (EDF) class; see thread_rt_set. Times are in ns.
+	 * Changed only by the thread itself and by schedule() on its
+	 * cpu, under that cpu's run queue lock. A real-time thread is
+	 * never moved to another cpu. While t_rtthrottled it has used
+	 * up this period's budget and is scheduled like any other.
+	 */
+	bool t_rt;			/* In the real-time class */
+	bool t_rtthrottled;		/* Out of budget this period */
+	uint64_t t_rtruntime;		/* Budget per period */
+	uint64_t t_rtperiod;		/* Period, and relative deadline */
+	unsigned t_rtutil;		/* runtime/period, in THREAD_RT_UNITs */
+	uint64_t t_rtdeadline;		/* End of the current period */
+	uint64_t t_rtbudget;		/* Budget left in this period */
+	uint64_t t_rtstart;		/* When budget was last charged */
 
 	/*
 	 * Public fields
@@ -144,6 +223,15 @@ int thread_fork(const char *name, struct proc *proc,
                 void (*func)(void *, unsigned long),
                 void *data1, unsigned long data2);
 
+/*
+ * Like thread_fork, but for a kernel thread that starts on cpu C and
+ * stays there: it is never migrated or stolen by another cpu. For
+ * per-cpu service threads.
+ */
+int thread_fork_oncpu(const char *name, struct cpu *c,
+                      void (*func)(void *, unsigned long),
+                      void *data1, unsigned long data2);
+
 /*
  * Cause the current thread to exit.
  * Interrupts need not be disabled.
@@ -158,15 +246,85 @@ void thread_exit(void);
 void thread_yield(void);
 
 /*
- * Reshuffle the run queue. Called from the timer interrupt.
+ * Sleep until the time (from clock_getns) reaches DEADLINE, in ns.
+ * Resolution is about 131 microseconds; see clock.c.
+ */
+void thread_sleep_until(uint64_t deadline);
+
+/*
+ * Scheduler bookkeeping. Called from the timer interrupt on every
+ * hardclock; charges the tick, demotes threads that used up their
+ * quantum, and periodically boosts everyone back to the top level.
+ * Sets curcpu->c_needresched if the current thread should yield.
  */
 void schedule(void);
 
+/*
+ * Print each runnable thread's level and t_runticks/t_waitticks (for
+ * the "cpustat threads" menu command).
+ */
+void thread_printstats(void);
+
+/*
+ * Set the level thread T inherits through locks it holds, moving it
+ * within its run queue if it's waiting on one. Called from synch.c.
+ */
+void thread_setinherited(struct thread *t, int pri);
+
 /*
  * Potentially migrate ready threads to other CPUs. Called from the
  * timer interrupt.
  */
 void thread_consider_migration(void);
 
+/*
+ * Migration policies for thread_consider_migration:
+ *
+ *    MIGRATE_AGGRESSIVE  balance run queue lengths, moving whatever
+ *                        is at the tail of the queue.
+ *    MIGRATE_AFFINITY    move only threads that haven't run here for
+ *                        thread_migrate_coldticks hardclocks (unless
+ *                        some cpu is idle), and never one that was
+ *                        itself moved in the last
+ *                        thread_migrate_holdticks hardclocks.
+ *
+ * Set from the migrate menu command. The affinity windows count the
+ * hardclocks of the cpu concerned, which don't advance while it's in
+ * tickless idle; a thread that last ran on a cpu that has since been
+ * idle looks as warm there as when it left.
+ */
+#define MIGRATE_AGGRESSIVE	0
+#define MIGRATE_AFFINITY	1
+
+extern int thread_migrate_policy;
+extern unsigned thread_migrate_coldticks;
+extern unsigned thread_migrate_holdticks;
+
+/*
+ * Real-time (earliest deadline first) scheduling.
+ *
+ * thread_rt_set puts the current thread in the real-time class with
+ * a budget of RUNTIME ns in every PERIOD ns, starting now; each
+ * period's end is its deadline. Real-time threads run before all
+ * others, earliest deadline first, and stay on the cpu they were on.
+ * Fails with EBUSY if that would commit more than THREAD_RT_MAXUTIL
+ * of the cpu to real-time threads, or EINVAL if RUNTIME is zero or
+ * more than PERIOD.
+ *
+ * thread_rt_wait ends the current period's work: it sleeps until the
+ * next period starts, which then gets a fresh budget. It returns
+ * false if the deadline for the work just finished was missed. A
+ * thread that uses up its budget before calling it carries on as an
+ * ordinary thread until then.
+ *
+ * thread_rt_clear leaves the real-time class; exiting does too.
+ */
+#define THREAD_RT_UNIT		1000000	/* utilization of a whole cpu */
+#define THREAD_RT_MAXUTIL	900000	/* most that can be committed */
+
+int thread_rt_set(uint64_t runtime, uint64_t period);
+bool thread_rt_wait(void);
+void thread_rt_clear(void);
+
 
 #endif /* _THREAD_H_ */
@@ -32,6 +32,7 @@
 
 
 #include <array.h>
+#include "opt-vfsbiglock.h"
 
 
 /*
@@ -185,12 +186,36 @@ DECLARRAY(vnode);
 DEFARRAY(vnode, VFSINLINE);
 
 /*
- * Global one-big-lock for all filesystem operations.
- * You must remove this for the filesystem assignment.
+ * VFS locking.
+ *
+ * Normally the VFS layer and the filesystems use fine-grained locks.
+ * The lock order, outermost first, is:
+ *
+ *    1. the VFS device list lock (vfslist.c);
+ *    2. per-vnode locks: a directory before any file in it (for SFS,
+ *       sv_lock);
+ *    3. per-filesystem vnode table locks (sfs_vnlock, emu's e_lock);
+ *    4. per-filesystem free block map locks (sfs_freemaplock);
+ *    5. spinlocks: the bootfs lock (vfslookup.c), then vn_countlock.
+ *
+ * No vnode lock is held across a call back into the VFS layer, and
+ * VOP_DECREF (which may reclaim) is only called holding locks that
+ * come before the vnode's own.
+ *
+ * With the vfsbiglock option there is instead one global recursive
+ * lock, taken on entry to every filesystem operation as OS/161 has
+ * always done; the fine-grained locks are still taken but are then
+ * never contended. Without the option the vfs_biglock calls compile
+ * to nothing.
  */
+#if OPT_VFSBIGLOCK
 void vfs_biglock_acquire(void);
 void vfs_biglock_release(void);
 bool vfs_biglock_do_i_hold(void);
+#else
+#define vfs_biglock_acquire()	((void)0)
+#define vfs_biglock_release()	((void)0)
+#endif
 
 
 #endif /* _VFS_H_ */
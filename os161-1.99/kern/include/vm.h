@@ -51,6 +51,15 @@ void vm_bootstrap(void);
 /* Fault handling function called by trap code */
 int vm_fault(int faulttype, vaddr_t faultaddress);
 
+/*
+ * Translate a user address in AS to a physical address, without
+ * faulting anything in. Returns EFAULT if VADDR isn't mapped. The
+ * page comes back pinned, so it stays put until the caller is done
+ * with it and calls coremap_unpin on it.
+ */
+struct addrspace;
+int vm_translate(struct addrspace *as, vaddr_t vaddr, paddr_t *ret);
+
 /* Allocate/free kernel heap pages (called by kmalloc/kfree) */
 vaddr_t alloc_kpages(int npages);
 void free_kpages(vaddr_t addr);
@@ -31,6 +31,8 @@
 #define _VNODE_H_
 
 
+#include <spinlock.h>
+
 struct uio;
 struct stat;
 
@@ -50,10 +52,13 @@ struct stat;
  * vn_opencount is managed using VOP_INCOPEN and VOP_DECOPEN by
  * vfs_open() and vfs_close(). Code above the VFS layer should not
  * need to worry about it.
+ *
+ * Both counts are protected by vn_countlock.
  */
 struct vnode {
 	int vn_refcount;                /* Reference count */
 	int vn_opencount;
+	struct spinlock vn_countlock;   /* Lock for vn_refcount/opencount */
 
 	struct fs *vn_fs;               /* Filesystem vnode belongs to */
 
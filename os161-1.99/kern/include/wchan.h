@@ -36,6 +36,7 @@
 
 
 struct wchan; /* Opaque */
+struct thread;
 
 /*
  * Create a wait channel. Use NAME as a symbolic name for the channel.
@@ -81,5 +82,22 @@ void wchan_sleep(struct wchan *wc);
 void wchan_wakeone(struct wchan *wc);
 void wchan_wakeall(struct wchan *wc);
 
+/*
+ * Wake up to N threads sleeping on a wait channel, and return the
+ * number woken. Waking several threads at once this way (or with
+ * wchan_wakeall) takes each cpu's run queue lock only once.
+ */
+unsigned wchan_wakemany(struct wchan *wc, unsigned n);
+
+/*
+ * Move all threads sleeping on FROM to TO without waking them; they
+ * will be woken by whoever wakes TO. Neither channel should already
+ * be locked. FROM is locked before TO, so moves between two channels
+ * must always go the same way. If MOVED isn't NULL, it's called with
+ * each thread moved (and DATA), with both channels locked.
+ */
+void wchan_moveall(struct wchan *from, struct wchan *to,
+		   void (*moved)(struct thread *, void *), void *data);
+
 
 #endif /* _WCHAN_H_ */
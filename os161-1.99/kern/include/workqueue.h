@@ -0,0 +1,28 @@
+/*
+ * Workqueues: deferred work run by per-cpu kernel worker threads.
+ *
+ * workqueue_enqueue arranges for FUNC(ARG) to be called soon from the
+ * current cpu's worker thread, where it may sleep, take locks, and
+ * so on. It may be called from interrupt handlers. Work is run in
+ * the order it was queued.
+ *
+ * workqueue_enqueue_delayed does the same once DELAYNS nanoseconds
+ * have passed, using a timeout on the current cpu's timer wheel.
+ *
+ * Both take work items from a fixed per-cpu pool so they never have
+ * to allocate memory; they return ENOMEM if the pool is used up, and
+ * 0 on success.
+ *
+ * workqueue_bootstrap starts the workers; it is called from boot()
+ * once all cpus are running. Nothing may be queued before then.
+ */
+
+#ifndef _WORKQUEUE_H_
+#define _WORKQUEUE_H_
+
+void workqueue_bootstrap(void);
+int workqueue_enqueue(void (*func)(void *), void *arg);
+int workqueue_enqueue_delayed(void (*func)(void *), void *arg,
+			      uint64_t delayns);
+
+#endif /* _WORKQUEUE_H_ */
@@ -49,7 +49,16 @@
 #include <syscall.h>
 #include <test.h>
 #include <version.h>
+#include <lockstat.h>
+#include <splwatch.h>
+#include <workqueue.h>
+#include <rcu.h>
+#include <uw-vmstats.h>
+#include <swap.h>
 #include "autoconf.h"  // for pseudoconfig
+#include "opt-lockstat.h"
+#include "opt-dumbvm.h"
+#include "opt-splwatch.h"
 
 
 /*
@@ -109,7 +118,6 @@ boot(void)
 	ram_bootstrap();
 	proc_bootstrap();
 	thread_bootstrap();
-	hardclock_bootstrap();
 	vfs_bootstrap();
 
 	/* Probe and initialize devices. Interrupts should come on. */
@@ -117,14 +125,30 @@ boot(void)
 	KASSERT(curthread->t_curspl > 0);
 	mainbus_bootstrap();
 	KASSERT(curthread->t_curspl == 0);
+#if OPT_LOCKSTAT
+	/* The clock is attached now, so lock timing can start. */
+	lockstat_bootstrap();
+#endif
+#if OPT_SPLSTAT
+	splstat_bootstrap();
+#endif
+#if OPT_SPLWATCH
+	splwatch_bootstrap();
+#endif
 	/* Now do pseudo-devices. */
 	pseudoconfig();
 	kprintf("\n");
 
 	/* Late phase of initialization. */
 	vm_bootstrap();
+	futex_bootstrap();
 	kprintf_bootstrap();
 	thread_start_cpus();
+	rcu_bootstrap();
+	workqueue_bootstrap();
+#if !OPT_DUMBVM
+	swap_bootstrap();
+#endif
 
 	/* Default bootfs - but ignore failure, in case emu0 doesn't exist */
 	vfs_setbootfs("emu0");
@@ -151,6 +175,10 @@ shutdown(void)
 	vfs_clearcurdir();
 	vfs_unmountall();
 
+#if !OPT_DUMBVM
+	vmstats_print();
+#endif
+
 	thread_shutdown();
 
 	splhigh();
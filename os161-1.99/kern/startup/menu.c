@@ -35,6 +35,7 @@
 #include <lib.h>
 #include <uio.h>
 #include <clock.h>
+#include <cpu.h>
 #include <thread.h>
 #include <proc.h>
 #include <synch.h>
@@ -42,9 +43,14 @@
 #include <sfs.h>
 #include <syscall.h>
 #include <test.h>
+#include <coremap.h>
+#include <lockstat.h>
+#include <splwatch.h>
 #include "opt-synchprobs.h"
 #include "opt-sfs.h"
 #include "opt-net.h"
+#include "opt-lockstat.h"
+#include "opt-splwatch.h"
 
 /*
  * In-kernel menu and command dispatcher.
@@ -398,6 +404,179 @@ cmd_bootfs(int nargs, char **args)
 	return vfs_setbootfs(device);
 }
 
+/*
+ * Command for per-cpu statistics.
+ *
+ *    cpustat           print the counters
+ *    cpustat reset     zero them, to start a measurement
+ *    cpustat threads   print scheduler stats of the runnable threads
+ */
+static
+int
+cmd_cpustat(int nargs, char **args)
+{
+	if (nargs > 2 || (nargs == 2 && strcmp(args[1], "reset") &&
+			  strcmp(args[1], "threads"))) {
+		kprintf("Usage: cpustat [reset | threads]\n");
+		return EINVAL;
+	}
+	if (nargs == 2 && !strcmp(args[1], "reset")) {
+		cpu_resetstats();
+		return 0;
+	}
+	if (nargs == 2) {
+		thread_printstats();
+		return 0;
+	}
+
+	cpu_printstats();
+
+	return 0;
+}
+
+/*
+ * Command for printing lock contention statistics.
+ *
+ *    lockstat          top 10 lock classes by wait time
+ *    lockstat N        top N
+ *    lockstat reset    zero the counters
+ */
+static
+int
+cmd_lockstat(int nargs, char **args)
+{
+#if OPT_LOCKSTAT
+	int n;
+
+	if (nargs > 2) {
+		kprintf("Usage: lockstat [N | reset]\n");
+		return EINVAL;
+	}
+	if (nargs == 2 && !strcmp(args[1], "reset")) {
+		lockstat_reset();
+		return 0;
+	}
+
+	n = (nargs == 2) ? atoi(args[1]) : 10;
+	if (n <= 0) {
+		kprintf("Usage: lockstat [N | reset]\n");
+		return EINVAL;
+	}
+	lockstat_print(n);
+#else
+	(void)nargs;
+	(void)args;
+
+	kprintf("Kernel not configured with the lockstat option\n");
+#endif
+
+	return 0;
+}
+
+/*
+ * Command for the interrupts-off watchdog.
+ *
+ *    splwatch            top 10 call sites by longest hold
+ *    splwatch N          top N
+ *    splwatch reset      zero the counters
+ *    splwatch warn US    warn about holds longer than US microseconds
+ *    splwatch panic US   panic on holds longer than US microseconds
+ *    splwatch off        no limit
+ */
+static
+int
+cmd_splwatch(int nargs, char **args)
+{
+#if OPT_SPLWATCH
+	const char *usage =
+		"Usage: splwatch [N | reset | warn US | panic US | off]\n";
+	int n;
+
+	if (nargs == 3 && (!strcmp(args[1], "warn") ||
+			   !strcmp(args[1], "panic"))) {
+		n = atoi(args[2]);
+		if (n <= 0) {
+			kprintf("%s", usage);
+			return EINVAL;
+		}
+		splwatch_setlimit((uint64_t)n * 1000, args[1][0] == 'p');
+		return 0;
+	}
+	if (nargs > 2) {
+		kprintf("%s", usage);
+		return EINVAL;
+	}
+	if (nargs == 2 && !strcmp(args[1], "reset")) {
+		splwatch_reset();
+		return 0;
+	}
+	if (nargs == 2 && !strcmp(args[1], "off")) {
+		splwatch_setlimit(0, false);
+		return 0;
+	}
+
+	n = (nargs == 2) ? atoi(args[1]) : 10;
+	if (n <= 0) {
+		kprintf("%s", usage);
+		return EINVAL;
+	}
+	splwatch_print(n);
+#else
+	(void)nargs;
+	(void)args;
+
+	kprintf("Kernel not configured with the splwatch option\n");
+#endif
+
+	return 0;
+}
+
+/*
+ * Command for choosing the thread migration policy (see thread.h).
+ *
+ *    migrate                           show the current policy
+ *    migrate aggressive                just balance the run queues
+ *    migrate affinity [COLD [HOLD]]    respect cache affinity, with
+ *                                      thresholds in hardclocks
+ */
+static
+int
+cmd_migrate(int nargs, char **args)
+{
+	int cold, hold;
+
+	if (nargs == 2 && !strcmp(args[1], "aggressive")) {
+		thread_migrate_policy = MIGRATE_AGGRESSIVE;
+	}
+	else if (nargs >= 2 && nargs <= 4 && !strcmp(args[1], "affinity")) {
+		cold = (nargs >= 3) ? atoi(args[2]) :
+			(int)thread_migrate_coldticks;
+		hold = (nargs >= 4) ? atoi(args[3]) :
+			(int)thread_migrate_holdticks;
+		if (cold < 0 || hold < 0) {
+			kprintf("migrate: thresholds must not be negative\n");
+			return EINVAL;
+		}
+		thread_migrate_coldticks = cold;
+		thread_migrate_holdticks = hold;
+		thread_migrate_policy = MIGRATE_AFFINITY;
+	}
+	else if (nargs != 1) {
+		kprintf("Usage: migrate [aggressive | affinity [COLD [HOLD]]]\n");
+		return EINVAL;
+	}
+
+	if (thread_migrate_policy == MIGRATE_AGGRESSIVE) {
+		kprintf("Migration policy: aggressive\n");
+	}
+	else {
+		kprintf("Migration policy: affinity, cold after %u "
+			"hardclocks, hold for %u\n",
+			thread_migrate_coldticks, thread_migrate_holdticks);
+	}
+	return 0;
+}
+
 static
 int
 cmd_kheapstats(int nargs, char **args)
@@ -410,6 +589,21 @@ cmd_kheapstats(int nargs, char **args)
 	return 0;
 }
 
+/*
+ * Command for printing physical memory use.
+ */
+static
+int
+cmd_coremap(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	coremap_printstats();
+
+	return 0;
+}
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -451,6 +645,7 @@ static const char *opsmenu[] = {
 	"[sync]    Sync filesystems          ",
 	"[panic]   Intentional panic         ",
 	"[dth]     Enable debugging output   ",
+	"[migrate] Thread migration policy   ",
 	"[q]       Quit and shut down        ",
 	NULL
 };
@@ -480,6 +675,13 @@ static const char *testmenu[] = {
 	"[sy1] Semaphore test                ",
 	"[sy2] Lock test             (1)     ",
 	"[sy3] CV test               (1)     ",
+	"[sy4] RW lock test                  ",
+	"[sy5] Priority inheritance test     ",
+	"[sy6] CV priority inheritance test  ",
+	"[rt1] Real-time (EDF) test          ",
+	"[rb1] Lookup scaling benchmark      ",
+	"[wq1] Workqueue test                ",
+	"[sl1] Spinlock stress test          ",
 #ifdef UW
 	"[uw1] UW lock test          (1)     ",
 	"[uw2] UW vmstats test       (3)     ",
@@ -520,6 +722,10 @@ static const char *mainmenu[] = {
 #endif /* UW */
 #endif
 	"[kh] Kernel heap stats              ",
+	"[cm] Physical memory stats          ",
+	"[cpustat] Per-cpu statistics        ",
+	"[lockstat] Lock contention stats    ",
+	"[splwatch] Interrupts-off watchdog  ",
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -562,6 +768,7 @@ static struct {
 	{ "sync",	cmd_sync },
 	{ "panic",	cmd_panic },
 	{ "dth",	cmd_dth },
+	{ "migrate",	cmd_migrate },
 	{ "q",		cmd_quit },
 	{ "exit",	cmd_quit },
 	{ "halt",	cmd_quit },
@@ -577,6 +784,10 @@ static struct {
 
 	/* stats */
 	{ "kh",         cmd_kheapstats },
+	{ "cm",		cmd_coremap },
+	{ "cpustat",	cmd_cpustat },
+	{ "lockstat",	cmd_lockstat },
+	{ "splwatch",	cmd_splwatch },
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -594,6 +805,13 @@ static struct {
 	/* synchronization assignment tests */
 	{ "sy2",	locktest },
 	{ "sy3",	cvtest },
+	{ "sy4",	rwlocktest },
+	{ "sy5",	pitest },
+	{ "sy6",	cvpitest },
+	{ "rt1",	rttest },
+	{ "rb1",	rcubench },
+	{ "wq1",	wqtest },
+	{ "sl1",	spinlockstress },
 #ifdef UW
 	{ "uw1",	uwlocktest1 },
 	{ "uw2",	uwvmstatstest },
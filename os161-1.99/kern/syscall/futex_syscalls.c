@@ -0,0 +1,241 @@
+/*
+ * Futexes: blocking on a word of user memory.
+ *
+ * futex_wait(addr, expected) sleeps if *addr still equals EXPECTED;
+ * futex_wake(addr, n) wakes up to N threads sleeping on ADDR. User
+ * code keeps its lock or condition state in the word and only calls
+ * in here when it has to block or someone is blocked, so the
+ * uncontended case costs no system call at all.
+ *
+ * Waiters are kept in a hash table keyed by the physical address of
+ * the word, so that two mappings of the same page would find the
+ * same waiters. That only works while the page stays put, so each
+ * waiter keeps it pinned for as long as it's queued. Each bucket has
+ * a spinlock and a short list of futexes that currently have waiters;
+ * a futex (with its wchan) is created by its first waiter and freed
+ * when the last one is woken.
+ *
+ * The value check is done under the bucket lock, reading the word
+ * through its physical address, so it can't fault. A wake that
+ * changes the word and then calls futex_wake must take the same
+ * bucket lock, so it can't slip in between the check and the sleep.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <proc.h>
+#include <current.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <coremap.h>
+#include <copyinout.h>
+#include <syscall.h>
+
+#define FUTEX_NBUCKETS	64	/* Size of hash table; power of 2 */
+
+struct futex {
+	struct futex *fx_next;		/* Next in bucket */
+	paddr_t fx_paddr;		/* Physical address of the word */
+	struct wchan *fx_wchan;		/* Where its waiters sleep */
+	unsigned fx_nwaiters;		/* Number of threads asleep */
+};
+
+struct futexbucket {
+	struct spinlock fb_lock;	/* Protects the list and futexes */
+	struct futex *fb_futexes;	/* Futexes with waiters */
+};
+
+static struct futexbucket futex_table[FUTEX_NBUCKETS];
+
+void
+futex_bootstrap(void)
+{
+	unsigned i;
+
+	for (i=0; i<FUTEX_NBUCKETS; i++) {
+		spinlock_init(&futex_table[i].fb_lock);
+		futex_table[i].fb_futexes = NULL;
+	}
+}
+
+static
+struct futexbucket *
+futex_bucket(paddr_t paddr)
+{
+	/* The low two bits are always zero; words in a page are close. */
+	return &futex_table[((paddr >> 2) ^ (paddr >> 12))
+			    & (FUTEX_NBUCKETS - 1)];
+}
+
+/*
+ * Look up the futex for PADDR. Must hold the bucket lock.
+ */
+static
+struct futex *
+futex_find(struct futexbucket *fb, paddr_t paddr)
+{
+	struct futex *fx;
+
+	KASSERT(spinlock_do_i_hold(&fb->fb_lock));
+
+	for (fx = fb->fb_futexes; fx != NULL; fx = fx->fx_next) {
+		if (fx->fx_paddr == paddr) {
+			return fx;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Check a user futex address and find the physical address behind
+ * it. The copyin makes sure the page is valid before we translate
+ * it; the page comes back pinned, so it can't be evicted (and its
+ * frame reused) while we're looking at it, and the caller must
+ * coremap_unpin it when done.
+ */
+static
+int
+futex_getpaddr(userptr_t addr, paddr_t *ret)
+{
+	struct addrspace *as;
+	int val, result;
+
+	if (((vaddr_t)addr & (sizeof(int) - 1)) != 0) {
+		return EINVAL;
+	}
+	result = copyin((const_userptr_t)addr, &val, sizeof(val));
+	if (result) {
+		return result;
+	}
+	as = curproc_getas();
+	if (as == NULL) {
+		return EFAULT;
+	}
+	return vm_translate(as, (vaddr_t)addr, ret);
+}
+
+int
+sys_futex_wait(userptr_t addr, int expected)
+{
+	struct futexbucket *fb;
+	struct futex *fx, *newfx;
+	paddr_t paddr;
+	int result;
+
+	result = futex_getpaddr(addr, &paddr);
+	if (result) {
+		return result;
+	}
+	fb = futex_bucket(paddr);
+
+	/*
+	 * Allocate a futex in case there isn't one yet; we can't do
+	 * that while holding the bucket lock.
+	 */
+	newfx = kmalloc(sizeof(*newfx));
+	if (newfx == NULL) {
+		coremap_unpin(paddr & PAGE_FRAME);
+		return ENOMEM;
+	}
+	newfx->fx_wchan = wchan_create("futex");
+	if (newfx->fx_wchan == NULL) {
+		kfree(newfx);
+		coremap_unpin(paddr & PAGE_FRAME);
+		return ENOMEM;
+	}
+
+	spinlock_acquire(&fb->fb_lock);
+
+	if (*(volatile int *)PADDR_TO_KVADDR(paddr) != expected) {
+		spinlock_release(&fb->fb_lock);
+		coremap_unpin(paddr & PAGE_FRAME);
+		wchan_destroy(newfx->fx_wchan);
+		kfree(newfx);
+		return EAGAIN;
+	}
+
+	fx = futex_find(fb, paddr);
+	if (fx == NULL) {
+		fx = newfx;
+		newfx = NULL;
+		fx->fx_paddr = paddr;
+		fx->fx_nwaiters = 0;
+		fx->fx_next = fb->fb_futexes;
+		fb->fb_futexes = fx;
+	}
+	fx->fx_nwaiters++;
+
+	wchan_lock(fx->fx_wchan);
+	spinlock_release(&fb->fb_lock);
+	wchan_sleep(fx->fx_wchan);
+
+	/*
+	 * Whoever woke us took us off the count (and maybe freed FX).
+	 * The page was kept pinned while we slept, so that a wake
+	 * finds it at the same physical address; it can go now.
+	 */
+	coremap_unpin(paddr & PAGE_FRAME);
+
+	if (newfx != NULL) {
+		wchan_destroy(newfx->fx_wchan);
+		kfree(newfx);
+	}
+	return 0;
+}
+
+int
+sys_futex_wake(userptr_t addr, int count, int *retval)
+{
+	struct futexbucket *fb;
+	struct futex *fx, **fxp;
+	struct wchan *deadwchan;
+	paddr_t paddr;
+	unsigned n;
+	int result;
+
+	if (count < 0) {
+		return EINVAL;
+	}
+
+	result = futex_getpaddr(addr, &paddr);
+	if (result) {
+		return result;
+	}
+	fb = futex_bucket(paddr);
+	deadwchan = NULL;
+	n = 0;
+
+	spinlock_acquire(&fb->fb_lock);
+	fx = futex_find(fb, paddr);
+	if (fx != NULL) {
+		n = (unsigned)count < fx->fx_nwaiters ?
+			(unsigned)count : fx->fx_nwaiters;
+		n = wchan_wakemany(fx->fx_wchan, n);
+		fx->fx_nwaiters -= n;
+		if (fx->fx_nwaiters == 0) {
+			/* Last waiter gone; take it out of the table. */
+			for (fxp = &fb->fb_futexes; *fxp != fx;
+			     fxp = &(*fxp)->fx_next) {
+				KASSERT(*fxp != NULL);
+			}
+			*fxp = fx->fx_next;
+			deadwchan = fx->fx_wchan;
+		}
+		else {
+			fx = NULL;
+		}
+	}
+	spinlock_release(&fb->fb_lock);
+	coremap_unpin(paddr & PAGE_FRAME);
+
+	if (deadwchan != NULL) {
+		wchan_destroy(deadwchan);
+		kfree(fx);
+	}
+
+	*retval = n;
+	return 0;
+}
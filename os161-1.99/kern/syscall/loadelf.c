@@ -42,6 +42,11 @@
  * circumstances, as_prepare_load and as_complete_load probably don't
  * need to do anything.
  *
+ * With the paged VM system (that is, without dumbvm), "loading" a
+ * chunk only attaches the file to the address space, with
+ * as_define_file; each page is read in when the program first
+ * touches it.
+ *
  * If you wanted to support memory-mapped executables you would need
  * to rearrange this to map each segment.
  *
@@ -59,6 +64,7 @@
 #include <addrspace.h>
 #include <vnode.h>
 #include <elf.h>
+#include "opt-dumbvm.h"
 
 /*
  * Load a segment at virtual address VADDR. The segment in memory
@@ -73,7 +79,11 @@
  * executable whose load address is in kernel space. If you should
  * change this code to not use uiomove, be sure to check for this case
  * explicitly.
+ *
+ * Without dumbvm nothing is read here; see above. (The address space
+ * code has already rejected segments in kernel space.)
  */
+#if OPT_DUMBVM
 static
 int
 load_segment(struct addrspace *as, struct vnode *v,
@@ -144,6 +154,27 @@ load_segment(struct addrspace *as, struct vnode *v,
 	
 	return result;
 }
+#else
+static
+int
+load_segment(struct addrspace *as, struct vnode *v,
+	     off_t offset, vaddr_t vaddr, 
+	     size_t memsize, size_t filesize,
+	     int is_executable)
+{
+	(void)is_executable;
+
+	if (filesize > memsize) {
+		kprintf("ELF: warning: segment filesize > segment memsize\n");
+		filesize = memsize;
+	}
+
+	DEBUG(DB_EXEC, "ELF: Mapping %lu bytes at 0x%lx\n", 
+	      (unsigned long) filesize, (unsigned long) vaddr);
+
+	return as_define_file(as, vaddr, v, offset, filesize);
+}
+#endif /* OPT_DUMBVM */
 
 /*
  * Load an ELF executable user program into the current address space.
@@ -0,0 +1,261 @@
+/*
+ * Lookup scaling benchmark.
+ *
+ * One reader thread per cpu looks up entries in a small table as
+ * fast as it can, while a writer thread changes a random entry every
+ * millisecond. The table is protected three ways in turn: by a sleep
+ * lock, by a seqlock, and by RCU. For each, we print how many lookups
+ * per millisecond got done with 1, 2, ... cpus reading; lookups that
+ * take a lock should stop scaling well before the lockless ones do.
+ *
+ * Each entry holds a value and its complement, which readers check,
+ * so a torn read shows up as an error.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <cpu.h>
+#include <thread.h>
+#include <current.h>
+#include <synch.h>
+#include <seqlock.h>
+#include <rcu.h>
+#include <test.h>
+
+#define RB_NKEYS	64
+#define RB_MAXCPUS	32
+#define RB_RUNNS	200000000ULL	/* 200 ms per run */
+#define RB_WRITENS	1000000ULL	/* 1 ms between updates */
+
+#define RB_LOCK		0
+#define RB_SEQLOCK	1
+#define RB_RCU		2
+#define RB_NMODES	3
+
+struct rbentry {
+	unsigned re_value;
+	unsigned re_check;		/* ~re_value */
+};
+
+static const char *const rb_modenames[RB_NMODES] = {
+	"lock", "seqlock", "rcu",
+};
+
+/* For RB_LOCK and RB_SEQLOCK */
+static struct rbentry rb_table[RB_NKEYS];
+static struct lock *rb_lock;
+static struct seqlock rb_seqlock;
+
+/* For RB_RCU */
+static struct rbentry *rb_rcutable[RB_NKEYS];
+
+static int rb_mode;
+static volatile bool rb_stop;
+static volatile unsigned long rb_counts[RB_MAXCPUS];
+static volatile unsigned rb_errors;
+static struct semaphore *rb_donesem;
+
+/*
+ * Look up KEY; returns false if the entry was inconsistent.
+ */
+static
+bool
+rb_lookup(unsigned key)
+{
+	struct rbentry *e;
+	unsigned value, check, seq;
+
+	switch (rb_mode) {
+	    case RB_LOCK:
+		lock_acquire(rb_lock);
+		value = rb_table[key].re_value;
+		check = rb_table[key].re_check;
+		lock_release(rb_lock);
+		break;
+	    case RB_SEQLOCK:
+		do {
+			seq = seqlock_read_begin(&rb_seqlock);
+			value = rb_table[key].re_value;
+			check = rb_table[key].re_check;
+		} while (seqlock_read_retry(&rb_seqlock, seq));
+		break;
+	    default:
+		rcu_read_lock();
+		e = rcu_dereference(rb_rcutable[key]);
+		value = e->re_value;
+		check = e->re_check;
+		rcu_read_unlock();
+		break;
+	}
+	return check == ~value;
+}
+
+static
+void
+rb_reader(void *junk, unsigned long num)
+{
+	unsigned long count;
+	unsigned key;
+
+	(void)junk;
+
+	count = 0;
+	key = num;
+	while (!rb_stop) {
+		if (!rb_lookup(key)) {
+			rb_errors++;
+		}
+		key = (key * 7 + 1) % RB_NKEYS;
+		count++;
+	}
+	rb_counts[num] = count;
+	V(rb_donesem);
+}
+
+static
+void
+rb_writer(void *junk, unsigned long num)
+{
+	struct rbentry *e, *old;
+	unsigned key, value;
+
+	(void)junk;
+	(void)num;
+
+	key = 0;
+	value = 0;
+	while (!rb_stop) {
+		key = (key * 13 + 5) % RB_NKEYS;
+		value++;
+		switch (rb_mode) {
+		    case RB_LOCK:
+			lock_acquire(rb_lock);
+			rb_table[key].re_value = value;
+			rb_table[key].re_check = ~value;
+			lock_release(rb_lock);
+			break;
+		    case RB_SEQLOCK:
+			seqlock_write_begin(&rb_seqlock);
+			rb_table[key].re_value = value;
+			rb_table[key].re_check = ~value;
+			seqlock_write_end(&rb_seqlock);
+			break;
+		    default:
+			e = kmalloc(sizeof(*e));
+			if (e == NULL) {
+				break;
+			}
+			e->re_value = value;
+			e->re_check = ~value;
+			old = rb_rcutable[key];
+			rcu_assign_pointer(rb_rcutable[key], e);
+			rcu_synchronize();
+			kfree(old);
+			break;
+		}
+		thread_sleep_until(clock_getns() + RB_WRITENS);
+	}
+	V(rb_donesem);
+}
+
+/*
+ * Run MODE with readers on the first NCPUS cpus; returns lookups/ms.
+ */
+static
+unsigned long
+rb_run(int mode, unsigned ncpus)
+{
+	unsigned long total;
+	unsigned i;
+	int result;
+
+	rb_mode = mode;
+	rb_stop = false;
+	for (i=0; i<ncpus; i++) {
+		rb_counts[i] = 0;
+		result = thread_fork_oncpu("rb_reader", cpu_bynumber(i),
+					   rb_reader, NULL, i);
+		if (result) {
+			panic("rcubench: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	result = thread_fork("rb_writer", NULL, rb_writer, NULL, 0);
+	if (result) {
+		panic("rcubench: thread_fork failed: %s\n",
+		      strerror(result));
+	}
+
+	thread_sleep_until(clock_getns() + RB_RUNNS);
+	rb_stop = true;
+	for (i=0; i<ncpus + 1; i++) {
+		P(rb_donesem);
+	}
+
+	total = 0;
+	for (i=0; i<ncpus; i++) {
+		total += rb_counts[i];
+	}
+	return total / (RB_RUNNS / 1000000);
+}
+
+int
+rcubench(int nargs, char **args)
+{
+	unsigned i, n, ncpus;
+	int mode;
+
+	(void)nargs;
+	(void)args;
+
+	ncpus = cpu_count();
+	if (ncpus > RB_MAXCPUS) {
+		ncpus = RB_MAXCPUS;
+	}
+
+	rb_lock = lock_create("rb_lock");
+	rb_donesem = sem_create("rb_donesem", 0);
+	if (rb_lock == NULL || rb_donesem == NULL) {
+		panic("rcubench: out of memory\n");
+	}
+	seqlock_init(&rb_seqlock);
+	for (i=0; i<RB_NKEYS; i++) {
+		rb_table[i].re_value = 0;
+		rb_table[i].re_check = ~0U;
+		rb_rcutable[i] = kmalloc(sizeof(struct rbentry));
+		if (rb_rcutable[i] == NULL) {
+			panic("rcubench: out of memory\n");
+		}
+		rb_rcutable[i]->re_value = 0;
+		rb_rcutable[i]->re_check = ~0U;
+	}
+	rb_errors = 0;
+
+	kprintf("Lookups per ms, by number of cpus reading:\n");
+	kprintf("%4s", "cpus");
+	for (mode = 0; mode < RB_NMODES; mode++) {
+		kprintf(" %10s", rb_modenames[mode]);
+	}
+	kprintf("\n");
+	for (n = 1; n <= ncpus; n++) {
+		kprintf("%4u", n);
+		for (mode = 0; mode < RB_NMODES; mode++) {
+			kprintf(" %10lu", rb_run(mode, n));
+		}
+		kprintf("\n");
+	}
+	if (rb_errors > 0) {
+		kprintf("%u inconsistent lookups!\n", rb_errors);
+	}
+
+	for (i=0; i<RB_NKEYS; i++) {
+		kfree(rb_rcutable[i]);
+		rb_rcutable[i] = NULL;
+	}
+	seqlock_cleanup(&rb_seqlock);
+	sem_destroy(rb_donesem);
+	lock_destroy(rb_lock);
+
+	return 0;
+}
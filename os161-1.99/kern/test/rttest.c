@@ -0,0 +1,207 @@
+/*
+ * Real-time (EDF) scheduling test.
+ *
+ * Puts a few periodic real-time threads on one cpu along with more
+ * CPU hogs than it has room for, and checks that every job finishes
+ * by its deadline anyway. Each job spins for half its budget, by the
+ * clock, so it never needs more than it asked for. Also checks that
+ * admission control turns away a thread that would overcommit the
+ * cpu.
+ *
+ * Everything is started on the cpu the test runs on and kept there,
+ * so the hogs can't just be migrated out of the way.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <cpu.h>
+#include <thread.h>
+#include <current.h>
+#include <synch.h>
+#include <test.h>
+
+#define RT_NHOGS	3
+#define RT_NTHREADS	3
+#define RT_NJOBS	50
+#define RT_MS		1000000ULL	/* ns */
+
+/* Runtime and period of each real-time thread: 60% in all. */
+static const struct {
+	uint64_t runtime, period;
+} rtparams[RT_NTHREADS] = {
+	{ 1 * RT_MS, 5 * RT_MS },
+	{ 2 * RT_MS, 10 * RT_MS },
+	{ 4 * RT_MS, 20 * RT_MS },
+};
+
+static struct semaphore *rtready;
+static struct semaphore *rtdone;
+static volatile bool rtstop;
+static volatile unsigned rtmisses[RT_NTHREADS];
+static volatile uint64_t rtworst[RT_NTHREADS];
+static volatile int rtsetresult[RT_NTHREADS];
+static volatile int rtgreedyresult;
+
+static
+void
+rthog(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	while (!rtstop) {
+		/* burn cpu */
+	}
+	V(rtdone);
+}
+
+static
+void
+rtthread(void *junk, unsigned long num)
+{
+	uint64_t start, finish, deadline;
+	unsigned i;
+
+	(void)junk;
+
+	rtsetresult[num] = thread_rt_set(rtparams[num].runtime,
+					 rtparams[num].period);
+	V(rtready);
+	if (rtsetresult[num]) {
+		V(rtdone);
+		return;
+	}
+
+	for (i=0; i<RT_NJOBS; i++) {
+		/* Each job is released at the start of its period */
+		deadline = curthread->t_rtdeadline;
+		start = deadline - rtparams[num].period;
+		do {
+			finish = clock_getns();
+		} while (finish - start < rtparams[num].runtime / 2);
+
+		if (finish - start > rtworst[num]) {
+			rtworst[num] = finish - start;
+		}
+		if (!thread_rt_wait()) {
+			rtmisses[num]++;
+		}
+	}
+
+	thread_rt_clear();
+	V(rtdone);
+}
+
+static
+void
+rtgreedy(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	/* Half the cpu on top of the 60% already committed */
+	rtgreedyresult = thread_rt_set(5 * RT_MS, 10 * RT_MS);
+	thread_rt_clear();
+	V(rtdone);
+}
+
+static
+void
+rtfork(const char *name, struct cpu *c,
+       void (*func)(void *, unsigned long), unsigned long num)
+{
+	int result;
+
+	result = thread_fork_oncpu(name, c, func, NULL, num);
+	if (result) {
+		panic("rttest: thread_fork failed: %s\n", strerror(result));
+	}
+}
+
+int
+rttest(int nargs, char **args)
+{
+	struct cpu *c;
+	unsigned i;
+	bool failed;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting real-time scheduling test...\n");
+
+	rtready = sem_create("rtready", 0);
+	rtdone = sem_create("rtdone", 0);
+	if (rtready == NULL || rtdone == NULL) {
+		panic("rttest: out of memory\n");
+	}
+	rtstop = false;
+	for (i=0; i<RT_NTHREADS; i++) {
+		rtmisses[i] = 0;
+		rtworst[i] = 0;
+		rtsetresult[i] = -1;
+	}
+	rtgreedyresult = -1;
+
+	c = curcpu->c_self;
+	for (i=0; i<RT_NHOGS; i++) {
+		rtfork("rthog", c, rthog, i);
+	}
+	for (i=0; i<RT_NTHREADS; i++) {
+		rtfork("rtthread", c, rtthread, i);
+	}
+	for (i=0; i<RT_NTHREADS; i++) {
+		P(rtready);
+	}
+	rtfork("rtgreedy", c, rtgreedy, 0);
+
+	/* Wait for the real-time threads and rtgreedy, then the hogs. */
+	for (i=0; i<RT_NTHREADS + 1; i++) {
+		P(rtdone);
+	}
+	rtstop = true;
+	for (i=0; i<RT_NHOGS; i++) {
+		P(rtdone);
+	}
+
+	failed = false;
+	for (i=0; i<RT_NTHREADS; i++) {
+		if (rtsetresult[i]) {
+			kprintf("Thread %u (%lu/%lu ms) not admitted: %s\n",
+				i,
+				(unsigned long)(rtparams[i].runtime / RT_MS),
+				(unsigned long)(rtparams[i].period / RT_MS),
+				strerror(rtsetresult[i]));
+			failed = true;
+			continue;
+		}
+		kprintf("Thread %u (%lu/%lu ms): %u of %u deadlines missed, "
+			"worst response %lu us\n", i,
+			(unsigned long)(rtparams[i].runtime / RT_MS),
+			(unsigned long)(rtparams[i].period / RT_MS),
+			rtmisses[i], RT_NJOBS,
+			(unsigned long)(rtworst[i] / 1000));
+		if (rtmisses[i] > 0) {
+			failed = true;
+		}
+	}
+	if (rtgreedyresult != EBUSY) {
+		kprintf("Overcommitting thread got %s, not EBUSY\n",
+			rtgreedyresult ? strerror(rtgreedyresult) :
+			"admitted");
+		failed = true;
+	}
+
+	sem_destroy(rtdone);
+	sem_destroy(rtready);
+
+	if (failed) {
+		kprintf("Test failed\n");
+		return EIO;
+	}
+	kprintf("Real-time scheduling test done.\n");
+
+	return 0;
+}
@@ -0,0 +1,147 @@
+/*
+ * Spinlock stress test.
+ *
+ * A bunch of threads hammer on one spinlock until it has been taken
+ * a fixed number of times in total. Each thread times its own
+ * acquires and counts how many it got; if the lock is fair, the
+ * counts should come out about even and nobody's worst-case wait
+ * should be far off everyone else's.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <cpu.h>
+#include <spinlock.h>
+#include <thread.h>
+#include <current.h>
+#include <synch.h>
+#include <test.h>
+#include "opt-ticketlock.h"
+
+#define NSLTHREADS    16
+#define NSLACQUIRES   20000
+
+struct slstat {
+	unsigned sl_cpu;		/* cpu the thread finished on */
+	unsigned sl_acquires;		/* acquires it got */
+	uint64_t sl_totalwait;		/* total ns spent in acquire */
+	uint32_t sl_maxwait;		/* worst single acquire, ns */
+};
+
+static struct spinlock sltest_lock;
+static volatile unsigned sltest_count;
+static struct slstat sltest_stats[NSLTHREADS];
+static struct semaphore *sltest_donesem;
+
+static
+uint32_t
+sltest_elapsed(time_t s1, uint32_t ns1, time_t s2, uint32_t ns2)
+{
+	time_t secs;
+	uint32_t nsecs;
+
+	getinterval(s1, ns1, s2, ns2, &secs, &nsecs);
+	return secs * 1000000000 + nsecs;
+}
+
+static
+void
+sltestthread(void *junk, unsigned long num)
+{
+	struct slstat *st = &sltest_stats[num];
+	time_t s1, s2;
+	uint32_t ns1, ns2, wait;
+	bool done;
+
+	(void)junk;
+
+	done = false;
+	while (!done) {
+		gettime(&s1, &ns1);
+		spinlock_acquire(&sltest_lock);
+		gettime(&s2, &ns2);
+
+		if (sltest_count < NSLACQUIRES) {
+			sltest_count++;
+			wait = sltest_elapsed(s1, ns1, s2, ns2);
+			st->sl_acquires++;
+			st->sl_totalwait += wait;
+			if (wait > st->sl_maxwait) {
+				st->sl_maxwait = wait;
+			}
+		}
+		else {
+			done = true;
+		}
+		st->sl_cpu = curcpu->c_number;
+		spinlock_release(&sltest_lock);
+	}
+
+	V(sltest_donesem);
+}
+
+int
+spinlockstress(int nargs, char **args)
+{
+	unsigned i, minacq, maxacq;
+	uint32_t maxwait;
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting spinlock stress test (%s locks)...\n",
+		OPT_TICKETLOCK ? "ticket" : "test-and-set");
+
+	spinlock_init(&sltest_lock);
+	sltest_count = 0;
+	bzero(sltest_stats, sizeof(sltest_stats));
+	sltest_donesem = sem_create("sltest_donesem", 0);
+	if (sltest_donesem == NULL) {
+		panic("spinlockstress: sem_create failed\n");
+	}
+
+	for (i=0; i<NSLTHREADS; i++) {
+		result = thread_fork("spinlockstress", NULL, sltestthread,
+				     NULL, i);
+		if (result) {
+			panic("spinlockstress: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<NSLTHREADS; i++) {
+		P(sltest_donesem);
+	}
+
+	minacq = maxacq = sltest_stats[0].sl_acquires;
+	maxwait = 0;
+	for (i=0; i<NSLTHREADS; i++) {
+		struct slstat *st = &sltest_stats[i];
+
+		kprintf("thread %2u (cpu%u): %5u acquires, "
+			"avg wait %lu ns, max wait %u ns\n",
+			i, st->sl_cpu, st->sl_acquires,
+			st->sl_acquires == 0 ? 0UL :
+			(unsigned long)(st->sl_totalwait / st->sl_acquires),
+			st->sl_maxwait);
+		if (st->sl_acquires < minacq) {
+			minacq = st->sl_acquires;
+		}
+		if (st->sl_acquires > maxacq) {
+			maxacq = st->sl_acquires;
+		}
+		if (st->sl_maxwait > maxwait) {
+			maxwait = st->sl_maxwait;
+		}
+	}
+	kprintf("Fairness: min %u / max %u acquires per thread; "
+		"worst wait %u ns\n", minacq, maxacq, maxwait);
+
+	sem_destroy(sltest_donesem);
+	sltest_donesem = NULL;
+	spinlock_cleanup(&sltest_lock);
+
+	kprintf("Spinlock stress test done.\n");
+	return 0;
+}
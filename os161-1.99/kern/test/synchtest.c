@@ -34,7 +34,9 @@
 #include <types.h>
 #include <lib.h>
 #include <clock.h>
+#include <spl.h>
 #include <thread.h>
+#include <current.h>
 #include <synch.h>
 #include <test.h>
 
@@ -248,6 +250,8 @@ locktest(int nargs, char **args)
 		P(donesem);
 	}
 
+	lock_printstats(testlock);
+
 #ifdef UW
   cleanitems();
 #endif
@@ -347,3 +351,447 @@ cvtest(int nargs, char **args)
 
 	return 0;
 }
+
+/*
+ * Reader-writer lock test.
+ *
+ * Runs increasing numbers of reader threads against one writer and
+ * reports read throughput for each, so we can see how well readers
+ * scale as more of them (and hence more CPUs) are involved. Readers
+ * check that they never see a half-finished write.
+ */
+
+#define NRWLOOPS      2000
+#define NRWWRITES     100
+#define NRWMAXREADERS 16
+
+static struct rwlock *testrwlock;
+static volatile unsigned long rwtestval1;
+static volatile unsigned long rwtestval2;
+static volatile bool rwtestfailed;
+
+static
+void
+rwtestreader(void *junk, unsigned long num)
+{
+	int i;
+	volatile int j;
+
+	(void)junk;
+
+	for (i=0; i<NRWLOOPS; i++) {
+		rwlock_acquire_read(testrwlock);
+		if (rwtestval2 != rwtestval1 * 2) {
+			kprintf("reader %lu: saw a partial write\n", num);
+			rwtestfailed = true;
+		}
+		/* pretend to look at something */
+		for (j=0; j<50; j++);
+		rwlock_release_read(testrwlock);
+	}
+	V(donesem);
+}
+
+static
+void
+rwtestwriter(void *junk, unsigned long num)
+{
+	int i;
+	volatile int j;
+
+	(void)junk;
+	(void)num;
+
+	for (i=0; i<NRWWRITES; i++) {
+		if (i % 4 == 0) {
+			/* Exercise upgrade and downgrade too. */
+			rwlock_acquire_read(testrwlock);
+			if (rwlock_upgrade(testrwlock)) {
+				rwtestval1++;
+				for (j=0; j<50; j++);
+				rwtestval2 = rwtestval1 * 2;
+				rwlock_downgrade(testrwlock);
+			}
+			if (rwtestval2 != rwtestval1 * 2) {
+				kprintf("writer: bad value after downgrade\n");
+				rwtestfailed = true;
+			}
+			rwlock_release_read(testrwlock);
+		}
+		else {
+			rwlock_acquire_write(testrwlock);
+			rwtestval1++;
+			for (j=0; j<50; j++);
+			rwtestval2 = rwtestval1 * 2;
+			rwlock_release_write(testrwlock);
+		}
+		thread_yield();
+	}
+	V(donesem);
+}
+
+int
+rwlocktest(int nargs, char **args)
+{
+	unsigned long nreaders, i;
+	time_t secs1, secs2, secs;
+	uint32_t nsecs1, nsecs2, nsecs;
+	uint64_t ns, reads;
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	kprintf("Starting rwlock test...\n");
+
+	testrwlock = rwlock_create("testrwlock");
+	if (testrwlock == NULL) {
+		panic("rwlocktest: rwlock_create failed\n");
+	}
+	rwtestval1 = rwtestval2 = 0;
+	rwtestfailed = false;
+
+	for (nreaders=1; nreaders<=NRWMAXREADERS; nreaders *= 2) {
+		gettime(&secs1, &nsecs1);
+
+		result = thread_fork("rwtestwriter", NULL, rwtestwriter,
+				     NULL, 0);
+		if (result) {
+			panic("rwlocktest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+		for (i=0; i<nreaders; i++) {
+			result = thread_fork("rwtestreader", NULL,
+					     rwtestreader, NULL, i);
+			if (result) {
+				panic("rwlocktest: thread_fork failed: %s\n",
+				      strerror(result));
+			}
+		}
+		for (i=0; i<nreaders+1; i++) {
+			P(donesem);
+		}
+
+		gettime(&secs2, &nsecs2);
+		getinterval(secs1, nsecs1, secs2, nsecs2, &secs, &nsecs);
+		ns = (uint64_t)secs * 1000000000 + nsecs;
+		reads = (uint64_t)nreaders * NRWLOOPS;
+
+		kprintf("%2lu readers: %lu reads in %lu.%09lu seconds "
+			"(%lu reads/sec)\n", nreaders, (unsigned long)reads,
+			(unsigned long)secs, (unsigned long)nsecs,
+			ns == 0 ? 0UL :
+			(unsigned long)(reads * 1000000000 / ns));
+	}
+
+	rwlock_destroy(testrwlock);
+	testrwlock = NULL;
+
+#ifdef UW
+  cleanitems();
+#endif
+	if (rwtestfailed) {
+		kprintf("Test failed\n");
+	}
+	kprintf("Rwlock test done.\n");
+
+	return 0;
+}
+
+/*
+ * Priority inheritance test.
+ *
+ * Sets up a priority inversion: low-priority thread L holds lock A
+ * and has work to do, middle thread M holds lock B and waits for A,
+ * and then top-level thread H waits for B. Meanwhile CPU hogs keep
+ * the cpus busy, so without inheritance L has to share with them and
+ * H waits a long time. With it, H's level should reach L by way of
+ * M (so inheritance has to be transitive), and L should give it back
+ * when it releases A. We print how long H waited.
+ */
+
+#define PI_NHOGS	4
+#define PI_WORK		2000000		/* L's work, in loop iterations */
+#define PI_TIMEOUT	2000000000ULL	/* 2 seconds, in ns */
+
+static struct lock *pilocka;
+static struct lock *pilockb;
+static struct semaphore *piheld;
+static volatile bool pistop;
+static volatile int piseen, piafter;
+static volatile uint64_t piwaitns;
+
+static
+void
+pisetlevel(int level)
+{
+	int spl;
+
+	/* Keep schedule() off curthread while we change it */
+	spl = splhigh();
+	curthread->t_priority = level;
+	splx(spl);
+}
+
+static
+void
+pihog(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	while (!pistop) {
+		/* burn cpu */
+	}
+	V(donesem);
+}
+
+static
+void
+pilow(void *junk, unsigned long num)
+{
+	volatile unsigned long i;
+	uint64_t deadline;
+
+	(void)junk;
+	(void)num;
+
+	pisetlevel(SCHED_NLEVELS - 1);
+	lock_acquire(pilocka);
+	V(piheld);
+
+	/* Wait until H is queued up behind M, behind us. */
+	deadline = clock_getns() + PI_TIMEOUT;
+	while (curthread->t_inheritpri != 0 && clock_getns() < deadline) {
+		/* nothing */
+	}
+	piseen = curthread->t_inheritpri;
+
+	for (i=0; i<PI_WORK; i++) {
+		/* nothing */
+	}
+
+	lock_release(pilocka);
+	piafter = curthread->t_inheritpri;
+	V(donesem);
+}
+
+static
+void
+pimiddle(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	lock_acquire(pilockb);
+	pisetlevel(1);
+	lock_acquire(pilocka);
+	lock_release(pilocka);
+	lock_release(pilockb);
+	V(donesem);
+}
+
+static
+void
+pihigh(void *junk, unsigned long num)
+{
+	uint64_t start;
+
+	(void)junk;
+	(void)num;
+
+	start = clock_getns();
+	lock_acquire(pilockb);
+	piwaitns = clock_getns() - start;
+	lock_release(pilockb);
+
+	pistop = true;
+	V(donesem);
+}
+
+static
+void
+pifork(const char *name, void (*func)(void *, unsigned long),
+       unsigned long num)
+{
+	int result;
+
+	result = thread_fork(name, NULL, func, NULL, num);
+	if (result) {
+		panic("pitest: thread_fork failed: %s\n", strerror(result));
+	}
+}
+
+int
+pitest(int nargs, char **args)
+{
+	uint64_t deadline;
+	int i;
+	bool failed;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	kprintf("Starting priority inheritance test...\n");
+
+	pilocka = lock_create("pilocka");
+	pilockb = lock_create("pilockb");
+	piheld = sem_create("piheld", 0);
+	if (pilocka == NULL || pilockb == NULL || piheld == NULL) {
+		panic("pitest: out of memory\n");
+	}
+	pistop = false;
+	piseen = piafter = -1;
+
+	for (i=0; i<PI_NHOGS; i++) {
+		pifork("pihog", pihog, i);
+	}
+	pifork("pilow", pilow, 0);
+	P(piheld);
+
+	/* Make sure M is asleep on A before H comes along. */
+	pifork("pimiddle", pimiddle, 0);
+	deadline = clock_getns() + PI_TIMEOUT;
+	while (pilocka->lk_npiwaiters == 0 && clock_getns() < deadline) {
+		thread_yield();
+	}
+	pifork("pihigh", pihigh, 0);
+
+	for (i=0; i<PI_NHOGS + 3; i++) {
+		P(donesem);
+	}
+
+	failed = false;
+	if (piseen != 0) {
+		kprintf("Low thread inherited level %d, not 0\n", piseen);
+		failed = true;
+	}
+	if (piafter != SCHED_NLEVELS) {
+		kprintf("Low thread kept level %d after releasing\n",
+			piafter);
+		failed = true;
+	}
+	kprintf("High thread waited %lu us for its lock\n",
+		(unsigned long)(piwaitns / 1000));
+
+	sem_destroy(piheld);
+	lock_destroy(pilockb);
+	lock_destroy(pilocka);
+
+#ifdef UW
+  cleanitems();
+#endif
+	if (failed) {
+		kprintf("Test failed\n");
+	}
+	kprintf("Priority inheritance test done.\n");
+
+	return 0;
+}
+
+/*
+ * Priority inheritance through cv_broadcast.
+ *
+ * A top-level thread H sleeps on a CV. A low-priority thread L takes
+ * the CV's lock and broadcasts, which moves H onto the lock's wait
+ * channel without waking it. H is now waiting for L's lock, so L
+ * should inherit H's level right away, and give it back when it
+ * releases the lock.
+ */
+
+static struct lock *cvpilock;
+static struct cv *cvpicv;
+static volatile bool cvpiwaiting, cvpidone;
+static volatile int cvpiseen, cvpiafter;
+
+static
+void
+cvpihigh(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	pisetlevel(0);
+	lock_acquire(cvpilock);
+	cvpiwaiting = true;
+	while (!cvpidone) {
+		cv_wait(cvpicv, cvpilock);
+	}
+	lock_release(cvpilock);
+	V(donesem);
+}
+
+static
+void
+cvpilow(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	pisetlevel(SCHED_NLEVELS - 1);
+
+	/* H sets the flag with the lock held, and holds it until asleep */
+	lock_acquire(cvpilock);
+	while (!cvpiwaiting) {
+		lock_release(cvpilock);
+		thread_yield();
+		lock_acquire(cvpilock);
+	}
+	cvpidone = true;
+	cv_broadcast(cvpicv, cvpilock);
+	cvpiseen = curthread->t_inheritpri;
+	lock_release(cvpilock);
+	cvpiafter = curthread->t_inheritpri;
+	V(donesem);
+}
+
+int
+cvpitest(int nargs, char **args)
+{
+	bool failed;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	kprintf("Starting CV priority inheritance test...\n");
+
+	cvpilock = lock_create("cvpilock");
+	cvpicv = cv_create("cvpicv");
+	if (cvpilock == NULL || cvpicv == NULL) {
+		panic("cvpitest: out of memory\n");
+	}
+	cvpiwaiting = cvpidone = false;
+	cvpiseen = cvpiafter = -1;
+
+	pifork("cvpihigh", cvpihigh, 0);
+	pifork("cvpilow", cvpilow, 0);
+	P(donesem);
+	P(donesem);
+
+	failed = false;
+	if (cvpiseen != 0) {
+		kprintf("Broadcaster inherited level %d, not 0\n", cvpiseen);
+		failed = true;
+	}
+	if (cvpiafter != SCHED_NLEVELS) {
+		kprintf("Broadcaster kept level %d after releasing\n",
+			cvpiafter);
+		failed = true;
+	}
+
+	cv_destroy(cvpicv);
+	lock_destroy(cvpilock);
+
+#ifdef UW
+  cleanitems();
+#endif
+	if (failed) {
+		kprintf("Test failed\n");
+	}
+	kprintf("CV priority inheritance test done.\n");
+
+	return 0;
+}
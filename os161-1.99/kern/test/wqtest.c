@@ -0,0 +1,230 @@
+/*
+ * Workqueue test.
+ *
+ * From a thread bound to each cpu in turn, queues one piece of work
+ * and one piece of delayed work, and checks that each ran on that
+ * cpu's worker, and that the delayed one didn't run early. Then fills
+ * one cpu's pool with delayed work until workqueue_enqueue_delayed
+ * says ENOMEM, checks that all of it runs, and that the pool can be
+ * used again afterwards.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <cpu.h>
+#include <thread.h>
+#include <current.h>
+#include <synch.h>
+#include <workqueue.h>
+#include <test.h>
+
+#define WQ_DELAYNS	20000000ULL	/* 20 ms */
+#define WQ_FLOODMAX	1000		/* Give up on ENOMEM after this */
+
+struct wqitem {
+	unsigned wi_cpu;		/* Where it was queued */
+	uint64_t wi_notbefore;		/* Earliest it may run */
+	volatile int wi_rancpu;		/* Where it ran; -1 if not yet */
+	volatile uint64_t wi_ranat;	/* When it ran */
+};
+
+static struct semaphore *wqdone;
+static struct wqitem *wqitems;		/* Two per cpu */
+static volatile unsigned wqflooded;	/* Flood items queued */
+static volatile unsigned wqfloodran;	/* ...and run so far */
+static volatile int wqenqresult;	/* First error from wqqueue */
+
+static
+void
+wqwork(void *arg)
+{
+	struct wqitem *wi = arg;
+
+	wi->wi_ranat = clock_getns();
+	wi->wi_rancpu = curcpu->c_number;
+	V(wqdone);
+}
+
+static
+void
+wqfloodwork(void *arg)
+{
+	(void)arg;
+
+	/* All on one cpu's worker, so never run concurrently */
+	wqfloodran++;
+	V(wqdone);
+}
+
+/*
+ * Runs bound to cpu NUM: queue its two items.
+ */
+static
+void
+wqqueue(void *junk, unsigned long num)
+{
+	struct wqitem *now, *later;
+	int result;
+
+	(void)junk;
+
+	now = &wqitems[2 * num];
+	later = &wqitems[2 * num + 1];
+	now->wi_cpu = later->wi_cpu = curcpu->c_number;
+	now->wi_notbefore = clock_getns();
+	later->wi_notbefore = now->wi_notbefore + WQ_DELAYNS;
+
+	result = workqueue_enqueue(wqwork, now);
+	if (result == 0) {
+		result = workqueue_enqueue_delayed(wqwork, later, WQ_DELAYNS);
+		if (result) {
+			/* Account for the one that won't run */
+			V(wqdone);
+		}
+	}
+	else {
+		V(wqdone);
+		V(wqdone);
+	}
+	if (result) {
+		wqenqresult = result;
+	}
+}
+
+/*
+ * Runs bound to one cpu: fill its pool with delayed work.
+ */
+static
+void
+wqflood(void *junk, unsigned long num)
+{
+	int result;
+
+	(void)junk;
+	(void)num;
+
+	result = 0;
+	while (wqflooded < WQ_FLOODMAX) {
+		result = workqueue_enqueue_delayed(wqfloodwork, NULL,
+						   WQ_DELAYNS);
+		if (result) {
+			break;
+		}
+		wqflooded++;
+	}
+	wqenqresult = result;
+	V(wqdone);
+}
+
+static
+void
+wqfork(const char *name, struct cpu *c,
+       void (*func)(void *, unsigned long), unsigned long num)
+{
+	int result;
+
+	result = thread_fork_oncpu(name, c, func, NULL, num);
+	if (result) {
+		panic("wqtest: thread_fork failed: %s\n", strerror(result));
+	}
+}
+
+int
+wqtest(int nargs, char **args)
+{
+	struct wqitem *wi;
+	unsigned i, ncpus;
+	bool failed;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting workqueue test...\n");
+
+	ncpus = cpu_count();
+	wqdone = sem_create("wqdone", 0);
+	wqitems = kmalloc(2 * ncpus * sizeof(*wqitems));
+	if (wqdone == NULL || wqitems == NULL) {
+		panic("wqtest: out of memory\n");
+	}
+	for (i=0; i<2*ncpus; i++) {
+		wqitems[i].wi_rancpu = -1;
+	}
+	failed = false;
+
+	/* Ordinary and delayed work on every cpu */
+	wqenqresult = 0;
+	for (i=0; i<ncpus; i++) {
+		wqfork("wqqueue", cpu_bynumber(i), wqqueue, i);
+	}
+	for (i=0; i<2*ncpus; i++) {
+		P(wqdone);
+	}
+	if (wqenqresult) {
+		kprintf("Queueing work failed: %s\n",
+			strerror(wqenqresult));
+		failed = true;
+	}
+	for (i=0; i<2*ncpus; i++) {
+		wi = &wqitems[i];
+		if (wi->wi_rancpu < 0) {
+			continue;
+		}
+		if ((unsigned)wi->wi_rancpu != wi->wi_cpu) {
+			kprintf("%s work queued on cpu%u ran on cpu%d\n",
+				i % 2 ? "Delayed" : "Immediate", wi->wi_cpu,
+				wi->wi_rancpu);
+			failed = true;
+		}
+		if (wi->wi_ranat < wi->wi_notbefore) {
+			kprintf("Delayed work on cpu%u ran %lu us early\n",
+				wi->wi_cpu, (unsigned long)
+				((wi->wi_notbefore - wi->wi_ranat) / 1000));
+			failed = true;
+		}
+	}
+
+	/* Use up one cpu's pool */
+	wqenqresult = 0;
+	wqflooded = wqfloodran = 0;
+	wqfork("wqflood", curcpu->c_self, wqflood, 0);
+	P(wqdone);
+	if (wqenqresult != ENOMEM) {
+		kprintf("Queued %u delayed items without ENOMEM (got %s)\n",
+			wqflooded, wqenqresult ? strerror(wqenqresult) :
+			"no error");
+		failed = true;
+	}
+	for (i=0; i<wqflooded; i++) {
+		P(wqdone);
+	}
+	if (wqfloodran != wqflooded) {
+		kprintf("Queued %u delayed items, but %u ran\n",
+			wqflooded, wqfloodran);
+		failed = true;
+	}
+	kprintf("Pool ran out after %u items\n", wqflooded);
+
+	/* And it should be usable again */
+	wqitems[0].wi_rancpu = -1;
+	wqenqresult = 0;
+	wqfork("wqqueue", cpu_bynumber(0), wqqueue, 0);
+	P(wqdone);
+	P(wqdone);
+	if (wqenqresult || wqitems[0].wi_rancpu != 0) {
+		kprintf("Workqueue unusable after running out\n");
+		failed = true;
+	}
+
+	kfree(wqitems);
+	sem_destroy(wqdone);
+
+	if (failed) {
+		kprintf("Test failed\n");
+		return EIO;
+	}
+	kprintf("Workqueue test done.\n");
+	return 0;
+}
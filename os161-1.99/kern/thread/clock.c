@@ -30,18 +30,31 @@
 #include <types.h>
 #include <lib.h>
 #include <cpu.h>
-#include <wchan.h>
+#include <spl.h>
+#include <spinlock.h>
 #include <clock.h>
 #include <thread.h>
+#include <mainbus.h>
 #include <lamebus/ltimer.h>
 #include <current.h>
 
 /*
  * Time handling.
  *
- * This is pretty primitive. A real kernel will typically have some
- * kind of support for scheduling callbacks to happen at specific
- * points in the future, usually with more resolution that one second.
+ * Each cpu runs its own one-shot timer (set with mainbus_settimer).
+ * While the cpu is busy the timer is set for the earlier of the next
+ * hardclock and the next pending timeout; while it is idle the
+ * periodic tick is turned off and the timer is set only for the next
+ * timeout, so an idle machine doesn't wake up HZ times a second for
+ * nothing.
+ *
+ * Timeouts live on a per-cpu hierarchical timer wheel, as in the
+ * classic Varghese and Lauck scheme: TW_LEVELS levels of TW_NSLOTS
+ * slots each, where a slot on level 0 covers one wheel tick
+ * (2^TW_RESBITS ns, about 131 us) and each higher level is TW_NSLOTS
+ * times coarser. Timeouts are filed on the lowest level whose range
+ * covers them and "cascade" down a level when the wheel reaches the
+ * start of their slot. Adding and cancelling are O(1).
  *
  * A real kernel also has to maintain the time of day; in OS/161 we
  * skimp on that because we have a known-good hardware clock.
@@ -49,68 +62,486 @@
 
 /*
  * Timing constants. These should be tuned along with any work done on
- * the scheduler.
+ * the scheduler. (The scheduler's own quanta are in thread.c; it is
+ * called on every hardclock.)
  */
-#define SCHEDULE_HARDCLOCKS	4	/* Reschedule every 4 hardclocks. */
 #define MIGRATE_HARDCLOCKS	16	/* Migrate every 16 hardclocks. */
 
+#define TICK_NS		(1000000000ULL / HZ)	/* ns per hardclock */
+#define IDLE_MAX_NS	1000000000ULL		/* longest idle sleep */
+
+/* Timer wheel geometry */
+#define TW_LEVELS	4
+#define TW_SLOTBITS	6
+#define TW_NSLOTS	(1U << TW_SLOTBITS)
+#define TW_SLOTMASK	(TW_NSLOTS - 1)
+#define TW_RESBITS	17
+#define TW_RES		(1ULL << TW_RESBITS)	/* ns per wheel tick */
+
+/* Bits of wheel tick below the slot index on level L */
+#define TW_SHIFT(level)	(TW_SLOTBITS * (level))
+
+struct timerwheel {
+	/*
+	 * Protected by tw_lock (timeouts may be cancelled from other
+	 * cpus).
+	 */
+	struct spinlock tw_lock;
+	struct timeout *tw_slots[TW_LEVELS][TW_NSLOTS];
+	uint64_t tw_now;		/* Last wheel tick processed */
+	unsigned tw_count;		/* Number of timeouts on the wheel */
+
+	/*
+	 * Accessed only by the owning cpu.
+	 */
+	bool tw_started;		/* Timer hardware is running */
+	bool tw_tickless;		/* Periodic tick is off (idle) */
+	uint64_t tw_nexttick;		/* Time of next hardclock, ns */
+	uint64_t tw_armed;		/* Time the timer will go off, ns */
+	uint64_t tw_idlestart;		/* Time we went tickless, ns */
+};
+
+/*
+ * Get the current time in nanoseconds.
+ */
+uint64_t
+clock_getns(void)
+{
+	time_t secs;
+	uint32_t nsecs;
+
+	gettime(&secs, &nsecs);
+	return (uint64_t)secs * 1000000000ULL + nsecs;
+}
+
 /*
- * Once a second, everything waiting on lbolt is awakened by CPU 0.
+ * Set up a timer wheel. Called from cpu_create.
  */
-static struct wchan *lbolt;
+struct timerwheel *
+timerwheel_create(void)
+{
+	struct timerwheel *tw;
+	unsigned i, j;
+
+	tw = kmalloc(sizeof(*tw));
+	if (tw == NULL) {
+		return NULL;
+	}
+	spinlock_init(&tw->tw_lock);
+	for (i=0; i<TW_LEVELS; i++) {
+		for (j=0; j<TW_NSLOTS; j++) {
+			tw->tw_slots[i][j] = NULL;
+		}
+	}
+	tw->tw_now = 0;
+	tw->tw_count = 0;
+	tw->tw_started = false;
+	tw->tw_tickless = false;
+	tw->tw_nexttick = 0;
+	tw->tw_armed = 0;
+	tw->tw_idlestart = 0;
+	return tw;
+}
+
+/*
+ * File a timeout on the wheel. BASE is the first wheel tick that has
+ * not been processed yet; timeouts that are already due are filed to
+ * go off then. Timeouts too far out for the top level are filed as
+ * far out as it goes and re-filed when they come up.
+ *
+ * Must hold tw_lock.
+ */
+static
+void
+tw_insert(struct timerwheel *tw, struct timeout *to, uint64_t base)
+{
+	struct timeout **head;
+	uint64_t when, delta;
+	unsigned level;
+
+	/* Round up, so we never go off early */
+	when = (to->to_deadline + TW_RES - 1) >> TW_RESBITS;
+	if (when < base) {
+		when = base;
+	}
+	delta = when - base;
+
+	for (level=0; level<TW_LEVELS-1; level++) {
+		if (delta < (1ULL << TW_SHIFT(level + 1))) {
+			break;
+		}
+	}
+	if (delta >= (1ULL << TW_SHIFT(TW_LEVELS))) {
+		when = base + (1ULL << TW_SHIFT(TW_LEVELS)) - 1;
+	}
+
+	head = &tw->tw_slots[level][(when >> TW_SHIFT(level)) & TW_SLOTMASK];
+	to->to_next = *head;
+	if (to->to_next != NULL) {
+		to->to_next->to_pprev = &to->to_next;
+	}
+	to->to_pprev = head;
+	*head = to;
+}
+
 /*
- * Once every LT_GRANULARITY usec, everything on minibolt is awakenened by CPU 0
+ * Find the next wheel tick at which something happens: either a
+ * level-0 slot with timeouts in it comes up or a nonempty slot on a
+ * higher level needs to cascade. Returns false if the wheel is empty.
+ *
+ * Must hold tw_lock.
  */
-static struct wchan *minibolt;
+static
+bool
+tw_nextevent(struct timerwheel *tw, uint64_t *ret)
+{
+	uint64_t block, when;
+	unsigned level, i;
+	bool found;
 
-/* 
- * number of minibolts per second
+	if (tw->tw_count == 0) {
+		return false;
+	}
+
+	found = false;
+	when = 0;
+	for (level=0; level<TW_LEVELS; level++) {
+		block = tw->tw_now >> TW_SHIFT(level);
+		for (i=1; i<=TW_NSLOTS; i++) {
+			if (found && ((block + i) << TW_SHIFT(level)) >= when) {
+				break;
+			}
+			if (tw->tw_slots[level][(block + i) & TW_SLOTMASK]
+			    != NULL) {
+				when = (block + i) << TW_SHIFT(level);
+				found = true;
+				break;
+			}
+		}
+	}
+	KASSERT(found);
+	*ret = when;
+	return true;
+}
+
+/*
+ * Move everything in one higher-level slot down the wheel. BASE is
+ * the wheel tick being processed.
  */
-#define MINI_PER_SECOND (1000000/LT_GRANULARITY);
+static
+void
+tw_cascade(struct timerwheel *tw, unsigned level, uint64_t base)
+{
+	struct timeout **head, *to, *next;
+
+	head = &tw->tw_slots[level][(base >> TW_SHIFT(level)) & TW_SLOTMASK];
+	to = *head;
+	*head = NULL;
+	while (to != NULL) {
+		next = to->to_next;
+		tw_insert(tw, to, base);
+		to = next;
+	}
+}
 
 /*
- * minibolt countdown
+ * Bring the wheel up to time NOW, unhooking everything that's due.
+ * Returns the expired timeouts as a list linked through to_next.
+ *
+ * Must hold tw_lock.
  */
-static int minicount;
+static
+struct timeout *
+tw_advance(struct timerwheel *tw, uint64_t now)
+{
+	struct timeout *expired, *to, *next, **head;
+	uint64_t target, tick;
+	int level;
+
+	expired = NULL;
+	target = now >> TW_RESBITS;
+	while (tw->tw_now < target) {
+		/* Skip straight to the next tick with work to do. */
+		if (!tw_nextevent(tw, &tick) || tick > target) {
+			tw->tw_now = target;
+			break;
+		}
+		tw->tw_now = tick;
+
+		for (level=TW_LEVELS-1; level>0; level--) {
+			if ((tick & ((1ULL << TW_SHIFT(level)) - 1)) == 0) {
+				tw_cascade(tw, level, tick);
+			}
+		}
+
+		head = &tw->tw_slots[0][tick & TW_SLOTMASK];
+		to = *head;
+		*head = NULL;
+		while (to != NULL) {
+			next = to->to_next;
+			if (to->to_deadline > now) {
+				/* Was filed short of its real deadline. */
+				tw_insert(tw, to, tick + 1);
+			}
+			else {
+				to->to_pprev = NULL;
+				to->to_cpu = NULL;
+				tw->tw_count--;
+				to->to_next = expired;
+				expired = to;
+			}
+			to = next;
+		}
+	}
+	return expired;
+}
 
 /*
- * Setup.
+ * Program the cpu's timer for whatever is due next: the next timeout,
+ * and, unless we're idle, the next hardclock.
+ *
+ * Must hold tw_lock; must be on the owning cpu.
  */
+static
 void
-hardclock_bootstrap(void)
+clock_rearm(struct timerwheel *tw, uint64_t now)
 {
-	lbolt = wchan_create("lbolt");
-	if (lbolt == NULL) {
-		panic("Couldn't create lbolt\n");
+	uint64_t target, tick;
+
+	if (tw->tw_tickless) {
+		target = now + IDLE_MAX_NS;
 	}
-	minibolt = wchan_create("minibolt");
-	if (minibolt == NULL) {
-		panic("Couldn't create minibolt\n");
+	else {
+		target = tw->tw_nexttick;
 	}
-	minicount = MINI_PER_SECOND;
-	/* we assume MINI_PER_SECOND > 0 */
-	KASSERT(minicount > 0);
+	if (tw_nextevent(tw, &tick) && (tick << TW_RESBITS) < target) {
+		target = tick << TW_RESBITS;
+	}
+
+	tw->tw_armed = target;
+	mainbus_settimer(target > now ? target - now : 0);
 }
 
 /*
- * This is called once every every LT_GRANULARITY usec, on one processor,
- * by the timer code.
+ * Start the current cpu's timer. Called by the platform code once
+ * the real-time clock is attached, and on secondary cpus from
+ * cpu_hatch.
  */
 void
-timerclock(void)
+clock_start(void)
 {
-	/* Broadcast on minibolt */
-	wchan_wakeall(minibolt);
-	/* Broadcast on lbolt if a second has elapsed */
-	if (--minicount <= 0) {
-	  minicount = MINI_PER_SECOND;
-	  wchan_wakeall(lbolt);
+	struct timerwheel *tw;
+	uint64_t now;
+	int spl;
+
+	spl = splhigh();
+	tw = curcpu->c_timerwheel;
+	KASSERT(!tw->tw_started);
+
+	now = clock_getns();
+	spinlock_acquire(&tw->tw_lock);
+	if (tw->tw_count == 0) {
+		tw->tw_now = now >> TW_RESBITS;
 	}
+	tw->tw_started = true;
+	tw->tw_nexttick = now + TICK_NS;
+	curcpu->c_statstart = now;
+	clock_rearm(tw, now);
+	spinlock_release(&tw->tw_lock);
+	splx(spl);
+}
+
+/*
+ * Timer interrupt. Run any timeouts that are due, do a hardclock if
+ * one is due, and set the timer for next time.
+ */
+void
+clock_interrupt(void)
+{
+	struct timerwheel *tw = curcpu->c_timerwheel;
+	struct timeout *expired, *to;
+	uint64_t now;
+	bool tick;
+
+	curcpu->c_timerirqs++;
+
+	if (!tw->tw_started) {
+		/*
+		 * Stray interrupt from before clock_start; we can't
+		 * read the time yet. Behave like a plain tick.
+		 */
+		mainbus_settimer(TICK_NS);
+		hardclock();
+		return;
+	}
+
+	now = clock_getns();
+
+	spinlock_acquire(&tw->tw_lock);
+	expired = tw_advance(tw, now);
+	spinlock_release(&tw->tw_lock);
+
+	while (expired != NULL) {
+		to = expired;
+		expired = to->to_next;
+		to->to_next = NULL;
+		to->to_func(to->to_arg);
+	}
+
+	tick = false;
+	if (!tw->tw_tickless && now >= tw->tw_nexttick) {
+		tick = true;
+		tw->tw_nexttick += TICK_NS;
+		if (tw->tw_nexttick <= now) {
+			/* Fell behind; don't try to catch up. */
+			tw->tw_nexttick = now + TICK_NS;
+		}
+	}
+
+	/*
+	 * Set the timer before calling hardclock, because hardclock
+	 * may switch threads and not come back for a while.
+	 */
+	spinlock_acquire(&tw->tw_lock);
+	clock_rearm(tw, now);
+	spinlock_release(&tw->tw_lock);
+
+	if (tick) {
+		hardclock();
+	}
+	else if (curcpu->c_needresched && curthread->t_rcunest == 0) {
+		/*
+		 * A timeout woke something that should run before us,
+		 * such as a real-time thread starting its period;
+		 * don't make it wait for the next hardclock.
+		 */
+		thread_yield();
+	}
+}
+
+/*
+ * The current cpu is going idle: stop the periodic tick. Called from
+ * the idle loop in thread_switch, with interrupts off.
+ */
+void
+clock_idle(void)
+{
+	struct timerwheel *tw = curcpu->c_timerwheel;
+
+	if (!tw->tw_started || tw->tw_tickless) {
+		return;
+	}
+	tw->tw_idlestart = clock_getns();
+	spinlock_acquire(&tw->tw_lock);
+	tw->tw_tickless = true;
+	clock_rearm(tw, tw->tw_idlestart);
+	spinlock_release(&tw->tw_lock);
+}
+
+/*
+ * The current cpu found something to run: restart the periodic tick,
+ * and count the hardclocks we skipped as idle time so the statistics
+ * come out the same as if we had taken them. Also count the time.
+ */
+void
+clock_unidle(void)
+{
+	struct timerwheel *tw = curcpu->c_timerwheel;
+	uint64_t now, skipped;
+
+	if (!tw->tw_tickless) {
+		return;
+	}
+
+	now = clock_getns();
+	curcpu->c_idlens += now - tw->tw_idlestart;
+	if (now >= tw->tw_nexttick) {
+		skipped = (now - tw->tw_nexttick) / TICK_NS + 1;
+		curcpu->c_hardclocks += skipped;
+		curcpu->c_idleclocks += skipped;
+		tw->tw_nexttick += skipped * TICK_NS;
+	}
+
+	spinlock_acquire(&tw->tw_lock);
+	tw->tw_tickless = false;
+	clock_rearm(tw, now);
+	spinlock_release(&tw->tw_lock);
+}
+
+/*
+ * Timeouts.
+ */
+void
+timeout_init(struct timeout *to, void (*func)(void *), void *arg)
+{
+	to->to_next = NULL;
+	to->to_pprev = NULL;
+	to->to_deadline = 0;
+	to->to_func = func;
+	to->to_arg = arg;
+	to->to_cpu = NULL;
+}
+
+void
+timeout_add(struct timeout *to, uint64_t deadline)
+{
+	struct timerwheel *tw;
+	int spl;
+
+	KASSERT(to->to_cpu == NULL);
+
+	/* Stay on this cpu until the timeout is on its wheel. */
+	spl = splhigh();
+	tw = curcpu->c_timerwheel;
+
+	spinlock_acquire(&tw->tw_lock);
+	if (tw->tw_count == 0 && tw->tw_started) {
+		/* Nothing to keep in step with; catch up for free. */
+		tw->tw_now = clock_getns() >> TW_RESBITS;
+	}
+	to->to_deadline = deadline;
+	to->to_cpu = curcpu->c_self;
+	tw_insert(tw, to, tw->tw_now + 1);
+	tw->tw_count++;
+	if (tw->tw_started && deadline < tw->tw_armed) {
+		/* Goes off sooner than the timer; move the timer up. */
+		clock_rearm(tw, clock_getns());
+	}
+	spinlock_release(&tw->tw_lock);
+
+	splx(spl);
+}
+
+bool
+timeout_cancel(struct timeout *to)
+{
+	struct timerwheel *tw;
+	struct cpu *c;
+
+	while ((c = to->to_cpu) != NULL) {
+		tw = c->c_timerwheel;
+		spinlock_acquire(&tw->tw_lock);
+		if (to->to_cpu == c) {
+			/* Still on that wheel; unhook it. */
+			*to->to_pprev = to->to_next;
+			if (to->to_next != NULL) {
+				to->to_next->to_pprev = to->to_pprev;
+			}
+			to->to_next = NULL;
+			to->to_pprev = NULL;
+			to->to_cpu = NULL;
+			tw->tw_count--;
+			spinlock_release(&tw->tw_lock);
+			return true;
+		}
+		spinlock_release(&tw->tw_lock);
+	}
+	return false;
 }
 
 /*
  * This is called HZ times a second (on each processor) by the timer
- * code.
+ * code, except while the processor is idle.
  */
 void
 hardclock(void)
@@ -120,13 +551,22 @@ hardclock(void)
 	 */
 
 	curcpu->c_hardclocks++;
-	if ((curcpu->c_hardclocks % SCHEDULE_HARDCLOCKS) == 0) {
-		schedule();
-	}
+	schedule();
 	if ((curcpu->c_hardclocks % MIGRATE_HARDCLOCKS) == 0) {
 		thread_consider_migration();
 	}
-	thread_yield();
+
+	/*
+	 * Outside an RCU read section this is a quiescent state;
+	 * inside one, preemption has to wait (see rcu.h).
+	 */
+	if (curthread->t_rcunest > 0) {
+		return;
+	}
+	curcpu->c_rcuqs++;
+	if (curcpu->c_needresched) {
+		thread_yield();
+	}
 }
 
 /*
@@ -135,11 +575,11 @@ hardclock(void)
 void
 clocksleep(int num_secs)
 {
-  while (num_secs > 0) {
-    wchan_lock(lbolt);
-    wchan_sleep(lbolt);
-    num_secs--;
-  }
+	if (num_secs <= 0) {
+		return;
+	}
+	thread_sleep_until(clock_getns() +
+			   (uint64_t)num_secs * 1000000000ULL);
 }
 
 /*
@@ -149,9 +589,9 @@ clocksleep(int num_secs)
 void
 clocknap(int num_ticks)
 {
-  while (num_ticks > 0) {
-    wchan_lock(minibolt);
-    wchan_sleep(minibolt);
-    num_ticks--;
-  }
+	if (num_ticks <= 0) {
+		return;
+	}
+	thread_sleep_until(clock_getns() +
+			   (uint64_t)num_ticks * LT_GRANULARITY * 1000ULL);
 }
@@ -0,0 +1,296 @@
+/*
+ * Lock order checking (the lockdep option). See <lockdep.h>.
+ *
+ * The order graph is a bitmap per class: bit J of lockdep_after[I]
+ * is set once class J has been acquired while holding class I. With
+ * at most 64 classes that's one uint64_t each, so the check done on
+ * every acquire is a bit test per lock held, without locking; only a
+ * new edge takes lockdep_lock and searches the graph for a cycle.
+ * (On a 32-bit machine the unlocked read can be torn, but bits are
+ * only ever set, so at worst we take the slow path for nothing.)
+ *
+ * Where each edge was first seen is kept in a separate table, for
+ * reports. Neither classes nor edges are ever removed.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <thread.h>
+#include <current.h>
+#include <synch.h>
+#include <lockdep.h>
+
+#define LOCKDEP_NCLASSES	64	/* Bits in lockdep_after[] */
+#define LOCKDEP_NAMELEN		24	/* Longest class name kept */
+#define LOCKDEP_NEDGES		256	/* Edges whose sites are kept */
+
+#define LOCKDEP_BIT(cl)		((uint64_t)1 << (cl))
+
+struct lockdep_class {
+	char lc_name[LOCKDEP_NAMELEN];	/* Lock or CV name */
+	bool lc_iscv;			/* True for a CV */
+};
+
+struct lockdep_edge {
+	int le_from, le_to;		/* Classes: TO taken holding FROM */
+	const void *le_fromwhere;	/* Where FROM was acquired */
+	const void *le_towhere;		/* Where TO was acquired */
+};
+
+static struct lockdep_class lockdep_classes[LOCKDEP_NCLASSES];
+static unsigned lockdep_nclasses;
+static volatile uint64_t lockdep_after[LOCKDEP_NCLASSES];
+static struct lockdep_edge lockdep_edges[LOCKDEP_NEDGES];
+static unsigned lockdep_nedges;
+static bool lockdep_full;		/* Ran out of classes */
+
+/* Protects all of the above, for writing */
+static struct spinlock lockdep_lock = SPINLOCK_INITIALIZER;
+
+/*
+ * Check if class CL is NAME/ISCV. Long names are kept truncated, so
+ * only compare as much as we kept.
+ */
+static
+bool
+lockdep_match(struct lockdep_class *lc, const char *name, bool iscv)
+{
+	unsigned i;
+
+	if (lc->lc_iscv != iscv) {
+		return false;
+	}
+	for (i=0; i<LOCKDEP_NAMELEN-1; i++) {
+		if (lc->lc_name[i] != name[i]) {
+			return false;
+		}
+		if (name[i] == 0) {
+			break;
+		}
+	}
+	return true;
+}
+
+int
+lockdep_class(const char *name, bool iscv)
+{
+	struct lockdep_class *lc;
+	unsigned i;
+	bool warn;
+
+	spinlock_acquire(&lockdep_lock);
+	for (i=0; i<lockdep_nclasses; i++) {
+		if (lockdep_match(&lockdep_classes[i], name, iscv)) {
+			spinlock_release(&lockdep_lock);
+			return i;
+		}
+	}
+	if (lockdep_nclasses >= LOCKDEP_NCLASSES) {
+		warn = !lockdep_full;
+		lockdep_full = true;
+		spinlock_release(&lockdep_lock);
+		if (warn) {
+			kprintf("lockdep: out of classes; %s %s and later "
+				"ones are not checked\n",
+				iscv ? "cv" : "lock", name);
+		}
+		return LOCKDEP_NOCLASS;
+	}
+
+	lc = &lockdep_classes[lockdep_nclasses];
+	for (i=0; i<LOCKDEP_NAMELEN-1 && name[i] != 0; i++) {
+		lc->lc_name[i] = name[i];
+	}
+	lc->lc_name[i] = 0;
+	lc->lc_iscv = iscv;
+	i = lockdep_nclasses++;
+	spinlock_release(&lockdep_lock);
+	return i;
+}
+
+/*
+ * Look for a path FROM ... TO in the graph, breadth first so that a
+ * report shows the shortest one. On success, fill in PREV (the class
+ * before each class on the path) and return true.
+ */
+static
+bool
+lockdep_findpath(int from, int to, int8_t *prev)
+{
+	int8_t queue[LOCKDEP_NCLASSES];
+	unsigned head, tail;
+	uint64_t seen, next;
+	int cl, n;
+
+	KASSERT(spinlock_do_i_hold(&lockdep_lock));
+
+	seen = LOCKDEP_BIT(from);
+	head = tail = 0;
+	queue[tail++] = from;
+	while (head < tail) {
+		cl = queue[head++];
+		next = lockdep_after[cl] & ~seen;
+		for (n = 0; next != 0; n++, next >>= 1) {
+			if ((next & 1) == 0) {
+				continue;
+			}
+			prev[n] = cl;
+			if (n == to) {
+				return true;
+			}
+			seen |= LOCKDEP_BIT(n);
+			queue[tail++] = n;
+		}
+	}
+	return false;
+}
+
+/*
+ * Print one class, and where it was acquired if we know.
+ */
+static
+void
+lockdep_printone(int cl, const void *where)
+{
+	struct lockdep_class *lc = &lockdep_classes[cl];
+
+	if (where != NULL) {
+		kprintf("%s \"%s\" (at %p)", lc->lc_iscv ? "cv" : "lock",
+			lc->lc_name, where);
+	}
+	else {
+		kprintf("%s \"%s\"", lc->lc_iscv ? "cv" : "lock",
+			lc->lc_name);
+	}
+}
+
+/*
+ * Print the edge FROM -> TO, with its sites if we kept them.
+ */
+static
+void
+lockdep_printedge(int from, int to)
+{
+	const void *fromwhere, *towhere;
+	unsigned i;
+
+	fromwhere = towhere = NULL;
+	spinlock_acquire(&lockdep_lock);
+	for (i=0; i<lockdep_nedges; i++) {
+		if (lockdep_edges[i].le_from == from &&
+		    lockdep_edges[i].le_to == to) {
+			fromwhere = lockdep_edges[i].le_fromwhere;
+			towhere = lockdep_edges[i].le_towhere;
+			break;
+		}
+	}
+	spinlock_release(&lockdep_lock);
+
+	kprintf("lockdep:   ");
+	lockdep_printone(from, fromwhere);
+	kprintf(" -> ");
+	lockdep_printone(to, towhere);
+	kprintf("\n");
+}
+
+/*
+ * Record that TO was taken while holding FROM, and report if that
+ * closes a cycle. The edge is added either way, so each inversion is
+ * only reported once.
+ */
+static
+void
+lockdep_newedge(int from, int to, const void *fromwhere,
+		const void *towhere)
+{
+	int8_t prev[LOCKDEP_NCLASSES], path[LOCKDEP_NCLASSES];
+	struct lockdep_edge *le;
+	bool cycle;
+	int cl, n;
+
+	spinlock_acquire(&lockdep_lock);
+	if (lockdep_after[from] & LOCKDEP_BIT(to)) {
+		/* Someone else just added it */
+		spinlock_release(&lockdep_lock);
+		return;
+	}
+	cycle = lockdep_findpath(to, from, prev);
+	lockdep_after[from] |= LOCKDEP_BIT(to);
+	if (lockdep_nedges < LOCKDEP_NEDGES) {
+		le = &lockdep_edges[lockdep_nedges];
+		le->le_from = from;
+		le->le_to = to;
+		le->le_fromwhere = fromwhere;
+		le->le_towhere = towhere;
+		lockdep_nedges++;
+	}
+	spinlock_release(&lockdep_lock);
+
+	if (!cycle) {
+		return;
+	}
+
+	kprintf("lockdep: possible deadlock in thread %s:\n",
+		curthread->t_name);
+	kprintf("lockdep: new order\n");
+	kprintf("lockdep:   ");
+	lockdep_printone(from, fromwhere);
+	kprintf(" -> ");
+	lockdep_printone(to, towhere);
+	kprintf("\n");
+	kprintf("lockdep: but already seen\n");
+
+	/* PREV leads back from FROM to TO; print it the other way */
+	n = 0;
+	for (cl = from; cl != to; cl = prev[cl]) {
+		path[n++] = cl;
+	}
+	cl = to;
+	while (n > 0) {
+		lockdep_printedge(cl, path[--n]);
+		cl = path[n];
+	}
+}
+
+void
+lockdep_acquire(int cl, struct lock *skip, const void *where)
+{
+	struct lock *held;
+	int from;
+
+	if (cl == LOCKDEP_NOCLASS) {
+		return;
+	}
+	for (held = curthread->t_heldlocks; held != NULL;
+	     held = held->lk_nextheld) {
+		from = held->lk_ldclass;
+		if (held == skip || from == LOCKDEP_NOCLASS || from == cl) {
+			continue;
+		}
+		if ((lockdep_after[from] & LOCKDEP_BIT(cl)) == 0) {
+			lockdep_newedge(from, cl, held->lk_ldwhere, where);
+		}
+	}
+}
+
+void
+lockdep_signal(int cl, struct lock *skip, const void *where)
+{
+	struct lock *held;
+	int to;
+
+	if (cl == LOCKDEP_NOCLASS) {
+		return;
+	}
+	for (held = curthread->t_heldlocks; held != NULL;
+	     held = held->lk_nextheld) {
+		to = held->lk_ldclass;
+		if (held == skip || to == LOCKDEP_NOCLASS) {
+			continue;
+		}
+		if ((lockdep_after[cl] & LOCKDEP_BIT(to)) == 0) {
+			lockdep_newedge(cl, to, where, held->lk_ldwhere);
+		}
+	}
+}
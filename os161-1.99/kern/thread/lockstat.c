@@ -0,0 +1,316 @@
+/*
+ * Lock contention statistics (the lockstat option).
+ *
+ * Classes live in a fixed-size open-addressed hash table, so the lock
+ * code never has to allocate memory and a class pointer stays good
+ * forever. If the table fills up, further classes share one overflow
+ * entry.
+ *
+ * This is called from inside spinlock_acquire and spinlock_release,
+ * so it cannot use spinlocks itself. The table and each class are
+ * protected by raw machine-level lock words instead, taken with
+ * interrupts off.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <clock.h>
+#include <lockstat.h>
+
+#define LOCKSTAT_NCLASSES	256	/* Size of class table */
+#define LOCKSTAT_NAMELEN	24	/* Longest class name kept */
+#define LOCKSTAT_MAXPRINT	32	/* Most classes lockstat_print shows */
+
+struct lockstat {
+	char ls_name[LOCKSTAT_NAMELEN];	/* Class name; "" if slot unused */
+	const void *ls_key;		/* Class key, for spinlocks */
+	volatile spinlock_data_t ls_lock; /* Protects the counters */
+
+	unsigned ls_acquires;		/* Number of acquires */
+	unsigned ls_contended;		/* ...where the lock was held */
+	uint64_t ls_waitns;		/* Total time spent waiting */
+	uint64_t ls_maxwaitns;		/* Longest single wait */
+	uint64_t ls_holdns;		/* Total time held */
+	uint64_t ls_maxholdns;		/* Longest single hold */
+};
+
+static struct lockstat lockstat_table[LOCKSTAT_NCLASSES];
+static struct lockstat lockstat_overflow = { .ls_name = "(overflow)" };
+static unsigned lockstat_nclasses;
+static volatile spinlock_data_t lockstat_tablelock =
+	SPINLOCK_DATA_INITIALIZER;
+static bool lockstat_clockok;
+
+/*
+ * Raw lock words. Like spinlock_acquire, minus the statistics.
+ */
+static
+void
+lockstat_lock(volatile spinlock_data_t *sd)
+{
+	splraise(IPL_NONE, IPL_HIGH);
+	while (1) {
+		if (spinlock_data_get(sd) != 0) {
+			continue;
+		}
+		if (spinlock_data_testandset(sd) != 0) {
+			continue;
+		}
+		break;
+	}
+}
+
+static
+void
+lockstat_unlock(volatile spinlock_data_t *sd)
+{
+	spinlock_data_set(sd, 0);
+	spllower(IPL_HIGH, IPL_NONE);
+}
+
+/*
+ * Start timing. Called from boot() once the clock is attached.
+ */
+void
+lockstat_bootstrap(void)
+{
+	lockstat_clockok = true;
+}
+
+uint64_t
+lockstat_now(void)
+{
+	if (!lockstat_clockok) {
+		return 0;
+	}
+	return clock_getns();
+}
+
+/*
+ * Hash a class: by name for sleep locks, by key for spinlocks.
+ */
+static
+unsigned
+lockstat_hash(const char *name, const void *key)
+{
+	unsigned h;
+
+	if (name == NULL) {
+		h = (uintptr_t)key;
+		return (h >> 2) ^ (h >> 12);
+	}
+	h = 0;
+	while (*name != 0) {
+		h = h * 33 + (unsigned char)*name++;
+	}
+	return h;
+}
+
+/*
+ * Check if LS is the class for NAME/KEY. Long names are kept
+ * truncated, so only compare as much as we kept.
+ */
+static
+bool
+lockstat_match(struct lockstat *ls, const char *name, const void *key)
+{
+	unsigned i;
+
+	if (name == NULL || ls->ls_key != NULL) {
+		return ls->ls_key == key;
+	}
+	for (i=0; i<LOCKSTAT_NAMELEN-1; i++) {
+		if (ls->ls_name[i] != name[i]) {
+			return false;
+		}
+		if (name[i] == 0) {
+			break;
+		}
+	}
+	return true;
+}
+
+struct lockstat *
+lockstat_class(const char *name, const void *key)
+{
+	struct lockstat *ls;
+	unsigned i, slot;
+
+	KASSERT(name != NULL || key != NULL);
+
+	if (name != NULL && name[0] == 0) {
+		name = "(noname)";
+	}
+
+	lockstat_lock(&lockstat_tablelock);
+	slot = lockstat_hash(name, key) % LOCKSTAT_NCLASSES;
+	for (i=0; i<LOCKSTAT_NCLASSES; i++) {
+		ls = &lockstat_table[(slot + i) % LOCKSTAT_NCLASSES];
+		if (ls->ls_name[0] == 0) {
+			break;
+		}
+		if (lockstat_match(ls, name, key)) {
+			lockstat_unlock(&lockstat_tablelock);
+			return ls;
+		}
+	}
+
+	if (lockstat_nclasses >= LOCKSTAT_NCLASSES * 3 / 4) {
+		/* Keep probe chains short; lump the rest together. */
+		lockstat_unlock(&lockstat_tablelock);
+		return &lockstat_overflow;
+	}
+
+	if (name != NULL) {
+		for (i=0; i<LOCKSTAT_NAMELEN-1 && name[i] != 0; i++) {
+			ls->ls_name[i] = name[i];
+		}
+		ls->ls_name[i] = 0;
+		ls->ls_key = NULL;
+	}
+	else {
+		snprintf(ls->ls_name, sizeof(ls->ls_name), "spin %p", key);
+		ls->ls_key = key;
+	}
+	spinlock_data_set(&ls->ls_lock, 0);
+	lockstat_nclasses++;
+	lockstat_unlock(&lockstat_tablelock);
+	return ls;
+}
+
+void
+lockstat_acquired(struct lockstat *ls, bool contended,
+		  uint64_t waitstart, uint64_t now)
+{
+	uint64_t wait;
+
+	wait = (waitstart != 0 && now > waitstart) ? now - waitstart : 0;
+
+	lockstat_lock(&ls->ls_lock);
+	ls->ls_acquires++;
+	if (contended) {
+		ls->ls_contended++;
+		ls->ls_waitns += wait;
+		if (wait > ls->ls_maxwaitns) {
+			ls->ls_maxwaitns = wait;
+		}
+	}
+	lockstat_unlock(&ls->ls_lock);
+}
+
+void
+lockstat_released(struct lockstat *ls, uint64_t stamp)
+{
+	uint64_t now, hold;
+
+	if (stamp == 0) {
+		return;
+	}
+	now = lockstat_now();
+	hold = now > stamp ? now - stamp : 0;
+
+	lockstat_lock(&ls->ls_lock);
+	ls->ls_holdns += hold;
+	if (hold > ls->ls_maxholdns) {
+		ls->ls_maxholdns = hold;
+	}
+	lockstat_unlock(&ls->ls_lock);
+}
+
+/*
+ * Zero one class's counters.
+ */
+static
+void
+lockstat_zero(struct lockstat *ls)
+{
+	lockstat_lock(&ls->ls_lock);
+	ls->ls_acquires = 0;
+	ls->ls_contended = 0;
+	ls->ls_waitns = 0;
+	ls->ls_maxwaitns = 0;
+	ls->ls_holdns = 0;
+	ls->ls_maxholdns = 0;
+	lockstat_unlock(&ls->ls_lock);
+}
+
+void
+lockstat_reset(void)
+{
+	unsigned i;
+
+	for (i=0; i<LOCKSTAT_NCLASSES; i++) {
+		if (lockstat_table[i].ls_name[0] != 0) {
+			lockstat_zero(&lockstat_table[i]);
+		}
+	}
+	lockstat_zero(&lockstat_overflow);
+}
+
+/*
+ * Print the N classes with the most total wait time. We copy them out
+ * first, so as not to kprintf with interrupts off.
+ */
+void
+lockstat_print(unsigned n)
+{
+	struct lockstat *top, *ls;
+	unsigned i, j, ntop;
+
+	if (n > LOCKSTAT_MAXPRINT) {
+		n = LOCKSTAT_MAXPRINT;
+	}
+
+	/* Too big for the stack */
+	top = kmalloc((n > 0 ? n : 1) * sizeof(*top));
+	if (top == NULL) {
+		kprintf("lockstat: out of memory\n");
+		return;
+	}
+
+	ntop = 0;
+	for (i=0; i<=LOCKSTAT_NCLASSES; i++) {
+		ls = (i < LOCKSTAT_NCLASSES) ?
+			&lockstat_table[i] : &lockstat_overflow;
+		if (ls->ls_name[0] == 0 || ls->ls_acquires == 0) {
+			continue;
+		}
+
+		/* Insertion sort into top[], by wait time */
+		j = ntop;
+		while (j > 0 && top[j-1].ls_waitns < ls->ls_waitns) {
+			if (j < n) {
+				top[j] = top[j-1];
+			}
+			j--;
+		}
+		if (j < n) {
+			lockstat_lock(&ls->ls_lock);
+			top[j] = *ls;
+			lockstat_unlock(&ls->ls_lock);
+			if (ntop < n) {
+				ntop++;
+			}
+		}
+	}
+
+	kprintf("%-24s %9s %9s %10s %10s %10s %10s\n", "class",
+		"acquires", "contended", "wait(us)", "maxwait", "hold(us)",
+		"maxhold");
+	for (i=0; i<ntop; i++) {
+		ls = &top[i];
+		kprintf("%-24s %9u %9u %10lu %10lu %10lu %10lu\n",
+			ls->ls_name, ls->ls_acquires, ls->ls_contended,
+			(unsigned long)(ls->ls_waitns / 1000),
+			(unsigned long)(ls->ls_maxwaitns / 1000),
+			(unsigned long)(ls->ls_holdns / 1000),
+			(unsigned long)(ls->ls_maxholdns / 1000));
+	}
+	if (ntop == 0) {
+		kprintf("(no lock activity recorded)\n");
+	}
+
+	kfree(top);
+}
@@ -0,0 +1,59 @@
+/*
+ * Read-copy-update. See <rcu.h>.
+ *
+ * Each cpu counts its quiescent states in c_rcuqs: thread_switch
+ * bumps it on every switch (readers can't switch), and hardclock on
+ * every tick that didn't land inside a read section. A grace period
+ * is over once every other cpu's count has moved, or the cpu has been
+ * seen idle, since rcu_synchronize started; our own cpu is quiescent
+ * already, since we're not in a read section either. Counting idle
+ * cpus is only right because interrupt handlers can't be readers.
+ */
+
+/* Make sure to build out-of-line versions of inline functions */
+#define RCU_INLINE	/* empty */
+
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <cpu.h>
+#include <thread.h>
+#include <current.h>
+#include <rcu.h>
+
+/* How long to sleep between looks at the other cpus, in ns */
+#define RCU_POLL_NS	1000000
+
+static bool rcu_started;
+
+void
+rcu_bootstrap(void)
+{
+	rcu_started = true;
+}
+
+void
+rcu_synchronize(void)
+{
+	struct cpu *c;
+	unsigned i, n, seen;
+
+	KASSERT(!curthread->t_in_interrupt);
+	KASSERT(curthread->t_rcunest == 0);
+
+	if (!rcu_started) {
+		return;
+	}
+
+	n = cpu_count();
+	for (i=0; i<n; i++) {
+		c = cpu_bynumber(i);
+		if (c == curcpu->c_self) {
+			continue;
+		}
+		seen = c->c_rcuqs;
+		while (c->c_rcuqs == seen && !c->c_isidle) {
+			thread_sleep_until(clock_getns() + RCU_POLL_NS);
+		}
+	}
+}
@@ -0,0 +1,46 @@
+/*
+ * Sequence locks. See <seqlock.h>.
+ */
+
+/* Make sure to build out-of-line versions of inline functions */
+#define SEQLOCK_INLINE	/* empty */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <seqlock.h>
+
+void
+seqlock_init(struct seqlock *sl)
+{
+	spinlock_init(&sl->sl_lock);
+	sl->sl_seq = 0;
+}
+
+void
+seqlock_cleanup(struct seqlock *sl)
+{
+	KASSERT((sl->sl_seq & 1) == 0);
+	spinlock_cleanup(&sl->sl_lock);
+}
+
+/*
+ * The spinlock keeps interrupts off during the write, so a reader on
+ * this cpu can't come along and spin forever on the odd number.
+ */
+void
+seqlock_write_begin(struct seqlock *sl)
+{
+	spinlock_acquire(&sl->sl_lock);
+	sl->sl_seq++;
+	membar_store_store();
+}
+
+void
+seqlock_write_end(struct seqlock *sl)
+{
+	KASSERT(sl->sl_seq & 1);
+	membar_store_store();
+	sl->sl_seq++;
+	spinlock_release(&sl->sl_lock);
+}
@@ -35,6 +35,8 @@
 #include <cpu.h>
 #include <spl.h>
 #include <spinlock.h>
+#include <lockstat.h>
+#include <splwatch.h>
 #include <current.h>	/* for curcpu */
 
 /*
@@ -48,8 +50,22 @@
 void
 spinlock_init(struct spinlock *lk)
 {
+#if OPT_TICKETLOCK
+	spinlock_data_set(&lk->lk_next, 0);
+	spinlock_data_set(&lk->lk_serving, 0);
+#else
 	spinlock_data_set(&lk->lk_lock, 0);
+#endif
 	lk->lk_holder = NULL;
+#if OPT_LOCKSTAT
+	/* Class is the caller, e.g. all wchan locks count together */
+	lk->lk_stat = lockstat_class(NULL, __builtin_return_address(0));
+	lk->lk_stamp = 0;
+#endif
+#if OPT_SPLWATCH
+	lk->lk_wstart = 0;
+	lk->lk_wsite = NULL;
+#endif
 }
 
 /*
@@ -59,7 +75,12 @@ void
 spinlock_cleanup(struct spinlock *lk)
 {
 	KASSERT(lk->lk_holder == NULL);
+#if OPT_TICKETLOCK
+	KASSERT(spinlock_data_get(&lk->lk_next) ==
+		spinlock_data_get(&lk->lk_serving));
+#else
 	KASSERT(spinlock_data_get(&lk->lk_lock) == 0);
+#endif
 }
 
 /*
@@ -68,13 +89,30 @@ spinlock_cleanup(struct spinlock *lk)
  * First disable interrupts (otherwise, if we get a timer interrupt we
  * might come back to this lock and deadlock), then use a machine-level
  * atomic operation to wait for the lock to be free.
+ *
+ * With the ticketlock option the atomic operation is a fetch-and-add
+ * that takes a ticket, and the wait is for our number to come up.
+ *
+ * With the lockstat option we also note whether the lock was held
+ * when we got here and how long we waited; this is only bookkeeping
+ * and does not change how the lock is taken.
  */
 void
 spinlock_acquire(struct spinlock *lk)
 {
 	struct cpu *mycpu;
+#if OPT_TICKETLOCK
+	spinlock_data_t ticket;
+#endif
+#if OPT_LOCKSTAT
+	uint64_t waitstart;
+	bool contended;
+#endif
 
 	splraise(IPL_NONE, IPL_HIGH);
+#if OPT_SPLWATCH
+	splwatch_site(__builtin_return_address(0));
+#endif
 
 	/* this must work before curcpu initialization */
 	if (CURCPU_EXISTS()) {
@@ -87,6 +125,22 @@ spinlock_acquire(struct spinlock *lk)
 		mycpu = NULL;
 	}
 
+#if OPT_LOCKSTAT
+	waitstart = lockstat_now();
+#endif
+
+#if OPT_TICKETLOCK
+	ticket = spinlock_data_fetchadd(&lk->lk_next, 1);
+#if OPT_LOCKSTAT
+	contended = spinlock_data_get(&lk->lk_serving) != ticket;
+#endif
+	while (spinlock_data_get(&lk->lk_serving) != ticket) {
+		/* spin; only the holder writes lk_serving */
+	}
+#else
+#if OPT_LOCKSTAT
+	contended = spinlock_data_get(&lk->lk_lock) != 0;
+#endif
 	while (1) {
 		/*
 		 * Do test-test-and-set, that is, read first before
@@ -106,8 +160,22 @@ spinlock_acquire(struct spinlock *lk)
 		}
 		break;
 	}
+#endif
 
 	lk->lk_holder = mycpu;
+
+#if OPT_LOCKSTAT
+	if (lk->lk_stat == NULL) {
+		/* Statically initialized; the lock is its own class */
+		lk->lk_stat = lockstat_class(NULL, lk);
+	}
+	lk->lk_stamp = lockstat_now();
+	lockstat_acquired(lk->lk_stat, contended, waitstart, lk->lk_stamp);
+#endif
+#if OPT_SPLWATCH
+	lk->lk_wstart = splwatch_now();
+	lk->lk_wsite = __builtin_return_address(0);
+#endif
 }
 
 /*
@@ -121,9 +189,28 @@ spinlock_release(struct spinlock *lk)
 		KASSERT(lk->lk_holder == curcpu->c_self);
 	}
 
+#if OPT_LOCKSTAT
+	lockstat_released(lk->lk_stat, lk->lk_stamp);
+	lk->lk_stamp = 0;
+#endif
+#if OPT_SPLWATCH
+	splwatch_held(SPLWATCH_SPINLOCK, lk->lk_wsite, lk->lk_wstart);
+	lk->lk_wstart = 0;
+#endif
+
 	lk->lk_holder = NULL;
+#if OPT_TICKETLOCK
+	/* We hold the lock, so nobody else can be changing lk_serving. */
+	spinlock_data_set(&lk->lk_serving,
+			  spinlock_data_get(&lk->lk_serving) + 1);
+#else
 	spinlock_data_set(&lk->lk_lock, 0);
+#endif
 	spllower(IPL_HIGH, IPL_NONE);
+#if OPT_SPLWATCH
+	/* If that was the last lock held, any warning can be printed */
+	splwatch_report();
+#endif
 }
 
 /*
@@ -36,6 +36,8 @@
 #include <spl.h>
 #include <thread.h>
 #include <current.h>
+#include <clock.h>
+#include <splwatch.h>
 
 /*
  * Machine-independent interrupt handling functions.
@@ -55,6 +57,112 @@
  */
 
 
+#if OPT_SPLSTAT
+/*
+ * splhigh time accounting (the splstat option).
+ *
+ * The outermost raise stamps the time in curcpu->c_splhighstart and
+ * the matching lower adds up the interval. Reading the clock raises
+ * the spl again itself, but only from 1 to 2, so it doesn't recurse.
+ *
+ * Interrupt handlers don't go through here (the trap code sets the
+ * counts directly), so time spent in them isn't counted; that's
+ * interrupt time rather than time with interrupts held off. Across
+ * a thread switch the stamp belongs to the cpu; splstat_switch
+ * closes it off, and restarts it unless the next thread is going to
+ * get its interrupts back by returning from a trap.
+ */
+
+static bool splstat_clockok;
+
+void
+splstat_bootstrap(void)
+{
+	splstat_clockok = true;
+}
+
+static
+void
+splstat_start(void)
+{
+	if (splstat_clockok) {
+		curcpu->c_splhighstart = clock_getns();
+	}
+}
+
+static
+void
+splstat_stop(void)
+{
+	struct cpu *c = curcpu;
+
+	if (c->c_splhighstart != 0) {
+		c->c_splhighns += clock_getns() - c->c_splhighstart;
+		c->c_splhighstart = 0;
+	}
+}
+
+void
+splstat_switch(struct thread *next)
+{
+	splstat_stop();
+	if (!next->t_in_interrupt) {
+		splstat_start();
+	}
+}
+#endif /* OPT_SPLSTAT */
+
+#if OPT_SPLWATCH
+/*
+ * splhigh hold timing for the splwatch option. This works like the
+ * splstat accounting above, except that each interval is charged to
+ * a call site, in curcpu->c_splwsite. splraise can only see its own
+ * caller, which is usually splx or spinlock_acquire, so those call
+ * splwatch_site afterwards to put in their caller instead.
+ */
+
+static
+void
+splwatch_start(const void *where)
+{
+	struct cpu *c = curcpu;
+
+	c->c_splwstart = splwatch_now();
+	c->c_splwsite = where;
+}
+
+static
+void
+splwatch_stop(void)
+{
+	struct cpu *c = curcpu;
+	uint64_t start;
+
+	if (c->c_splwstart != 0) {
+		start = c->c_splwstart;
+		c->c_splwstart = 0;
+		splwatch_held(SPLWATCH_SPL, c->c_splwsite, start);
+	}
+}
+
+void
+splwatch_site(const void *where)
+{
+	if (CURCPU_EXISTS() && curthread->t_iplhigh_count == 1) {
+		curcpu->c_splwsite = where;
+	}
+}
+
+void
+splwatch_switch(struct thread *next)
+{
+	splwatch_stop();
+	if (!next->t_in_interrupt) {
+		splwatch_start(__builtin_return_address(0));
+	}
+}
+#endif /* OPT_SPLWATCH */
+
 /*
  * Raise and lower the interrupt priority level.
  *
@@ -101,6 +209,16 @@ splraise(int oldspl, int newspl)
 		cpu_irqoff();
 	}
 	cur->t_iplhigh_count++;
+#if OPT_SPLSTAT
+	if (cur->t_iplhigh_count == 1) {
+		splstat_start();
+	}
+#endif
+#if OPT_SPLWATCH
+	if (cur->t_iplhigh_count == 1) {
+		splwatch_start(__builtin_return_address(0));
+	}
+#endif
 }
 
 void
@@ -117,6 +235,16 @@ spllower(int oldspl, int newspl)
 		return;
 	}
 
+#if OPT_SPLSTAT
+	if (cur->t_iplhigh_count == 1) {
+		splstat_stop();
+	}
+#endif
+#if OPT_SPLWATCH
+	if (cur->t_iplhigh_count == 1) {
+		splwatch_stop();
+	}
+#endif
 	cur->t_iplhigh_count--;
 	if (cur->t_iplhigh_count == 0) {
 		cpu_irqon();
@@ -137,6 +265,9 @@ splx(int spl)
 	if (cur->t_curspl < spl) {
 		/* turning interrupts off */
 		splraise(cur->t_curspl, spl);
+#if OPT_SPLWATCH
+		splwatch_site(__builtin_return_address(0));
+#endif
 		ret = cur->t_curspl;
 		cur->t_curspl = spl;
 	}
@@ -145,6 +276,9 @@ splx(int spl)
 		ret = cur->t_curspl;
 		cur->t_curspl = spl;
 		spllower(ret, spl);
+#if OPT_SPLWATCH
+		splwatch_report();
+#endif
 	}
 	else {
 		/* do nothing */
@@ -0,0 +1,341 @@
+/*
+ * Interrupts-off watchdog (the splwatch option). See <splwatch.h>.
+ *
+ * Call sites live in a fixed-size open-addressed hash table, like the
+ * classes in lockstat.c, and for the same reason this can't use
+ * spinlocks: it's called from spinlock_release and spllower. The
+ * table and each site are protected by raw machine-level lock words
+ * instead, taken with interrupts off. Taking those raises the spl
+ * from 1 to 2 at the least, so it never recurses into the spl hooks.
+ *
+ * The spl hooks themselves (when a cpu goes to splhigh and back) are
+ * in spl.c; the spinlock ones are in spinlock.c.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <cpu.h>
+#include <thread.h>
+#include <current.h>
+#include <clock.h>
+#include <membar.h>
+#include <splwatch.h>
+
+#define SPLWATCH_NSITES		128	/* Size of site table */
+#define SPLWATCH_MAXPRINT	16	/* Most sites splwatch_print shows */
+#define SPLWATCH_DEFLIMIT	10000000ULL	/* Default limit: 10 ms */
+
+struct splwatch_site {
+	const void *sw_where;		/* Call site; NULL if slot unused */
+	int sw_kind;			/* SPLWATCH_* */
+	volatile spinlock_data_t sw_lock; /* Protects the counters */
+
+	unsigned sw_holds;		/* Number of holds */
+	uint64_t sw_totalns;		/* Total time held */
+	uint64_t sw_maxns;		/* Longest single hold */
+};
+
+static const char *const splwatch_kindnames[] = {
+	"splhigh", "spinlock",
+};
+
+static struct splwatch_site splwatch_table[SPLWATCH_NSITES];
+static struct splwatch_site splwatch_overflow;
+static volatile spinlock_data_t splwatch_tablelock =
+	SPINLOCK_DATA_INITIALIZER;
+static bool splwatch_clockok;
+
+static uint64_t splwatch_limit = SPLWATCH_DEFLIMIT;
+static bool splwatch_dopanic;
+
+/*
+ * Raw lock words. Like spinlock_acquire, minus all the hooks.
+ */
+static
+void
+splwatch_lock(volatile spinlock_data_t *sd)
+{
+	splraise(IPL_NONE, IPL_HIGH);
+	while (1) {
+		if (spinlock_data_get(sd) != 0) {
+			continue;
+		}
+		if (spinlock_data_testandset(sd) != 0) {
+			continue;
+		}
+		break;
+	}
+}
+
+static
+void
+splwatch_unlock(volatile spinlock_data_t *sd)
+{
+	spinlock_data_set(sd, 0);
+	spllower(IPL_HIGH, IPL_NONE);
+}
+
+/*
+ * Start timing. Called from boot() once the clock is attached.
+ */
+void
+splwatch_bootstrap(void)
+{
+	splwatch_clockok = true;
+}
+
+uint64_t
+splwatch_now(void)
+{
+	if (!splwatch_clockok) {
+		return 0;
+	}
+	return clock_getns();
+}
+
+/*
+ * Find or create the entry for a site. Entries are never freed, so
+ * once a slot's sw_where is set it can be checked without locking;
+ * sw_kind is always set first.
+ */
+static
+struct splwatch_site *
+splwatch_lookup(int kind, const void *where)
+{
+	struct splwatch_site *sw;
+	unsigned start, i;
+
+	start = (((uintptr_t)where >> 2) * 2 + kind) % SPLWATCH_NSITES;
+
+	/* Fast path: already there */
+	for (i = start; ; ) {
+		sw = &splwatch_table[i];
+		if (sw->sw_where == NULL) {
+			break;
+		}
+		if (sw->sw_where == where && sw->sw_kind == kind) {
+			return sw;
+		}
+		i = (i + 1) % SPLWATCH_NSITES;
+		if (i == start) {
+			return &splwatch_overflow;
+		}
+	}
+
+	/* Not found; look again with the table locked, and add it */
+	splwatch_lock(&splwatch_tablelock);
+	for (i = start; ; ) {
+		sw = &splwatch_table[i];
+		if (sw->sw_where == NULL) {
+			sw->sw_kind = kind;
+			membar_store_store();
+			sw->sw_where = where;
+			break;
+		}
+		if (sw->sw_where == where && sw->sw_kind == kind) {
+			break;
+		}
+		i = (i + 1) % SPLWATCH_NSITES;
+		if (i == start) {
+			sw = &splwatch_overflow;
+			break;
+		}
+	}
+	splwatch_unlock(&splwatch_tablelock);
+	return sw;
+}
+
+void
+splwatch_held(int kind, const void *where, uint64_t start)
+{
+	struct splwatch_site *sw;
+	struct cpu *c;
+	uint64_t now, hold;
+	bool newmax;
+
+	if (start == 0 || !CURCPU_EXISTS() || curthread->t_splwreport) {
+		return;
+	}
+
+	now = clock_getns();
+	hold = now > start ? now - start : 0;
+
+	sw = splwatch_lookup(kind, where);
+	splwatch_lock(&sw->sw_lock);
+	sw->sw_holds++;
+	sw->sw_totalns += hold;
+	newmax = hold > sw->sw_maxns;
+	if (newmax) {
+		sw->sw_maxns = hold;
+	}
+	splwatch_unlock(&sw->sw_lock);
+
+	if (splwatch_limit == 0 || hold <= splwatch_limit) {
+		return;
+	}
+	if (splwatch_dopanic) {
+		panic("splwatch: %s held for %lu us, from %p\n",
+		      splwatch_kindnames[kind], (unsigned long)(hold / 1000),
+		      where);
+	}
+	if (!newmax) {
+		return;
+	}
+
+	/* Keep the worst one for splwatch_report */
+	c = curcpu;
+	if (hold > c->c_splwpendns) {
+		c->c_splwpendkind = kind;
+		c->c_splwpendsite = where;
+		c->c_splwpendns = hold;
+	}
+}
+
+void
+splwatch_report(void)
+{
+	struct thread *cur;
+	struct cpu *c;
+	const void *where;
+	uint64_t hold;
+	int kind, s;
+
+	if (!CURCPU_EXISTS() || curcpu->c_splwpendns == 0) {
+		return;
+	}
+	cur = curthread;
+	if (cur->t_splwreport) {
+		return;
+	}
+	if (cur->t_iplhigh_count > 0) {
+		/*
+		 * Some other spinlock or raised spl is still in force;
+		 * leave it for whichever release ends the last of them.
+		 */
+		return;
+	}
+
+	/* Don't time (or report) what we do here */
+	cur->t_splwreport = true;
+
+	s = splhigh();
+	c = curcpu;
+	kind = c->c_splwpendkind;
+	where = c->c_splwpendsite;
+	hold = c->c_splwpendns;
+	c->c_splwpendns = 0;
+	splx(s);
+
+	if (hold > 0) {
+		kprintf("splwatch: %s held for %lu us, from %p\n",
+			splwatch_kindnames[kind], (unsigned long)(hold / 1000),
+			where);
+	}
+
+	cur->t_splwreport = false;
+}
+
+void
+splwatch_setlimit(uint64_t ns, bool dopanic)
+{
+	splwatch_limit = ns;
+	splwatch_dopanic = dopanic;
+}
+
+/*
+ * Zero one site's counters.
+ */
+static
+void
+splwatch_zero(struct splwatch_site *sw)
+{
+	splwatch_lock(&sw->sw_lock);
+	sw->sw_holds = 0;
+	sw->sw_totalns = 0;
+	sw->sw_maxns = 0;
+	splwatch_unlock(&sw->sw_lock);
+}
+
+void
+splwatch_reset(void)
+{
+	unsigned i;
+
+	for (i=0; i<SPLWATCH_NSITES; i++) {
+		if (splwatch_table[i].sw_where != NULL) {
+			splwatch_zero(&splwatch_table[i]);
+		}
+	}
+	splwatch_zero(&splwatch_overflow);
+}
+
+/*
+ * Print the N sites with the longest single hold. As in lockstat.c,
+ * copy them out first so as not to kprintf with interrupts off.
+ */
+void
+splwatch_print(unsigned n)
+{
+	struct splwatch_site top[SPLWATCH_MAXPRINT];
+	struct splwatch_site *sw;
+	unsigned i, j, ntop;
+
+	if (n > SPLWATCH_MAXPRINT) {
+		n = SPLWATCH_MAXPRINT;
+	}
+
+	ntop = 0;
+	for (i=0; i<=SPLWATCH_NSITES; i++) {
+		sw = (i < SPLWATCH_NSITES) ?
+			&splwatch_table[i] : &splwatch_overflow;
+		if (sw->sw_holds == 0) {
+			continue;
+		}
+
+		/* Insertion sort into top[], by longest hold */
+		j = ntop;
+		while (j > 0 && top[j-1].sw_maxns < sw->sw_maxns) {
+			if (j < n) {
+				top[j] = top[j-1];
+			}
+			j--;
+		}
+		if (j < n) {
+			splwatch_lock(&sw->sw_lock);
+			top[j] = *sw;
+			splwatch_unlock(&sw->sw_lock);
+			if (ntop < n) {
+				ntop++;
+			}
+		}
+	}
+
+	if (splwatch_limit == 0) {
+		kprintf("No hold time limit\n");
+	}
+	else {
+		kprintf("Hold time limit: %lu us (%s)\n",
+			(unsigned long)(splwatch_limit / 1000),
+			splwatch_dopanic ? "panic" : "warn");
+	}
+	kprintf("%-8s %-10s %10s %10s %10s\n", "kind", "site", "holds",
+		"hold(us)", "maxhold");
+	for (i=0; i<ntop; i++) {
+		sw = &top[i];
+		if (sw->sw_where == NULL) {
+			kprintf("%-8s %-10s", "", "(overflow)");
+		}
+		else {
+			kprintf("%-8s %-10p", splwatch_kindnames[sw->sw_kind],
+				sw->sw_where);
+		}
+		kprintf(" %10u %10lu %10lu\n", sw->sw_holds,
+			(unsigned long)(sw->sw_totalns / 1000),
+			(unsigned long)(sw->sw_maxns / 1000));
+	}
+	if (ntop == 0) {
+		kprintf("(no holds recorded)\n");
+	}
+}
@@ -34,7 +34,10 @@
 
 #include <types.h>
 #include <lib.h>
+#include <cpu.h>
 #include <spinlock.h>
+#include <lockstat.h>
+#include <lockdep.h>
 #include <wchan.h>
 #include <thread.h>
 #include <current.h>
@@ -71,6 +74,7 @@ sem_create(const char *name, int initial_count)
 
 	spinlock_init(&sem->sem_lock);
         sem->sem_count = initial_count;
+	sem->sem_nwaiters = 0;
 
         return sem;
 }
@@ -87,6 +91,24 @@ sem_destroy(struct semaphore *sem)
         kfree(sem);
 }
 
+/*
+ * Take one from the count if it's positive. Returns true if we did.
+ */
+static
+bool
+sem_trydown(struct semaphore *sem)
+{
+	spinlock_data_t count;
+
+	while ((count = spinlock_data_get(&sem->sem_count)) > 0) {
+		if (spinlock_data_cas(&sem->sem_count, count, count - 1)
+		    == count) {
+			return true;
+		}
+	}
+	return false;
+}
+
 void 
 P(struct semaphore *sem)
 {
@@ -100,8 +122,21 @@ P(struct semaphore *sem)
          */
         KASSERT(curthread->t_in_interrupt == false);
 
+	/* Fast path: nothing to wait for. */
+	if (sem_trydown(sem)) {
+		return;
+	}
+
+	/*
+	 * Slow path. Count ourselves in sem_nwaiters *before* looking
+	 * at the count again, so that a V that increments the count
+	 * after we look is sure to see us and come wake us up. (LL/SC
+	 * keeps these in order on our sequentially consistent
+	 * machine; elsewhere this would need memory barriers.)
+	 */
 	spinlock_acquire(&sem->sem_lock);
-        while (sem->sem_count == 0) {
+	sem->sem_nwaiters++;
+        while (!sem_trydown(sem)) {
 		/*
 		 * Bridge to the wchan lock, so if someone else comes
 		 * along in V right this instant the wakeup can't go
@@ -124,22 +159,32 @@ P(struct semaphore *sem)
 
 		spinlock_acquire(&sem->sem_lock);
         }
-        KASSERT(sem->sem_count > 0);
-        sem->sem_count--;
+	sem->sem_nwaiters--;
 	spinlock_release(&sem->sem_lock);
 }
 
 void
 V(struct semaphore *sem)
 {
+	spinlock_data_t count;
+
         KASSERT(sem != NULL);
 
-	spinlock_acquire(&sem->sem_lock);
+	count = spinlock_data_fetchadd(&sem->sem_count, 1);
+	KASSERT(count + 1 > 0);
 
-        sem->sem_count++;
-        KASSERT(sem->sem_count > 0);
-	wchan_wakeone(sem->sem_wchan);
+	/* Fast path: nobody to wake. */
+	if (sem->sem_nwaiters == 0) {
+		return;
+	}
 
+	/*
+	 * Someone's in P's slow path. Take the spinlock so that if
+	 * they haven't got as far as the wchan yet, we wait for them
+	 * to get there rather than wake nobody.
+	 */
+	spinlock_acquire(&sem->sem_lock);
+	wchan_wakeone(sem->sem_wchan);
 	spinlock_release(&sem->sem_lock);
 }
 
@@ -151,6 +196,7 @@ struct lock *
 lock_create(const char *name)
 {
         struct lock *lock;
+	unsigned i;
 
         lock = kmalloc(sizeof(struct lock));
         if (lock == NULL) {
@@ -162,9 +208,32 @@ lock_create(const char *name)
                 kfree(lock);
                 return NULL;
         }
-        
-        // add stuff here as needed
-        
+
+	lock->lk_wchan = wchan_create(lock->lk_name);
+	if (lock->lk_wchan == NULL) {
+		kfree(lock->lk_name);
+		kfree(lock);
+		return NULL;
+	}
+
+	spinlock_init(&lock->lk_lock);
+	lock->lk_owner = NULL;
+	lock->lk_spinhits = 0;
+	lock->lk_sleeps = 0;
+	for (i=0; i<SCHED_NLEVELS; i++) {
+		lock->lk_piwaiters[i] = 0;
+	}
+	lock->lk_npiwaiters = 0;
+	lock->lk_nextheld = NULL;
+#if OPT_LOCKSTAT
+	lock->lk_stat = lockstat_class(lock->lk_name, NULL);
+	lock->lk_stamp = 0;
+#endif
+#if OPT_LOCKDEP
+	lock->lk_ldclass = lockdep_class(lock->lk_name, false);
+	lock->lk_ldwhere = NULL;
+#endif
+
         return lock;
 }
 
@@ -172,48 +241,391 @@ void
 lock_destroy(struct lock *lock)
 {
         KASSERT(lock != NULL);
+	KASSERT(lock->lk_owner == NULL);
+	KASSERT(lock->lk_npiwaiters == 0);
 
-        // add stuff here as needed
-        
+	/* wchan_cleanup will assert if anyone's waiting on it */
+	spinlock_cleanup(&lock->lk_lock);
+	wchan_destroy(lock->lk_wchan);
         kfree(lock->lk_name);
         kfree(lock);
 }
 
+/*
+ * Priority inheritance.
+ *
+ * A thread about to sleep on a lock records the level it's waiting
+ * at (its effective level, t_waitpri) in the lock's lk_piwaiters
+ * counts and points t_blockedon at the lock. The owner then inherits
+ * the best level waiting on any lock it holds; if the owner is itself
+ * asleep on another lock, its own entry there is moved up and that
+ * lock's owner inherits in turn, and so on down the chain.
+ *
+ * All of this is protected by the one global spinlock lock_pilock,
+ * so that a chain can be followed without taking every lock in it.
+ * It's only taken when a thread has to sleep, and by owners of locks
+ * that have sleepers, so the uncontended paths never touch it.
+ *
+ * Lock order: lk_lock, then lock_pilock, then run queue locks.
+ * (cv_broadcast also takes the wchan locks between lk_lock and
+ * lock_pilock.)
+ *
+ * A lock with sleepers registered only changes owner under
+ * lock_pilock; since registering and unregistering require lk_lock
+ * as well, lk_npiwaiters can be checked under lk_lock alone to see
+ * whether that's necessary.
+ */
+static struct spinlock lock_pilock = SPINLOCK_INITIALIZER;
+
+/*
+ * Best level waiting on LOCK, or SCHED_NLEVELS if none.
+ */
+static
+int
+lock_pi_top(struct lock *lock)
+{
+	int i;
+
+	KASSERT(spinlock_do_i_hold(&lock_pilock));
+
+	for (i=0; i<SCHED_NLEVELS; i++) {
+		if (lock->lk_piwaiters[i] > 0) {
+			break;
+		}
+	}
+	return i;
+}
+
+/*
+ * Hand LOCK's best waiting level to its owner and on down the chain
+ * of owners, stopping at the first one that's already at least that
+ * good.
+ */
+static
+void
+lock_pi_propagate(struct lock *lock)
+{
+	struct thread *owner;
+	int pri;
+
+	KASSERT(spinlock_do_i_hold(&lock_pilock));
+
+	pri = lock_pi_top(lock);
+	while (lock != NULL) {
+		owner = lock->lk_owner;
+		if (owner == NULL || thread_effpri(owner) <= pri) {
+			break;
+		}
+		thread_setinherited(owner, pri);
+
+		lock = owner->t_blockedon;
+		if (lock != NULL) {
+			KASSERT(lock->lk_piwaiters[owner->t_waitpri] > 0);
+			lock->lk_piwaiters[owner->t_waitpri]--;
+			owner->t_waitpri = pri;
+			lock->lk_piwaiters[pri]++;
+		}
+	}
+}
+
+/*
+ * Register T as sleeping on LOCK, and boost the owner(s).
+ */
+static
+void
+lock_pi_register(struct lock *lock, struct thread *t)
+{
+	KASSERT(spinlock_do_i_hold(&lock->lk_lock));
+
+	spinlock_acquire(&lock_pilock);
+	KASSERT(t->t_blockedon == NULL);
+	t->t_blockedon = lock;
+	t->t_waitpri = thread_effpri(t);
+	lock->lk_piwaiters[t->t_waitpri]++;
+	lock->lk_npiwaiters++;
+	lock_pi_propagate(lock);
+	spinlock_release(&lock_pilock);
+}
+
+/*
+ * Register curthread as about to sleep on LOCK.
+ */
+static
+void
+lock_pi_block(struct lock *lock)
+{
+	lock_pi_register(lock, curthread);
+}
+
+/*
+ * wchan_moveall callback for cv_broadcast: T has just been moved onto
+ * the wchan of LOCK (DATA), so register it there as if it had gone to
+ * sleep on the lock itself. It undoes this in cv_wait when it wakes.
+ */
+static
+void
+lock_pi_moved(struct thread *t, void *data)
+{
+	lock_pi_register(data, t);
+}
+
+/*
+ * Undo lock_pi_block after waking up.
+ */
+static
+void
+lock_pi_unblock(struct lock *lock)
+{
+	KASSERT(spinlock_do_i_hold(&lock->lk_lock));
+
+	spinlock_acquire(&lock_pilock);
+	KASSERT(curthread->t_blockedon == lock);
+	KASSERT(lock->lk_piwaiters[curthread->t_waitpri] > 0);
+	lock->lk_piwaiters[curthread->t_waitpri]--;
+	lock->lk_npiwaiters--;
+	curthread->t_blockedon = NULL;
+	curthread->t_waitpri = SCHED_NLEVELS;
+	spinlock_release(&lock_pilock);
+}
+
+/*
+ * Recompute what curthread inherits from the locks it still holds.
+ * Nobody can be inheriting through curthread, since it isn't asleep
+ * on anything, so nothing further needs to change.
+ */
+static
+void
+lock_pi_recompute(void)
+{
+	struct lock *held;
+	int pri, top;
+
+	KASSERT(spinlock_do_i_hold(&lock_pilock));
+	KASSERT(curthread->t_blockedon == NULL);
+
+	pri = SCHED_NLEVELS;
+	for (held = curthread->t_heldlocks; held != NULL;
+	     held = held->lk_nextheld) {
+		top = lock_pi_top(held);
+		if (top < pri) {
+			pri = top;
+		}
+	}
+	thread_setinherited(curthread, pri);
+}
+
+/*
+ * Check if it's worth spinning while OWNER holds the lock: only if
+ * it's actually running, and on some other CPU. (If it's on our CPU
+ * it can't run until we get off, and if it's asleep or waiting for a
+ * CPU it won't be done any time soon.)
+ *
+ * Must be called with the lock's spinlock held; that keeps OWNER from
+ * releasing the lock, and therefore from exiting, while we look at it.
+ */
+static
+bool
+lock_owner_oncpu(struct lock *lock, struct thread *owner)
+{
+	KASSERT(spinlock_do_i_hold(&lock->lk_lock));
+
+	return owner->t_state == S_RUN && owner->t_cpu != curcpu->c_self;
+}
+
 void
 lock_acquire(struct lock *lock)
 {
-	KASSERT(lock->owner == curthread);
-	spinlock_acquire(lock->spin);
-	while(lock->held){
-		wchan_lock(lock->wc);
-		spinlock_release(lock->spin);
-		wchan_sleep(lock->wc);
-		spinlock_acquire(lock->spin);
+	struct thread *owner;
+	unsigned spins;
+	bool spun;
+#if OPT_LOCKSTAT
+	uint64_t waitstart;
+	bool contended;
+#endif
+
+	KASSERT(lock != NULL);
+
+	/* May not block in an interrupt handler. */
+	KASSERT(curthread->t_in_interrupt == false);
+
+	spins = 0;
+	spun = false;
+#if OPT_LOCKSTAT
+	waitstart = lockstat_now();
+#endif
+#if OPT_LOCKDEP
+	/* Check the order before we can get stuck */
+	lockdep_acquire(lock->lk_ldclass, NULL, __builtin_return_address(0));
+#endif
+
+	spinlock_acquire(&lock->lk_lock);
+	if (lock->lk_owner == curthread) {
+		panic("Deadlock on lock %s\n", lock->lk_name);
+	}
+#if OPT_LOCKSTAT
+	contended = lock->lk_owner != NULL;
+#endif
+        while (lock->lk_owner != NULL) {
+		owner = lock->lk_owner;
+		if (spins < LOCK_SPIN_LIMIT &&
+		    lock_owner_oncpu(lock, owner)) {
+			/*
+			 * Spin without the spinlock, watching only the
+			 * owner pointer (not the owner itself, which
+			 * could be gone once it lets go), then go back
+			 * and look again under the spinlock.
+			 */
+			spinlock_release(&lock->lk_lock);
+			while (lock->lk_owner == owner &&
+			       spins < LOCK_SPIN_LIMIT) {
+				spins++;
+			}
+			spun = true;
+			spinlock_acquire(&lock->lk_lock);
+			continue;
+		}
+
+		/*
+		 * Bridge to the wchan lock, exactly as in P().
+		 */
+		lock->lk_sleeps++;
+		spun = false;
+		lock_pi_block(lock);
+		wchan_lock(lock->lk_wchan);
+		spinlock_release(&lock->lk_lock);
+		wchan_sleep(lock->lk_wchan);
+
+		spinlock_acquire(&lock->lk_lock);
+		lock_pi_unblock(lock);
+	}
+	if (spun) {
+		lock->lk_spinhits++;
+	}
+	if (lock->lk_npiwaiters > 0) {
+		/* Others are still asleep on it; inherit from them. */
+		spinlock_acquire(&lock_pilock);
+		lock->lk_owner = curthread;
+		lock_pi_propagate(lock);
+		spinlock_release(&lock_pilock);
+	}
+	else {
+		lock->lk_owner = curthread;
+	}
+	spinlock_release(&lock->lk_lock);
+
+	/* Only we use this list, so it needs no locking. */
+	lock->lk_nextheld = curthread->t_heldlocks;
+	curthread->t_heldlocks = lock;
+#if OPT_LOCKDEP
+	lock->lk_ldwhere = __builtin_return_address(0);
+#endif
+
+#if OPT_LOCKSTAT
+	lock->lk_stamp = lockstat_now();
+	lockstat_acquired(lock->lk_stat, contended, waitstart,
+			  lock->lk_stamp);
+#endif
+}
+
+bool
+lock_tryacquire(struct lock *lock)
+{
+	KASSERT(lock != NULL);
+
+	spinlock_acquire(&lock->lk_lock);
+	if (lock->lk_owner != NULL) {
+		spinlock_release(&lock->lk_lock);
+		return false;
+	}
+	if (lock->lk_npiwaiters > 0) {
+		/* Woken waiters haven't got it back yet; as in lock_acquire. */
+		spinlock_acquire(&lock_pilock);
+		lock->lk_owner = curthread;
+		lock_pi_propagate(lock);
+		spinlock_release(&lock_pilock);
+	}
+	else {
+		lock->lk_owner = curthread;
 	}
-        //(void)lock;  // suppress warning until code gets written
+	spinlock_release(&lock->lk_lock);
+
+	lock->lk_nextheld = curthread->t_heldlocks;
+	curthread->t_heldlocks = lock;
+#if OPT_LOCKDEP
+	/* No order to check: this can't wait, so it can't deadlock */
+	lock->lk_ldwhere = __builtin_return_address(0);
+#endif
+
+#if OPT_LOCKSTAT
+	lock->lk_stamp = lockstat_now();
+	lockstat_acquired(lock->lk_stat, false, lock->lk_stamp,
+			  lock->lk_stamp);
+#endif
+	return true;
 }
 
 void
 lock_release(struct lock *lock)
 {
-	KASSERT(lock->owner == curthread);
-	spinlock_acquire(lock->spin);
-	lock->held = false;
-	lock->owner = NULL;
-	wchan_wakeone(lock->wc);
-	spinlock_release(lock->spin);
-        //(void)lock;  // suppress warning until code gets written
-	
+	struct lock **lp;
+
+	KASSERT(lock != NULL);
+	KASSERT(lock->lk_owner == curthread);
+
+	/* Usually it's the most recently acquired one. */
+	for (lp = &curthread->t_heldlocks; *lp != lock;
+	     lp = &(*lp)->lk_nextheld) {
+		KASSERT(*lp != NULL);
+	}
+	*lp = lock->lk_nextheld;
+	lock->lk_nextheld = NULL;
+
+#if OPT_LOCKSTAT
+	lockstat_released(lock->lk_stat, lock->lk_stamp);
+	lock->lk_stamp = 0;
+#endif
+
+	spinlock_acquire(&lock->lk_lock);
+	if (lock->lk_npiwaiters > 0 ||
+	    curthread->t_inheritpri < SCHED_NLEVELS) {
+		/*
+		 * Give back whatever we were lent for this lock. (If
+		 * we're inheriting through some other lock instead,
+		 * it's still held and recomputing keeps that.)
+		 */
+		spinlock_acquire(&lock_pilock);
+		lock->lk_owner = NULL;
+		lock_pi_recompute();
+		spinlock_release(&lock_pilock);
+	}
+	else {
+		lock->lk_owner = NULL;
+	}
+	wchan_wakeone(lock->lk_wchan);
+	spinlock_release(&lock->lk_lock);
 }
 
 bool
 lock_do_i_hold(struct lock *lock)
 {
-        // Write this
+	KASSERT(lock != NULL);
+
+	/* curthread can't change under us, so no need for the spinlock */
+	return lock->lk_owner == curthread;
+}
+
+void
+lock_printstats(struct lock *lock)
+{
+	unsigned spinhits, sleeps;
 
-        (void)lock;  // suppress warning until code gets written
+	spinlock_acquire(&lock->lk_lock);
+	spinhits = lock->lk_spinhits;
+	sleeps = lock->lk_sleeps;
+	spinlock_release(&lock->lk_lock);
 
-        return true; // dummy until code gets written
+	kprintf("lock %s: %u acquired by spinning, %u slept\n",
+		lock->lk_name, spinhits, sleeps);
 }
 
 ////////////////////////////////////////////////////////////
@@ -236,9 +648,17 @@ cv_create(const char *name)
                 kfree(cv);
                 return NULL;
         }
-        
-        // add stuff here as needed
-        
+
+	cv->cv_wchan = wchan_create(cv->cv_name);
+	if (cv->cv_wchan == NULL) {
+		kfree(cv->cv_name);
+		kfree(cv);
+		return NULL;
+	}
+#if OPT_LOCKDEP
+	cv->cv_ldclass = lockdep_class(cv->cv_name, true);
+#endif
+
         return cv;
 }
 
@@ -247,8 +667,8 @@ cv_destroy(struct cv *cv)
 {
         KASSERT(cv != NULL);
 
-        // add stuff here as needed
-        
+	/* wchan_cleanup will assert if anyone's waiting on it */
+	wchan_destroy(cv->cv_wchan);
         kfree(cv->cv_name);
         kfree(cv);
 }
@@ -256,23 +676,259 @@ cv_destroy(struct cv *cv)
 void
 cv_wait(struct cv *cv, struct lock *lock)
 {
-        // Write this
-        (void)cv;    // suppress warning until code gets written
-        (void)lock;  // suppress warning until code gets written
+	KASSERT(cv != NULL);
+	KASSERT(lock_do_i_hold(lock));
+
+#if OPT_LOCKDEP
+	lockdep_acquire(cv->cv_ldclass, lock, __builtin_return_address(0));
+#endif
+
+	/*
+	 * Lock the wchan before letting go of the lock, so a signal
+	 * can't get in between and find nobody asleep yet.
+	 */
+	wchan_lock(cv->cv_wchan);
+	lock_release(lock);
+	wchan_sleep(cv->cv_wchan);
+
+	/* Only cv_broadcast (via lock_pi_moved) can have set this */
+	if (curthread->t_blockedon != NULL) {
+		spinlock_acquire(&lock->lk_lock);
+		lock_pi_unblock(lock);
+		spinlock_release(&lock->lk_lock);
+	}
+	lock_acquire(lock);
 }
 
 void
 cv_signal(struct cv *cv, struct lock *lock)
 {
-        // Write this
-	(void)cv;    // suppress warning until code gets written
-	(void)lock;  // suppress warning until code gets written
+	KASSERT(cv != NULL);
+	KASSERT(lock_do_i_hold(lock));
+
+#if OPT_LOCKDEP
+	lockdep_signal(cv->cv_ldclass, lock, __builtin_return_address(0));
+#endif
+	wchan_wakeone(cv->cv_wchan);
 }
 
 void
 cv_broadcast(struct cv *cv, struct lock *lock)
 {
-	// Write this
-	(void)cv;    // suppress warning until code gets written
-	(void)lock;  // suppress warning until code gets written
+	KASSERT(cv != NULL);
+	KASSERT(lock_do_i_hold(lock));
+
+#if OPT_LOCKDEP
+	lockdep_signal(cv->cv_ldclass, lock, __builtin_return_address(0));
+#endif
+
+	/*
+	 * Wait morphing: we hold the lock, so our lock_release will
+	 * wake one of them, and each one's release the next. They're
+	 * now waiting for the lock, so we (and whoever holds it after
+	 * us) must inherit from them, as if they had slept in
+	 * lock_acquire.
+	 */
+	spinlock_acquire(&lock->lk_lock);
+	wchan_moveall(cv->cv_wchan, lock->lk_wchan, lock_pi_moved, lock);
+	spinlock_release(&lock->lk_lock);
+}
+
+////////////////////////////////////////////////////////////
+//
+// Reader-writer lock.
+
+struct rwlock *
+rwlock_create(const char *name)
+{
+	struct rwlock *rw;
+
+	rw = kmalloc(sizeof(struct rwlock));
+	if (rw == NULL) {
+		return NULL;
+	}
+
+	rw->rw_name = kstrdup(name);
+	if (rw->rw_name == NULL) {
+		kfree(rw);
+		return NULL;
+	}
+
+	rw->rw_readwchan = wchan_create(rw->rw_name);
+	if (rw->rw_readwchan == NULL) {
+		kfree(rw->rw_name);
+		kfree(rw);
+		return NULL;
+	}
+
+	rw->rw_writewchan = wchan_create(rw->rw_name);
+	if (rw->rw_writewchan == NULL) {
+		wchan_destroy(rw->rw_readwchan);
+		kfree(rw->rw_name);
+		kfree(rw);
+		return NULL;
+	}
+
+	spinlock_init(&rw->rw_lock);
+	rw->rw_readers = 0;
+	rw->rw_waitingwriters = 0;
+	rw->rw_writer = NULL;
+	rw->rw_upgrader = NULL;
+
+	return rw;
+}
+
+void
+rwlock_destroy(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+	KASSERT(rw->rw_readers == 0);
+	KASSERT(rw->rw_waitingwriters == 0);
+	KASSERT(rw->rw_writer == NULL);
+	KASSERT(rw->rw_upgrader == NULL);
+
+	spinlock_cleanup(&rw->rw_lock);
+	wchan_destroy(rw->rw_writewchan);
+	wchan_destroy(rw->rw_readwchan);
+	kfree(rw->rw_name);
+	kfree(rw);
+}
+
+/*
+ * Sleep on WC, bridging from the rwlock's spinlock to the wchan lock
+ * the same way P() does.
+ */
+static
+void
+rwlock_sleep(struct rwlock *rw, struct wchan *wc)
+{
+	wchan_lock(wc);
+	spinlock_release(&rw->rw_lock);
+	wchan_sleep(wc);
+	spinlock_acquire(&rw->rw_lock);
+}
+
+void
+rwlock_acquire_read(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	spinlock_acquire(&rw->rw_lock);
+	KASSERT(rw->rw_writer != curthread);
+	/* Writer preference: also wait if a writer is merely waiting. */
+	while (rw->rw_writer != NULL || rw->rw_waitingwriters > 0 ||
+	       rw->rw_upgrader != NULL) {
+		rwlock_sleep(rw, rw->rw_readwchan);
+	}
+	rw->rw_readers++;
+	spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_release_read(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+
+	spinlock_acquire(&rw->rw_lock);
+	KASSERT(rw->rw_readers > 0);
+	rw->rw_readers--;
+	if (rw->rw_readers == 0) {
+		if (rw->rw_upgrader != NULL) {
+			/*
+			 * The upgrader shares the writers' wchan; wake
+			 * everyone to be sure it hears. Any writers will
+			 * see rw_upgrader and go back to sleep.
+			 */
+			wchan_wakeall(rw->rw_writewchan);
+		}
+		else if (rw->rw_waitingwriters > 0) {
+			wchan_wakeone(rw->rw_writewchan);
+		}
+	}
+	spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_acquire_write(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	spinlock_acquire(&rw->rw_lock);
+	if (rw->rw_writer == curthread) {
+		panic("Deadlock on rwlock %s\n", rw->rw_name);
+	}
+	rw->rw_waitingwriters++;
+	while (rw->rw_writer != NULL || rw->rw_readers > 0 ||
+	       rw->rw_upgrader != NULL) {
+		rwlock_sleep(rw, rw->rw_writewchan);
+	}
+	rw->rw_waitingwriters--;
+	rw->rw_writer = curthread;
+	spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_release_write(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+
+	spinlock_acquire(&rw->rw_lock);
+	KASSERT(rw->rw_writer == curthread);
+	rw->rw_writer = NULL;
+	if (rw->rw_waitingwriters > 0) {
+		wchan_wakeone(rw->rw_writewchan);
+	}
+	else {
+		wchan_wakeall(rw->rw_readwchan);
+	}
+	spinlock_release(&rw->rw_lock);
+}
+
+bool
+rwlock_upgrade(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	spinlock_acquire(&rw->rw_lock);
+	KASSERT(rw->rw_readers > 0);
+	KASSERT(rw->rw_writer == NULL);
+	if (rw->rw_upgrader != NULL) {
+		/* Two upgraders would each wait for the other forever. */
+		spinlock_release(&rw->rw_lock);
+		return false;
+	}
+
+	/*
+	 * Stop counting ourselves as a reader, and wait for the rest
+	 * to drain. rw_upgrader keeps new readers and writers out
+	 * meanwhile.
+	 */
+	rw->rw_upgrader = curthread;
+	rw->rw_readers--;
+	while (rw->rw_readers > 0) {
+		rwlock_sleep(rw, rw->rw_writewchan);
+	}
+	rw->rw_upgrader = NULL;
+	rw->rw_writer = curthread;
+	spinlock_release(&rw->rw_lock);
+	return true;
+}
+
+void
+rwlock_downgrade(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+
+	spinlock_acquire(&rw->rw_lock);
+	KASSERT(rw->rw_writer == curthread);
+	rw->rw_writer = NULL;
+	rw->rw_readers++;
+	if (rw->rw_waitingwriters == 0) {
+		/* Let any other waiting readers in with us. */
+		wchan_wakeall(rw->rw_readwchan);
+	}
+	spinlock_release(&rw->rw_lock);
 }
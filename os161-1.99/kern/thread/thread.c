@@ -40,6 +40,7 @@
 #include <cpu.h>
 #include <spl.h>
 #include <spinlock.h>
+#include <clock.h>
 #include <wchan.h>
 #include <thread.h>
 #include <threadlist.h>
@@ -57,6 +58,24 @@
 /* Magic number used as a guard value on kernel thread stacks. */
 #define THREAD_STACK_MAGIC 0xbaadf00d
 
+/*
+ * Scheduler (multi-level feedback queue) parameters.
+ *
+ * Threads start at level 0, the highest priority. A thread that runs
+ * for its level's whole quantum without blocking is demoted one
+ * level; lower levels get longer quanta. Blocking gives the thread a
+ * whole quantum again, so threads that mostly wait stay at the top.
+ * Every SCHED_BOOST_HARDCLOCKS everything is moved back to level 0 so
+ * nothing starves.
+ * (SCHED_NLEVELS is in thread.h.)
+ *
+ * Queue order and preemption go by thread_precedes: real-time threads
+ * with budget left first, by deadline, then everyone else by
+ * thread_effpri, which also counts priority inherited through locks.
+ */
+#define SCHED_QUANTUM(level)	(1U << (level))	/* in hardclocks */
+#define SCHED_BOOST_HARDCLOCKS	100
+
 /* Wait channel. */
 struct wchan {
 	const char *wc_name;		/* name for this channel */
@@ -112,27 +131,43 @@ thread_checkstack(struct thread *thread)
 }
 
 /*
- * Create a thread. This is used both to create a first thread
- * for each CPU and to create subsequent forked threads.
+ * Set a thread's name. Short names go in t_namebuf, so that reusing a
+ * cached thread usually doesn't need to allocate anything.
  */
 static
-struct thread *
-thread_create(const char *name)
+int
+thread_setname(struct thread *thread, const char *name)
 {
-	struct thread *thread;
-
-	DEBUGASSERT(name != NULL);
-
-	thread = kmalloc(sizeof(*thread));
-	if (thread == NULL) {
-		return NULL;
+	if (strlen(name) < THREAD_NAMELEN) {
+		strcpy(thread->t_namebuf, name);
+		thread->t_name = thread->t_namebuf;
+		return 0;
 	}
-
 	thread->t_name = kstrdup(name);
 	if (thread->t_name == NULL) {
-		kfree(thread);
-		return NULL;
+		return ENOMEM;
+	}
+	return 0;
+}
+
+static
+void
+thread_freename(struct thread *thread)
+{
+	if (thread->t_name != thread->t_namebuf) {
+		kfree(thread->t_name);
 	}
+	thread->t_name = NULL;
+}
+
+/*
+ * Set up the fields of a new (or recycled) thread. Everything but the
+ * name and the stack.
+ */
+static
+void
+thread_initfields(struct thread *thread)
+{
 	thread->t_wchan_name = "NEW";
 	thread->t_state = S_READY;
 
@@ -148,12 +183,143 @@ thread_create(const char *name)
 	thread->t_in_interrupt = false;
 	thread->t_curspl = IPL_HIGH;
 	thread->t_iplhigh_count = 1; /* corresponding to t_curspl */
+	thread->t_rcunest = 0;
+#if OPT_SPLWATCH
+	thread->t_splwreport = false;
+#endif
+
+	/* Scheduler fields */
+	thread->t_priority = 0;
+	thread->t_quantum = SCHED_QUANTUM(0);
+	thread->t_runticks = 0;
+	thread->t_waitticks = 0;
+	thread->t_inheritpri = SCHED_NLEVELS;
+	thread->t_blockedon = NULL;
+	thread->t_waitpri = SCHED_NLEVELS;
+	thread->t_heldlocks = NULL;
+	thread->t_bound = false;
+	thread->t_lastcpu = NULL;
+	thread->t_lastran = 0;
+	thread->t_lastmoved = 0;
+	thread->t_rt = false;
+	thread->t_rtthrottled = false;
+	thread->t_rtruntime = 0;
+	thread->t_rtperiod = 0;
+	thread->t_rtutil = 0;
+	thread->t_rtdeadline = 0;
+	thread->t_rtbudget = 0;
+	thread->t_rtstart = 0;
 
 	/* If you add to struct thread, be sure to initialize here */
+}
+
+/*
+ * Create a thread. This is used both to create a first thread
+ * for each CPU and to create subsequent forked threads.
+ */
+static
+struct thread *
+thread_create(const char *name)
+{
+	struct thread *thread;
+
+	DEBUGASSERT(name != NULL);
+
+	thread = kmalloc(sizeof(*thread));
+	if (thread == NULL) {
+		return NULL;
+	}
+
+	if (thread_setname(thread, name)) {
+		kfree(thread);
+		return NULL;
+	}
+	thread_initfields(thread);
+
+	return thread;
+}
+
+/*
+ * Per-cpu cache of dead threads, each with its stack still attached.
+ * exorcise() puts zombies here instead of freeing them, and
+ * thread_fork takes them back out, so fork/exit churn doesn't go
+ * through kmalloc. The cache is only touched by its own cpu, at
+ * splhigh.
+ */
+#define THREAD_CACHE_MAX 16	/* Most threads kept per cpu */
+
+/*
+ * Get a thread with a stack from this cpu's cache, or make a new one.
+ */
+static
+struct thread *
+thread_cache_get(const char *name)
+{
+	struct thread *thread;
+	void *stack;
+	int spl;
+
+	spl = splhigh();
+	thread = threadlist_remhead(&curcpu->c_threadcache);
+	if (thread != NULL) {
+		curcpu->c_tcachehits++;
+	}
+	else {
+		curcpu->c_tcachemisses++;
+	}
+	splx(spl);
 
+	if (thread == NULL) {
+		thread = thread_create(name);
+		if (thread == NULL) {
+			return NULL;
+		}
+		thread->t_stack = kmalloc(STACK_SIZE);
+		if (thread->t_stack == NULL) {
+			thread_freename(thread);
+			kfree(thread);
+			return NULL;
+		}
+	}
+	else {
+		if (thread_setname(thread, name)) {
+			kfree(thread->t_stack);
+			kfree(thread);
+			return NULL;
+		}
+		stack = thread->t_stack;
+		thread_initfields(thread);
+		thread->t_stack = stack;
+	}
+	thread_checkstack_init(thread);
 	return thread;
 }
 
+/*
+ * Put a dead thread in this cpu's cache if there's room. Returns
+ * false if the caller should destroy it instead.
+ */
+static
+bool
+thread_cache_put(struct thread *thread)
+{
+	KASSERT(curthread->t_curspl > 0);
+	KASSERT(thread->t_proc == NULL);
+
+	if (thread->t_stack == NULL ||
+	    curcpu->c_threadcache.tl_count >= THREAD_CACHE_MAX) {
+		return false;
+	}
+
+	/* Catch overflows now; the canaries are reset on reuse */
+	thread_checkstack(thread);
+	thread_machdep_cleanup(&thread->t_machdep);
+	thread_freename(thread);
+	thread->t_wchan_name = "CACHED";
+	threadlist_addhead(&curcpu->c_threadcache, thread);
+	return true;
+}
+
 /*
  * Create a CPU structure. This is used for the bootup CPU and
  * also for secondary CPUs.
@@ -168,6 +334,7 @@ cpu_create(unsigned hardware_number)
 	struct cpu *c;
 	int result;
 	char namebuf[16];
+	unsigned i;
 
 	c = kmalloc(sizeof(*c));
 	if (c == NULL) {
@@ -176,12 +343,53 @@ cpu_create(unsigned hardware_number)
 	
 	c->c_self = c;
 	c->c_hardware_number = hardware_number;
+	c->c_timerwheel = timerwheel_create();
+	if (c->c_timerwheel == NULL) {
+		panic("cpu_create: Out of memory\n");
+	}
+	c->c_workqueue = NULL;
 
 	c->c_curthread = NULL;
 	threadlist_init(&c->c_zombies);
+	threadlist_init(&c->c_threadcache);
+	c->c_tcachehits = 0;
+	c->c_tcachemisses = 0;
+	c->c_rtmisses = 0;
+	c->c_rtthrottles = 0;
+	c->c_rcuqs = 0;
 	c->c_hardclocks = 0;
+	c->c_idleclocks = 0;
+	c->c_steals = 0;
+	c->c_demotions = 0;
+	c->c_boosts = 0;
+	c->c_migrations = 0;
+	c->c_volswitches = 0;
+	c->c_involswitches = 0;
+	for (i=0; i<CPU_NIRQSLOTS; i++) {
+		c->c_irqs[i] = 0;
+	}
+	c->c_timerirqs = 0;
+	for (i=0; i<CPU_NIPITYPES; i++) {
+		c->c_ipis[i] = 0;
+	}
+	c->c_idlens = 0;
+	c->c_statstart = 0;
+	c->c_statclocks = 0;
+#if OPT_SPLSTAT
+	c->c_splhighns = 0;
+	c->c_splhighstart = 0;
+#endif
+#if OPT_SPLWATCH
+	c->c_splwstart = 0;
+	c->c_splwsite = NULL;
+	c->c_splwpendkind = 0;
+	c->c_splwpendsite = NULL;
+	c->c_splwpendns = 0;
+#endif
 
 	c->c_isidle = false;
+	c->c_needresched = false;
+	c->c_rtutil = 0;
 	threadlist_init(&c->c_runqueue);
 	spinlock_init(&c->c_runqueue_lock);
 
@@ -258,7 +466,7 @@ thread_destroy(struct thread *thread)
 	/* sheer paranoia */
 	thread->t_wchan_name = "DESTROYED";
 
-	kfree(thread->t_name);
+	thread_freename(thread);
 	kfree(thread);
 }
 
@@ -277,7 +485,9 @@ exorcise(void)
 	while ((z = threadlist_remhead(&curcpu->c_zombies)) != NULL) {
 		KASSERT(z != curthread);
 		KASSERT(z->t_state == S_ZOMBIE);
-		thread_destroy(z);
+		if (!thread_cache_put(z)) {
+			thread_destroy(z);
+		}
 	}
 }
 
@@ -398,6 +608,7 @@ cpu_hatch(unsigned software_number)
 	KASSERT(curthread != NULL);
 	KASSERT(curcpu->c_number == software_number);
 
+	clock_start();
 	spl0();
 
 	kprintf("cpu%u: %s\n", software_number, cpu_identify());
@@ -406,6 +617,21 @@ cpu_hatch(unsigned software_number)
 	thread_exit();
 }
 
+/*
+ * Access to the cpu list.
+ */
+unsigned
+cpu_count(void)
+{
+	return cpuarray_num(&allcpus);
+}
+
+struct cpu *
+cpu_bynumber(unsigned n)
+{
+	return cpuarray_get(&allcpus, n);
+}
+
 /*
  * Start up secondary cpus. Called from boot().
  */
@@ -426,6 +652,93 @@ thread_start_cpus(void)
 	cpu_startup_sem = NULL;
 }
 
+/*
+ * Check if thread A should run before thread B: real-time threads
+ * that still have budget go first, earliest deadline first, and then
+ * the rest by level.
+ */
+static
+bool
+thread_precedes(struct thread *a, struct thread *b)
+{
+	bool art, brt;
+
+	art = a->t_rt && !a->t_rtthrottled;
+	brt = b->t_rt && !b->t_rtthrottled;
+	if (art != brt) {
+		return art;
+	}
+	if (art) {
+		return a->t_rtdeadline < b->t_rtdeadline;
+	}
+	return thread_effpri(a) < thread_effpri(b);
+}
+
+/*
+ * Put a thread on a cpu's run queue, which must be locked.
+ *
+ * The run queue is kept sorted by thread_precedes, FIFO among equals,
+ * so the head of the list is always the next thread to run. Most
+ * threads land at or near the tail, so search from there.
+ */
+static
+void
+thread_runqueue_add(struct cpu *c, struct thread *t)
+{
+	struct threadlistnode *tln;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	for (tln = c->c_runqueue.tl_tail.tln_prev;
+	     tln->tln_prev != NULL;
+	     tln = tln->tln_prev) {
+		if (!thread_precedes(t, tln->tln_self)) {
+			threadlist_insertafter(&c->c_runqueue,
+					       tln->tln_self, t);
+			return;
+		}
+	}
+	threadlist_addhead(&c->c_runqueue, t);
+}
+
+/*
+ * C's run queue has just grown. If C has more runnable threads than
+ * it can run, wake up some idle cpu so it comes and steals one (see
+ * thread_steal); idle cpus are tickless and otherwise might not look
+ * for up to a second. The peek at the other cpus' c_isidle is
+ * unlocked; the worst a stale one costs is a needless IPI, or a
+ * steal that waits for that cpu's next wakeup as before.
+ *
+ * Must hold C's run queue lock.
+ */
+static
+void
+thread_kick_idle(struct cpu *c)
+{
+	unsigned i, numcpus, waiting;
+	struct cpu *other;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	waiting = c->c_runqueue.tl_count;
+	if (c->c_isidle) {
+		/* It'll run one itself */
+		waiting--;
+	}
+	if (waiting == 0) {
+		return;
+	}
+
+	numcpus = cpuarray_num(&allcpus);
+	for (i=1; i<numcpus; i++) {
+		other = cpuarray_get(&allcpus, (c->c_number + i) % numcpus);
+		if (other->c_isidle) {
+			ipi_send(other, IPI_UNIDLE);
+			return;
+		}
+	}
+}
+
 /*
  * Make a thread runnable.
  *
@@ -450,7 +763,12 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 	}
 
 	isidle = targetcpu->c_isidle;
-	threadlist_addtail(&targetcpu->c_runqueue, target);
+	thread_runqueue_add(targetcpu, target);
+	if (!isidle && target != targetcpu->c_curthread &&
+	    thread_precedes(target, targetcpu->c_curthread)) {
+		/* Preempt at the next hardclock on that cpu. */
+		targetcpu->c_needresched = true;
+	}
 	if (isidle) {
 		/*
 		 * Other processor is idle; send interrupt to make
@@ -458,12 +776,130 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 		 */
 		ipi_send(targetcpu, IPI_UNIDLE);
 	}
+	thread_kick_idle(targetcpu);
 
 	if (!already_have_lock) {
 		spinlock_release(&targetcpu->c_runqueue_lock);
 	}
 }
 
+/*
+ * Make a whole list of threads runnable, as for wchan_wakeall.
+ *
+ * Rather than going through thread_make_runnable one thread at a
+ * time, group the threads by cpu: each pass takes the cpu of the
+ * first thread left on the list, locks its run queue once, moves
+ * every thread on the list that belongs there, and sends at most one
+ * IPI. The threads are asleep, so their t_cpu can't change under us.
+ */
+static
+void
+thread_make_runnable_list(struct threadlist *list)
+{
+	struct cpu *targetcpu;
+	struct thread *target, *best;
+	struct threadlistnode *tln, *next;
+	bool isidle;
+
+	while (!threadlist_isempty(list)) {
+		targetcpu = list->tl_head.tln_next->tln_self->t_cpu;
+		best = NULL;
+
+		spinlock_acquire(&targetcpu->c_runqueue_lock);
+		for (tln = list->tl_head.tln_next; tln->tln_next != NULL;
+		     tln = next) {
+			next = tln->tln_next;
+			target = tln->tln_self;
+			if (target->t_cpu != targetcpu) {
+				continue;
+			}
+			threadlist_remove(list, target);
+			thread_runqueue_add(targetcpu, target);
+			if (best == NULL || thread_precedes(target, best)) {
+				best = target;
+			}
+		}
+		KASSERT(best != NULL);
+
+		isidle = targetcpu->c_isidle;
+		if (!isidle && best != targetcpu->c_curthread &&
+		    thread_precedes(best, targetcpu->c_curthread)) {
+			/* Preempt at the next hardclock on that cpu. */
+			targetcpu->c_needresched = true;
+		}
+		if (isidle) {
+			ipi_send(targetcpu, IPI_UNIDLE);
+		}
+		thread_kick_idle(targetcpu);
+		spinlock_release(&targetcpu->c_runqueue_lock);
+	}
+}
+
+/*
+ * Work stealing.
+ *
+ * Called from the idle loop in thread_switch when our own run queue
+ * is empty. Look around the other cpus for one with threads waiting
+ * to run and take one, so it doesn't sit there runnable while we're
+ * idle. Returns true if we put a thread on our run queue.
+ *
+ * We take from the tail of the victim's queue, the opposite end from
+ * where its own cpu takes work, to stay out of its way as much as we
+ * can. Our own run queue lock must *not* be held; holding both locks
+ * at once would deadlock against another cpu stealing from us.
+ */
+static
+bool
+thread_steal(void)
+{
+	unsigned i, numcpus;
+	struct cpu *c;
+	struct thread *t;
+
+	KASSERT(!spinlock_do_i_hold(&curcpu->c_runqueue_lock));
+
+	numcpus = cpuarray_num(&allcpus);
+	for (i=1; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, (curcpu->c_number + i) % numcpus);
+
+		/* Unlocked peek, to avoid bothering cpus with no work. */
+		if (c->c_runqueue.tl_count == 0) {
+			continue;
+		}
+
+		spinlock_acquire(&c->c_runqueue_lock);
+		t = threadlist_remtail(&c->c_runqueue);
+		if (t != NULL &&
+		    (t == c->c_curthread || t->t_bound || t->t_rt)) {
+			/*
+			 * It's that cpu's own curthread, reawakened
+			 * before the cpu finished unidling, or it's
+			 * bound to that cpu, or real-time. It can't
+			 * be moved (see thread_consider_migration);
+			 * put it back.
+			 */
+			thread_runqueue_add(c, t);
+			t = NULL;
+		}
+		if (t != NULL) {
+			t->t_cpu = curcpu->c_self;
+			t->t_lastmoved = curcpu->c_hardclocks;
+		}
+		spinlock_release(&c->c_runqueue_lock);
+
+		if (t != NULL) {
+			DEBUG(DB_THREADS, "Stole thread %s: cpu %u -> %u\n",
+			      t->t_name, c->c_number, curcpu->c_number);
+			curcpu->c_steals++;
+			spinlock_acquire(&curcpu->c_runqueue_lock);
+			thread_runqueue_add(curcpu->c_self, t);
+			spinlock_release(&curcpu->c_runqueue_lock);
+			return true;
+		}
+	}
+	return false;
+}
+
 /*
  * Create a new thread based on an existing one.
  *
@@ -471,14 +907,17 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
  * ENTRYPOINT. DATA1 and DATA2 are passed to ENTRYPOINT.
  *
  * The new thread is created in the process P. If P is null, the
- * process is inherited from the caller. It will start on the same CPU
- * as the caller, unless the scheduler intervenes first.
+ * process is inherited from the caller. It starts on cpu C; if BOUND
+ * it stays there, and otherwise the scheduler may move it.
+ *
+ * thread_fork starts it on the same CPU as the caller.
  */
+static
 int
-thread_fork(const char *name,
-	    struct proc *proc,
-	    void (*entrypoint)(void *data1, unsigned long data2),
-	    void *data1, unsigned long data2)
+thread_fork_common(const char *name,
+		   struct proc *proc, struct cpu *c, bool bound,
+		   void (*entrypoint)(void *data1, unsigned long data2),
+		   void *data1, unsigned long data2)
 {
 	struct thread *newthread;
 	int result;
@@ -487,25 +926,19 @@ thread_fork(const char *name,
 	DEBUG(DB_THREADS,"Forking thread: %s\n",name);
 #endif // UW
 
-	newthread = thread_create(name);
+	/* Get a thread and a stack, from the cache if possible */
+	newthread = thread_cache_get(name);
 	if (newthread == NULL) {
 		return ENOMEM;
 	}
 
-	/* Allocate a stack */
-	newthread->t_stack = kmalloc(STACK_SIZE);
-	if (newthread->t_stack == NULL) {
-		thread_destroy(newthread);
-		return ENOMEM;
-	}
-	thread_checkstack_init(newthread);
-
 	/*
 	 * Now we clone various fields from the parent thread.
 	 */
 
 	/* Thread subsystem fields */
-	newthread->t_cpu = curthread->t_cpu;
+	newthread->t_cpu = c;
+	newthread->t_bound = bound;
 
 	/* Attach the new thread to its process */
 	if (proc == NULL) {
@@ -528,12 +961,57 @@ thread_fork(const char *name,
 	/* Set up the switchframe so entrypoint() gets called */
 	switchframe_init(newthread, entrypoint, data1, data2);
 
-	/* Lock the current cpu's run queue and make the new thread runnable */
+	/* Lock the target cpu's run queue and make the new thread runnable */
 	thread_make_runnable(newthread, false);
 
 	return 0;
 }
 
+int
+thread_fork(const char *name,
+	    struct proc *proc,
+	    void (*entrypoint)(void *data1, unsigned long data2),
+	    void *data1, unsigned long data2)
+{
+	return thread_fork_common(name, proc, curthread->t_cpu, false,
+				  entrypoint, data1, data2);
+}
+
+int
+thread_fork_oncpu(const char *name, struct cpu *c,
+		  void (*entrypoint)(void *data1, unsigned long data2),
+		  void *data1, unsigned long data2)
+{
+	return thread_fork_common(name, NULL, c, true,
+				  entrypoint, data1, data2);
+}
+
+/*
+ * Charge real-time thread T, which is running on this cpu, for the
+ * time since it was last charged, and throttle it if that uses up its
+ * budget. Called from thread_switch and schedule.
+ */
+static
+void
+thread_rt_charge(struct thread *t)
+{
+	uint64_t now, used;
+
+	KASSERT(spinlock_do_i_hold(&curcpu->c_runqueue_lock));
+	KASSERT(t->t_rt && !t->t_rtthrottled);
+
+	now = clock_getns();
+	used = now - t->t_rtstart;
+	t->t_rtstart = now;
+	if (used < t->t_rtbudget) {
+		t->t_rtbudget -= used;
+		return;
+	}
+	t->t_rtbudget = 0;
+	t->t_rtthrottled = true;
+	curcpu->c_rtthrottles++;
+}
+
 /*
  * High level, machine-independent context switch code.
  *
@@ -570,9 +1048,21 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	/* Check the stack guard band. */
 	thread_checkstack(cur);
 
+	/* RCU readers mustn't sleep or yield; see rcu.h */
+	KASSERT(cur->t_rcunest == 0);
+	curcpu->c_rcuqs++;
+
 	/* Lock the run queue. */
 	spinlock_acquire(&curcpu->c_runqueue_lock);
 
+	/* We're about to pick a thread; any pending preemption is done. */
+	curcpu->c_needresched = false;
+
+	/* Charge a real-time thread before it goes back on a queue */
+	if (cur->t_rt && !cur->t_rtthrottled) {
+		thread_rt_charge(cur);
+	}
+
 	/* Micro-optimization: if nothing to do, just return */
 	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue)) {
 		spinlock_release(&curcpu->c_runqueue_lock);
@@ -604,6 +1094,8 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 		 */
 		threadlist_addtail(&wc->wc_threads, cur);
 		wchan_unlock(wc);
+		/* Blocking starts a fresh quantum; see SCHED_QUANTUM */
+		cur->t_quantum = SCHED_QUANTUM(cur->t_priority);
 		break;
 	    case S_ZOMBIE:
 		cur->t_wchan_name = "ZOMBIE";
@@ -613,7 +1105,8 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	cur->t_state = newstate;
 
 	/*
-	 * Get the next thread. While there isn't one, call md_idle().
+	 * Get the next thread. While there isn't one, try to steal
+	 * one from another cpu, and failing that call md_idle().
 	 * curcpu->c_isidle must be true when md_idle is
 	 * called. Unlock the runqueue while idling too, to make sure
 	 * things can be added to it.
@@ -627,6 +1120,10 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	 * Note that c_isidle becomes true briefly even if we don't go
 	 * idle. However, because one is supposed to hold the runqueue
 	 * lock to look at it, this should not be visible or matter.
+	 *
+	 * The periodic timer tick is turned off while we're idle
+	 * (clock_idle) and back on once we have a thread to run
+	 * (clock_unidle). Pending timeouts still wake us up.
 	 */
 
 	/* The current cpu is now idle. */
@@ -635,11 +1132,38 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 		next = threadlist_remhead(&curcpu->c_runqueue);
 		if (next == NULL) {
 			spinlock_release(&curcpu->c_runqueue_lock);
-			cpu_idle();
+			if (!thread_steal()) {
+				clock_idle();
+				cpu_idle();
+			}
 			spinlock_acquire(&curcpu->c_runqueue_lock);
 		}
 	} while (next == NULL);
 	curcpu->c_isidle = false;
+	clock_unidle();
+
+	if (next->t_rt && !next->t_rtthrottled) {
+		next->t_rtstart = clock_getns();
+	}
+
+	if (next != cur) {
+		cur->t_lastcpu = curcpu->c_self;
+		cur->t_lastran = curcpu->c_hardclocks;
+
+		/* Preemption comes from hardclock, in the interrupt */
+		if (newstate == S_READY && cur->t_in_interrupt) {
+			curcpu->c_involswitches++;
+		}
+		else {
+			curcpu->c_volswitches++;
+		}
+	}
+#if OPT_SPLSTAT
+	splstat_switch(next);
+#endif
+#if OPT_SPLWATCH
+	splwatch_switch(next);
+#endif
 
 	/*
 	 * Note that curcpu->c_curthread may be the same variable as
@@ -799,6 +1323,15 @@ thread_exit(void)
 	/* Make sure we *are* detached (move this only if you're sure!) */
 	KASSERT(cur->t_proc == NULL);
 
+	DEBUG(DB_THREADS, "Thread %s exiting: ran %u ticks, waited %u ticks, "
+	      "level %d\n", cur->t_name, cur->t_runticks, cur->t_waitticks,
+	      cur->t_priority);
+
+	/* Give back any real-time commitment. */
+	if (cur->t_rt) {
+		thread_rt_clear();
+	}
+
 	/* Check the stack guard band. */
 	thread_checkstack(cur);
 
@@ -817,22 +1350,307 @@ thread_yield(void)
 	thread_switch(S_READY, NULL);
 }
 
+/*
+ * Timeout callback for thread_sleep_until.
+ */
+static
+void
+thread_sleep_wakeup(void *vwc)
+{
+	wchan_wakeall(vwc);
+}
+
+/*
+ * Sleep until clock_getns() reaches DEADLINE. We sleep on a private
+ * wait channel on our own stack and put a timeout on the wheel to
+ * wake it up.
+ */
+void
+thread_sleep_until(uint64_t deadline)
+{
+	struct wchan wc;
+	struct timeout to;
+
+	KASSERT(!curthread->t_in_interrupt);
+
+	spinlock_init(&wc.wc_lock);
+	threadlist_init(&wc.wc_threads);
+	wc.wc_name = "sleep_until";
+	timeout_init(&to, thread_sleep_wakeup, &wc);
+
+	while (clock_getns() < deadline) {
+		/*
+		 * Holding the wchan lock keeps the timeout from
+		 * firing until we're on the wchan.
+		 */
+		wchan_lock(&wc);
+		timeout_add(&to, deadline);
+		wchan_sleep(&wc);
+	}
+
+	threadlist_cleanup(&wc.wc_threads);
+	spinlock_cleanup(&wc.wc_lock);
+}
+
 ////////////////////////////////////////////////////////////
 
 /*
  * Scheduler.
  *
- * This is called periodically from hardclock(). It should reshuffle
- * the current CPU's run queue by job priority.
+ * This is called from hardclock() on every tick. The run queue itself
+ * is kept in priority order by thread_runqueue_add, so all that's
+ * needed here is the per-tick bookkeeping:
+ *
+ *    - charge the tick to the current thread, or to the waiting
+ *      threads' wait time;
+ *    - demote the current thread if it used up its quantum, or if
+ *      it's real-time, charge its budget and throttle it if that
+ *      ran out;
+ *    - ask for a reschedule if it did, or if something of higher
+ *      priority is waiting;
+ *    - every SCHED_BOOST_HARDCLOCKS, put everyone back at level 0.
+ *
+ * If the cpu is idle, curthread isn't really running (it's asleep,
+ * and we're in the idle loop on its stack) so it isn't charged.
  */
-
 void
 schedule(void)
 {
+	struct thread *cur = curthread;
+	struct threadlistnode *tln;
+	struct thread *head;
+	bool boost;
+
+	boost = (curcpu->c_hardclocks % SCHED_BOOST_HARDCLOCKS) == 0;
+
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+
+	for (tln = curcpu->c_runqueue.tl_head.tln_next;
+	     tln->tln_next != NULL;
+	     tln = tln->tln_next) {
+		tln->tln_self->t_waitticks++;
+		if (boost) {
+			/* Everyone goes to 0, so the order still holds */
+			tln->tln_self->t_priority = 0;
+			tln->tln_self->t_quantum = SCHED_QUANTUM(0);
+		}
+	}
+
+	if (!curcpu->c_isidle) {
+		cur->t_runticks++;
+		if (cur->t_rt && !cur->t_rtthrottled) {
+			/* Real-time threads have a budget, not a quantum */
+			thread_rt_charge(cur);
+			if (cur->t_rtthrottled) {
+				curcpu->c_needresched = true;
+			}
+		}
+		else {
+			KASSERT(cur->t_quantum > 0);
+			cur->t_quantum--;
+		}
+		if (cur->t_quantum == 0) {
+			if (cur->t_priority < SCHED_NLEVELS - 1) {
+				cur->t_priority++;
+				curcpu->c_demotions++;
+			}
+			cur->t_quantum = SCHED_QUANTUM(cur->t_priority);
+			curcpu->c_needresched = true;
+		}
+		if (boost) {
+			cur->t_priority = 0;
+			cur->t_quantum = SCHED_QUANTUM(0);
+		}
+
+		head = threadlist_isempty(&curcpu->c_runqueue) ? NULL :
+			curcpu->c_runqueue.tl_head.tln_next->tln_self;
+		if (head != NULL && thread_precedes(head, cur)) {
+			curcpu->c_needresched = true;
+		}
+	}
+
+	if (boost) {
+		curcpu->c_boosts++;
+	}
+
+	spinlock_release(&curcpu->c_runqueue_lock);
+}
+
+/*
+ * Change the level T inherits through locks (see synch.c).
+ *
+ * If T is waiting on its cpu's run queue it has to move to keep the
+ * queue sorted, so take that lock; T might be migrated while we're
+ * getting it, so check we got the right one. The queue is short
+ * enough that finding T in it by walking is fine.
+ */
+void
+thread_setinherited(struct thread *t, int pri)
+{
+	struct cpu *c;
+	struct threadlistnode *tln;
+	struct thread *head;
+
+	KASSERT(pri >= 0 && pri <= SCHED_NLEVELS);
+
+	while (1) {
+		c = t->t_cpu;
+		spinlock_acquire(&c->c_runqueue_lock);
+		if (t->t_cpu == c) {
+			break;
+		}
+		spinlock_release(&c->c_runqueue_lock);
+	}
+
+	if (t->t_inheritpri == pri) {
+		spinlock_release(&c->c_runqueue_lock);
+		return;
+	}
+	t->t_inheritpri = pri;
+
+	if (t == c->c_curthread) {
+		/* If it just lost a boost, something else may go first */
+		head = threadlist_isempty(&c->c_runqueue) ? NULL :
+			c->c_runqueue.tl_head.tln_next->tln_self;
+		if (!c->c_isidle && head != NULL &&
+		    thread_precedes(head, t)) {
+			c->c_needresched = true;
+		}
+	}
+	else {
+		for (tln = c->c_runqueue.tl_head.tln_next;
+		     tln->tln_next != NULL;
+		     tln = tln->tln_next) {
+			if (tln->tln_self == t) {
+				threadlist_remove(&c->c_runqueue, t);
+				thread_runqueue_add(c, t);
+				if (!c->c_isidle &&
+				    thread_precedes(t, c->c_curthread)) {
+					c->c_needresched = true;
+				}
+				break;
+			}
+		}
+	}
+
+	spinlock_release(&c->c_runqueue_lock);
+}
+
+/*
+ * Real-time scheduling.
+ *
+ * This is partitioned EDF: each cpu schedules its own real-time
+ * threads earliest deadline first, and admits a new one only while
+ * the sum of runtime/period over them stays within
+ * THREAD_RT_MAXUTIL, which (for EDF on one cpu) guarantees they all
+ * make their deadlines as long as they keep to their budgets. The
+ * headroom left over keeps ordinary threads from starving entirely.
+ *
+ * Budgets are charged in ns, on each switch and each hardclock, and
+ * a thread that runs out is throttled to the ordinary class so it
+ * can't eat into the others' time. Periods are per thread, not
+ * aligned to anything; the next period starts when the current one
+ * ends, or when the thread asks for it if it's running late.
+ */
+int
+thread_rt_set(uint64_t runtime, uint64_t period)
+{
+	struct thread *cur = curthread;
+	struct cpu *c;
+	unsigned util, old;
+	int spl;
+
+	if (runtime == 0 || runtime > period) {
+		return EINVAL;
+	}
+	util = runtime * THREAD_RT_UNIT / period;
+	if (util == 0) {
+		util = 1;
+	}
+
+	/* Stay on this cpu while we look at it, as in thread_switch */
+	spl = splhigh();
+	c = curcpu;
+	spinlock_acquire(&c->c_runqueue_lock);
+	old = cur->t_rt ? cur->t_rtutil : 0;
+	if (c->c_rtutil - old + util > THREAD_RT_MAXUTIL) {
+		spinlock_release(&c->c_runqueue_lock);
+		splx(spl);
+		return EBUSY;
+	}
+	c->c_rtutil = c->c_rtutil - old + util;
+
+	cur->t_rt = true;
+	cur->t_rtthrottled = false;
+	cur->t_rtruntime = runtime;
+	cur->t_rtperiod = period;
+	cur->t_rtutil = util;
+	cur->t_rtstart = clock_getns();
+	cur->t_rtdeadline = cur->t_rtstart + period;
+	cur->t_rtbudget = runtime;
+	spinlock_release(&c->c_runqueue_lock);
+	splx(spl);
+
+	return 0;
+}
+
+bool
+thread_rt_wait(void)
+{
+	struct thread *cur = curthread;
+	struct cpu *c;
+	uint64_t now, release;
+	bool met;
+	int spl;
+
+	KASSERT(cur->t_rt);
+
 	/*
-	 * You can write this. If we do nothing, threads will run in
-	 * round-robin fashion.
+	 * Set up the next period before sleeping, so that we're
+	 * queued by its deadline when the wakeup comes.
 	 */
+	spl = splhigh();
+	c = curcpu;
+	spinlock_acquire(&c->c_runqueue_lock);
+	now = clock_getns();
+	met = now <= cur->t_rtdeadline;
+	if (met) {
+		release = cur->t_rtdeadline;
+	}
+	else {
+		/* Overran; start over from now rather than catch up */
+		release = now;
+		c->c_rtmisses++;
+	}
+	cur->t_rtthrottled = false;
+	cur->t_rtdeadline = release + cur->t_rtperiod;
+	cur->t_rtbudget = cur->t_rtruntime;
+	cur->t_rtstart = now;
+	spinlock_release(&c->c_runqueue_lock);
+	splx(spl);
+
+	thread_sleep_until(release);
+	return met;
+}
+
+void
+thread_rt_clear(void)
+{
+	struct thread *cur = curthread;
+	struct cpu *c;
+	int spl;
+
+	spl = splhigh();
+	c = curcpu;
+	spinlock_acquire(&c->c_runqueue_lock);
+	if (cur->t_rt) {
+		KASSERT(c->c_rtutil >= cur->t_rtutil);
+		c->c_rtutil -= cur->t_rtutil;
+		cur->t_rt = false;
+		cur->t_rtthrottled = false;
+	}
+	spinlock_release(&c->c_runqueue_lock);
+	splx(spl);
 }
 
 /*
@@ -848,10 +1666,66 @@ schedule(void)
  * and the performance loss due to underutilization of some CPUs is
  * something that needs to be tuned and probably is workload-specific.
  *
- * For here and now, because we know we're running on System/161 and
- * System/161 does not (yet) model such cache effects, we'll be very
- * aggressive.
+ * So there are two policies (see thread.h). MIGRATE_AGGRESSIVE is
+ * the original one, which just evens out the run queues, taking from
+ * the tail. MIGRATE_AFFINITY prefers threads that haven't run here
+ * recently and so have little left in this cpu's cache, only takes
+ * recently-run ones when some cpu has nothing to do at all, and
+ * leaves alone threads that were themselves just moved, so they
+ * don't bounce back and forth between cpus.
+ */
+int thread_migrate_policy = MIGRATE_AFFINITY;
+unsigned thread_migrate_coldticks = 2;
+unsigned thread_migrate_holdticks = 32;	/* two migration periods */
+
+/*
+ * Check if T, on our run queue, may be migrated now. WARMOK says
+ * whether to take threads whose cache footprint is still here.
  */
+static
+bool
+thread_migratable(struct thread *t, bool warmok)
+{
+	unsigned now = curcpu->c_hardclocks;
+
+	KASSERT(spinlock_do_i_hold(&curcpu->c_runqueue_lock));
+
+	/*
+	 * Ordinarily, curthread will not appear on the run queue.
+	 * However, it can under the following circumstances:
+	 *   - it went to sleep;
+	 *   - the processor became idle, so it remained curthread;
+	 *   - it was reawakened, so it was put on the run queue;
+	 *   - and the processor hasn't fully unidled yet, so all
+	 *     these things are still true.
+	 *
+	 * If the timer interrupt happens at (almost) exactly the
+	 * proper moment, we can come here while things are in this
+	 * state and see curthread. However, *migrating* curthread can
+	 * cause bad things to happen (Exercise: Why? And what?) so
+	 * never pick it.
+	 */
+	if (t == curthread || t->t_bound) {
+		return false;
+	}
+	if (t->t_rt) {
+		/* Admitted against this cpu's real-time budget */
+		return false;
+	}
+
+	if (thread_migrate_policy == MIGRATE_AGGRESSIVE) {
+		return true;
+	}
+	if (now - t->t_lastmoved < thread_migrate_holdticks) {
+		return false;
+	}
+	if (!warmok && t->t_lastcpu == curcpu->c_self &&
+	    now - t->t_lastran < thread_migrate_coldticks) {
+		return false;
+	}
+	return true;
+}
+
 void
 thread_consider_migration(void)
 {
@@ -859,9 +1733,12 @@ thread_consider_migration(void)
 	unsigned i, numcpus;
 	struct cpu *c;
 	struct threadlist victims;
+	struct threadlistnode *tln, *prev;
 	struct thread *t;
+	bool anyidle;
 
 	my_count = total_count = 0;
+	anyidle = false;
 	numcpus = cpuarray_num(&allcpus);
 	for (i=0; i<numcpus; i++) {
 		c = cpuarray_get(&allcpus, i);
@@ -870,6 +1747,9 @@ thread_consider_migration(void)
 		if (c == curcpu->c_self) {
 			my_count = c->c_runqueue.tl_count;
 		}
+		else if (c->c_isidle) {
+			anyidle = true;
+		}
 		spinlock_release(&c->c_runqueue_lock);
 	}
 
@@ -878,14 +1758,25 @@ thread_consider_migration(void)
 		return;
 	}
 
+	/*
+	 * Pick the victims, starting from the tail (the lowest
+	 * priority threads) and skipping any that aren't migratable.
+	 */
 	to_send = my_count - one_share;
 	threadlist_init(&victims);
 	spinlock_acquire(&curcpu->c_runqueue_lock);
-	for (i=0; i<to_send; i++) {
-		t = threadlist_remtail(&curcpu->c_runqueue);
-		threadlist_addhead(&victims, t);
+	for (tln = curcpu->c_runqueue.tl_tail.tln_prev;
+	     tln->tln_prev != NULL && victims.tl_count < to_send;
+	     tln = prev) {
+		prev = tln->tln_prev;
+		t = tln->tln_self;
+		if (thread_migratable(t, anyidle)) {
+			threadlist_remove(&curcpu->c_runqueue, t);
+			threadlist_addhead(&victims, t);
+		}
 	}
 	spinlock_release(&curcpu->c_runqueue_lock);
+	to_send = victims.tl_count;
 
 	for (i=0; i < numcpus && to_send > 0; i++) {
 		c = cpuarray_get(&allcpus, i);
@@ -895,39 +1786,13 @@ thread_consider_migration(void)
 		spinlock_acquire(&c->c_runqueue_lock);
 		while (c->c_runqueue.tl_count < one_share && to_send > 0) {
 			t = threadlist_remhead(&victims);
-			/*
-			 * Ordinarily, curthread will not appear on
-			 * the run queue. However, it can under the
-			 * following circumstances:
-			 *   - it went to sleep;
-			 *   - the processor became idle, so it
-			 *     remained curthread;
-			 *   - it was reawakened, so it was put on the
-			 *     run queue;
-			 *   - and the processor hasn't fully unidled
-			 *     yet, so all these things are still true.
-			 *
-			 * If the timer interrupt happens at (almost)
-			 * exactly the proper moment, we can come here
-			 * while things are in this state and see
-			 * curthread. However, *migrating* curthread
-			 * can cause bad things to happen (Exercise:
-			 * Why? And what?) so shuffle it to the end of
-			 * the list and decrement to_send in order to
-			 * skip it. Then it goes back on our own run
-			 * queue below.
-			 */
-			if (t == curthread) {
-				threadlist_addtail(&victims, t);
-				to_send--;
-				continue;
-			}
-
 			t->t_cpu = c;
-			threadlist_addtail(&c->c_runqueue, t);
+			t->t_lastmoved = c->c_hardclocks;
+			thread_runqueue_add(c, t);
 			DEBUG(DB_THREADS,
 			      "Migrated thread %s: cpu %u -> %u",
 			      t->t_name, curcpu->c_number, c->c_number);
+			curcpu->c_migrations++;
 			to_send--;
 			if (c->c_isidle) {
 				/*
@@ -948,7 +1813,7 @@ thread_consider_migration(void)
 	if (!threadlist_isempty(&victims)) {
 		spinlock_acquire(&curcpu->c_runqueue_lock);
 		while ((t = threadlist_remhead(&victims)) != NULL) {
-			threadlist_addtail(&curcpu->c_runqueue, t);
+			thread_runqueue_add(curcpu->c_self, t);
 		}
 		spinlock_release(&curcpu->c_runqueue_lock);
 	}
@@ -1078,16 +1943,61 @@ wchan_wakeall(struct wchan *wc)
 	 */
 	spinlock_release(&wc->wc_lock);
 
-	/*
-	 * We could conceivably sort by cpu first to cause fewer lock
-	 * ops and fewer IPIs, but for now at least don't bother. Just
-	 * make each thread runnable.
-	 */
-	while ((target = threadlist_remhead(&list)) != NULL) {
-		thread_make_runnable(target, false);
+	thread_make_runnable_list(&list);
+
+	threadlist_cleanup(&list);
+}
+
+/*
+ * Wake up to N threads sleeping on a wait channel.
+ */
+unsigned
+wchan_wakemany(struct wchan *wc, unsigned n)
+{
+	struct thread *target;
+	struct threadlist list;
+	unsigned count;
+
+	threadlist_init(&list);
+
+	spinlock_acquire(&wc->wc_lock);
+	for (count = 0; count < n; count++) {
+		target = threadlist_remhead(&wc->wc_threads);
+		if (target == NULL) {
+			break;
+		}
+		threadlist_addtail(&list, target);
 	}
+	spinlock_release(&wc->wc_lock);
+
+	thread_make_runnable_list(&list);
 
 	threadlist_cleanup(&list);
+	return count;
+}
+
+/*
+ * Move all threads sleeping on one wait channel to another.
+ */
+void
+wchan_moveall(struct wchan *from, struct wchan *to,
+	      void (*moved)(struct thread *, void *), void *data)
+{
+	struct thread *target;
+
+	KASSERT(from != to);
+
+	spinlock_acquire(&from->wc_lock);
+	spinlock_acquire(&to->wc_lock);
+	while ((target = threadlist_remhead(&from->wc_threads)) != NULL) {
+		target->t_wchan_name = to->wc_name;
+		threadlist_addtail(&to->wc_threads, target);
+		if (moved != NULL) {
+			moved(target, data);
+		}
+	}
+	spinlock_release(&to->wc_lock);
+	spinlock_release(&from->wc_lock);
 }
 
 /*
@@ -1106,6 +2016,182 @@ wchan_isempty(struct wchan *wc)
 	return ret;
 }
 
+/*
+ * Print per-cpu statistics.
+ *
+ * These are updated by each cpu without locking and read (and reset)
+ * here without locking, so they may be very slightly stale.
+ */
+void
+cpu_printstats(void)
+{
+	static const char *const ipinames[CPU_NIPITYPES] = {
+		"panic", "offline", "unidle", "tlbshootdown",
+	};
+	unsigned i, j;
+	struct cpu *c;
+	uint64_t now, elapsed;
+
+	now = clock_getns();
+	for (i=0; i < cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		elapsed = now - c->c_statstart;
+		if (elapsed == 0) {
+			elapsed = 1;
+		}
+
+		kprintf("cpu%u: %lu ms, %u hardclocks, idle %lu ms (%u%%), "
+			"%u ticks skipped\n", c->c_number,
+			(unsigned long)(elapsed / 1000000),
+			c->c_hardclocks - c->c_statclocks,
+			(unsigned long)(c->c_idlens / 1000000),
+			(unsigned)(100 * c->c_idlens / elapsed),
+			c->c_idleclocks);
+		kprintf("      switches: %u voluntary, %u involuntary\n",
+			c->c_volswitches, c->c_involswitches);
+		kprintf("      %u threads stolen, %u migrated away, "
+			"%u demotions, %u priority boosts\n",
+			c->c_steals, c->c_migrations, c->c_demotions,
+			c->c_boosts);
+		kprintf("      thread cache: %u hits, %u misses, %u cached\n",
+			c->c_tcachehits, c->c_tcachemisses,
+			c->c_threadcache.tl_count);
+		if (c->c_rtutil > 0 || c->c_rtmisses > 0) {
+			kprintf("      real-time: %u%% committed, "
+				"%u missed deadlines, %u throttled\n",
+				c->c_rtutil / (THREAD_RT_UNIT / 100),
+				c->c_rtmisses, c->c_rtthrottles);
+		}
+		kprintf("      interrupts: timer %u", c->c_timerirqs);
+		for (j=0; j<CPU_NIRQSLOTS; j++) {
+			if (c->c_irqs[j] != 0) {
+				kprintf(", slot %u %u", j, c->c_irqs[j]);
+			}
+		}
+		kprintf("\n");
+		kprintf("      IPIs:");
+		for (j=0; j<CPU_NIPITYPES; j++) {
+			kprintf("%s %s %u", j == 0 ? "" : ",", ipinames[j],
+				c->c_ipis[j]);
+		}
+		kprintf("\n");
+#if OPT_SPLSTAT
+		kprintf("      splhigh: %lu us (%u%%)\n",
+			(unsigned long)(c->c_splhighns / 1000),
+			(unsigned)(100 * c->c_splhighns / elapsed));
+#endif
+	}
+}
+
+/*
+ * Print the scheduler statistics of each cpu's current thread and of
+ * the threads on its run queue (for "cpustat threads"). Sleeping
+ * threads aren't on any cpu, so they aren't shown. The threads are
+ * copied out under the run queue lock and printed after, so as not to
+ * kprintf with it held; only the first THREAD_STATMAX are shown.
+ */
+#define THREAD_STATMAX	8
+
+struct threadstat {
+	char ts_name[16];
+	int ts_priority;
+	unsigned ts_quantum;
+	unsigned ts_runticks;
+	unsigned ts_waitticks;
+};
+
+static
+void
+thread_getstat(struct thread *t, struct threadstat *ts)
+{
+	snprintf(ts->ts_name, sizeof(ts->ts_name), "%s", t->t_name);
+	ts->ts_priority = t->t_priority;
+	ts->ts_quantum = t->t_quantum;
+	ts->ts_runticks = t->t_runticks;
+	ts->ts_waitticks = t->t_waitticks;
+}
+
+void
+thread_printstats(void)
+{
+	struct threadstat ts[THREAD_STATMAX];
+	struct threadlistnode *tln;
+	struct cpu *c;
+	unsigned i, j, n, total;
+
+	for (i=0; i < cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+
+		n = total = 0;
+		spinlock_acquire(&c->c_runqueue_lock);
+		if (!c->c_isidle && c->c_curthread != NULL) {
+			thread_getstat(c->c_curthread, &ts[n++]);
+			total++;
+		}
+		for (tln = c->c_runqueue.tl_head.tln_next;
+		     tln->tln_next != NULL;
+		     tln = tln->tln_next) {
+			if (n < THREAD_STATMAX) {
+				thread_getstat(tln->tln_self, &ts[n++]);
+			}
+			total++;
+		}
+		spinlock_release(&c->c_runqueue_lock);
+
+		kprintf("cpu%u: %u runnable\n", c->c_number, total);
+		for (j=0; j<n; j++) {
+			kprintf("      %-16s level %d, %u left in quantum, "
+				"ran %u, waited %u\n", ts[j].ts_name,
+				ts[j].ts_priority, ts[j].ts_quantum,
+				ts[j].ts_runticks, ts[j].ts_waitticks);
+		}
+		if (total > n) {
+			kprintf("      ...and %u more\n", total - n);
+		}
+	}
+}
+
+/*
+ * Zero the per-cpu statistics.
+ */
+void
+cpu_resetstats(void)
+{
+	unsigned i, j;
+	struct cpu *c;
+	uint64_t now;
+
+	now = clock_getns();
+	for (i=0; i < cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		/* The scheduler uses c_hardclocks, so don't reset it */
+		c->c_statclocks = c->c_hardclocks;
+		c->c_idleclocks = 0;
+		c->c_steals = 0;
+		c->c_migrations = 0;
+		c->c_demotions = 0;
+		c->c_boosts = 0;
+		c->c_volswitches = 0;
+		c->c_involswitches = 0;
+		c->c_tcachehits = 0;
+		c->c_tcachemisses = 0;
+		c->c_rtmisses = 0;
+		c->c_rtthrottles = 0;
+		for (j=0; j<CPU_NIRQSLOTS; j++) {
+			c->c_irqs[j] = 0;
+		}
+		c->c_timerirqs = 0;
+		for (j=0; j<CPU_NIPITYPES; j++) {
+			c->c_ipis[j] = 0;
+		}
+		c->c_idlens = 0;
+#if OPT_SPLSTAT
+		c->c_splhighns = 0;
+#endif
+		c->c_statstart = now;
+	}
+}
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -1162,6 +2248,47 @@ ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
 	spinlock_release(&target->c_ipi_lock);
 }
 
+void
+ipi_tlbshootdown_allcpus(const struct tlbshootdown *mapping)
+{
+	unsigned i;
+	struct cpu *self, *c;
+	bool pending;
+
+	KASSERT(curthread->t_curspl == 0);
+
+	self = curcpu->c_self;
+	for (i=0; i < cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c != self) {
+			ipi_tlbshootdown(c, mapping);
+		}
+	}
+	vm_tlbshootdown(mapping);
+
+	/*
+	 * interprocessor_interrupt clears the pending bit once it has
+	 * done every shootdown queued so far, ours included. (If we
+	 * yield and come back on another cpu, it still takes the IPI.)
+	 */
+	for (i=0; i < cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c == self) {
+			continue;
+		}
+		while (1) {
+			spinlock_acquire(&c->c_ipi_lock);
+			pending = (c->c_ipi_pending &
+				   ((uint32_t)1 << IPI_TLBSHOOTDOWN)) != 0;
+			spinlock_release(&c->c_ipi_lock);
+			if (!pending) {
+				break;
+			}
+			thread_yield();
+		}
+	}
+}
+
 void
 interprocessor_interrupt(void)
 {
@@ -1171,6 +2298,12 @@ interprocessor_interrupt(void)
 	spinlock_acquire(&curcpu->c_ipi_lock);
 	bits = curcpu->c_ipi_pending;
 
+	for (i=0; i<CPU_NIPITYPES; i++) {
+		if (bits & (1U << i)) {
+			curcpu->c_ipis[i]++;
+		}
+	}
+
 	if (bits & (1U << IPI_PANIC)) {
 		/* panic on another cpu - just stop dead */
 		cpu_halt();
@@ -0,0 +1,239 @@
+/*
+ * Workqueues. See <workqueue.h>.
+ *
+ * Each cpu has a workqueue (c_workqueue) with a FIFO of pending work,
+ * a free list of work items, and one worker thread bound to that cpu
+ * that sleeps on the queue's wait channel when there's nothing to do.
+ * Everything in the queue is protected by its spinlock, which is what
+ * makes queueing work safe from interrupt handlers.
+ *
+ * Delayed work is taken from the pool right away and sits on the
+ * timer wheel until its timeout fires, at which point (from the timer
+ * interrupt) it is put on the queue like any other work.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <clock.h>
+#include <cpu.h>
+#include <thread.h>
+#include <current.h>
+#include <wchan.h>
+#include <workqueue.h>
+
+#define WORKQUEUE_NITEMS	64	/* Work items per cpu */
+
+struct work {
+	struct work *wk_next;		/* Next on queue or free list */
+	void (*wk_func)(void *);	/* What to call */
+	void *wk_arg;			/* Argument for wk_func */
+	struct workqueue *wk_wq;	/* Queue we belong to */
+	struct timeout wk_timeout;	/* For delayed work */
+};
+
+struct workqueue {
+	struct spinlock wq_lock;	/* Protects everything below */
+	struct work *wq_head;		/* Pending work, oldest first */
+	struct work **wq_tailp;		/* Where to add more */
+	struct work *wq_free;		/* Unused work items */
+	struct wchan *wq_wchan;		/* Where the worker sleeps */
+	struct work wq_items[WORKQUEUE_NITEMS];
+};
+
+/*
+ * Take a work item from WQ's pool. Must hold the queue lock.
+ */
+static
+struct work *
+workqueue_getitem(struct workqueue *wq, void (*func)(void *), void *arg)
+{
+	struct work *wk;
+
+	KASSERT(spinlock_do_i_hold(&wq->wq_lock));
+
+	wk = wq->wq_free;
+	if (wk != NULL) {
+		wq->wq_free = wk->wk_next;
+		wk->wk_next = NULL;
+		wk->wk_func = func;
+		wk->wk_arg = arg;
+	}
+	return wk;
+}
+
+/*
+ * Put WK on its queue and wake the worker. Must hold the queue lock.
+ */
+static
+void
+workqueue_put(struct work *wk)
+{
+	struct workqueue *wq = wk->wk_wq;
+
+	KASSERT(spinlock_do_i_hold(&wq->wq_lock));
+
+	wk->wk_next = NULL;
+	*wq->wq_tailp = wk;
+	wq->wq_tailp = &wk->wk_next;
+	wchan_wakeone(wq->wq_wchan);
+}
+
+/*
+ * Timeout callback for delayed work.
+ */
+static
+void
+workqueue_timeout(void *vwk)
+{
+	struct work *wk = vwk;
+	struct workqueue *wq = wk->wk_wq;
+
+	spinlock_acquire(&wq->wq_lock);
+	workqueue_put(wk);
+	spinlock_release(&wq->wq_lock);
+}
+
+/*
+ * Worker thread. DATA1 is its queue.
+ */
+static
+void
+workqueue_worker(void *data1, unsigned long data2)
+{
+	struct workqueue *wq = data1;
+	struct work *wk;
+	void (*func)(void *);
+	void *arg;
+
+	(void)data2;
+
+	spinlock_acquire(&wq->wq_lock);
+	while (1) {
+		wk = wq->wq_head;
+		if (wk == NULL) {
+			wchan_lock(wq->wq_wchan);
+			spinlock_release(&wq->wq_lock);
+			wchan_sleep(wq->wq_wchan);
+			spinlock_acquire(&wq->wq_lock);
+			continue;
+		}
+
+		wq->wq_head = wk->wk_next;
+		if (wq->wq_head == NULL) {
+			wq->wq_tailp = &wq->wq_head;
+		}
+
+		/* Free the item before running it, so it can requeue. */
+		func = wk->wk_func;
+		arg = wk->wk_arg;
+		wk->wk_next = wq->wq_free;
+		wq->wq_free = wk;
+
+		spinlock_release(&wq->wq_lock);
+		func(arg);
+		spinlock_acquire(&wq->wq_lock);
+	}
+}
+
+/*
+ * Set up one cpu's queue and start its worker.
+ */
+static
+void
+workqueue_create(struct cpu *c)
+{
+	struct workqueue *wq;
+	char name[16];
+	unsigned i;
+	int result;
+
+	wq = kmalloc(sizeof(*wq));
+	if (wq == NULL) {
+		panic("workqueue_create: Out of memory\n");
+	}
+	spinlock_init(&wq->wq_lock);
+	wq->wq_head = NULL;
+	wq->wq_tailp = &wq->wq_head;
+	wq->wq_free = NULL;
+	wq->wq_wchan = wchan_create("workqueue");
+	if (wq->wq_wchan == NULL) {
+		panic("workqueue_create: Out of memory\n");
+	}
+	for (i=0; i<WORKQUEUE_NITEMS; i++) {
+		wq->wq_items[i].wk_wq = wq;
+		timeout_init(&wq->wq_items[i].wk_timeout, workqueue_timeout,
+			     &wq->wq_items[i]);
+		wq->wq_items[i].wk_next = wq->wq_free;
+		wq->wq_free = &wq->wq_items[i];
+	}
+
+	c->c_workqueue = wq;
+
+	snprintf(name, sizeof(name), "worker/%u", c->c_number);
+	result = thread_fork_oncpu(name, c, workqueue_worker, wq, 0);
+	if (result) {
+		panic("workqueue_create: thread_fork_oncpu failed: %s\n",
+		      strerror(result));
+	}
+}
+
+void
+workqueue_bootstrap(void)
+{
+	unsigned i;
+
+	for (i=0; i<cpu_count(); i++) {
+		workqueue_create(cpu_bynumber(i));
+	}
+}
+
+int
+workqueue_enqueue(void (*func)(void *), void *arg)
+{
+	struct workqueue *wq;
+	struct work *wk;
+	int spl;
+
+	/* Stay on this cpu while we use its queue. */
+	spl = splhigh();
+	wq = curcpu->c_workqueue;
+	KASSERT(wq != NULL);
+
+	spinlock_acquire(&wq->wq_lock);
+	wk = workqueue_getitem(wq, func, arg);
+	if (wk != NULL) {
+		workqueue_put(wk);
+	}
+	spinlock_release(&wq->wq_lock);
+
+	splx(spl);
+	return wk == NULL ? ENOMEM : 0;
+}
+
+int
+workqueue_enqueue_delayed(void (*func)(void *), void *arg,
+			  uint64_t delayns)
+{
+	struct workqueue *wq;
+	struct work *wk;
+	int spl;
+
+	/* The timeout goes on this cpu's wheel; stay here. */
+	spl = splhigh();
+	wq = curcpu->c_workqueue;
+	KASSERT(wq != NULL);
+
+	spinlock_acquire(&wq->wq_lock);
+	wk = workqueue_getitem(wq, func, arg);
+	spinlock_release(&wq->wq_lock);
+
+	if (wk != NULL) {
+		timeout_add(&wk->wk_timeout, clock_getns() + delayns);
+	}
+
+	splx(spl);
+	return wk == NULL ? ENOMEM : 0;
+}
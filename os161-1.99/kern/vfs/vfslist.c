@@ -39,6 +39,7 @@
 #include <lib.h>
 #include <array.h>
 #include <synch.h>
+#include <rcu.h>
 #include <vfs.h>
 #include <fs.h>
 #include <vnode.h>
@@ -85,11 +86,21 @@ struct knowndev {
 DECLARRAY(knowndev);
 DEFARRAY(knowndev, /*no inline*/);
 
+/*
+ * The array is replaced rather than grown in place when a device is
+ * added (see knowndevs_add), so lookups can walk it under RCU without
+ * the lock. The knowndevs themselves are never freed.
+ */
 static struct knowndevarray *knowndevs;
 
-/* The big lock for all FS ops. Remove for filesystem assignment. */
+/* Lock for knowndevs and the mounts on them; taken by all updates. */
+static struct lock *vfs_devlistlock;
+
+#if OPT_VFSBIGLOCK
+/* The big lock for all FS ops. */
 static struct lock *vfs_biglock;
 static unsigned vfs_biglock_depth;
+#endif
 
 
 /*
@@ -103,11 +114,18 @@ vfs_bootstrap(void)
 		panic("vfs: Could not create knowndevs array\n");
 	}
 
+	vfs_devlistlock = lock_create("vfs_devlistlock");
+	if (vfs_devlistlock==NULL) {
+		panic("vfs: Could not create vfs device list lock\n");
+	}
+
+#if OPT_VFSBIGLOCK
 	vfs_biglock = lock_create("vfs_biglock");
 	if (vfs_biglock==NULL) {
 		panic("vfs: Could not create vfs big lock\n");
 	}
 	vfs_biglock_depth = 0;
+#endif
 
 	devnull_create();
 }
@@ -116,9 +134,10 @@ vfs_bootstrap(void)
  * Operations on vfs_biglock. We make it recursive to avoid having to
  * think about where we do and don't already hold it. This is an
  * undesirable hack that's frequently necessary when a lock covers too
- * much material. Your solution scheme for FS and VFS locking should
- * not require recursive locks.
+ * much material. The fine-grained locking used without the vfsbiglock
+ * option does not need recursive locks.
  */
+#if OPT_VFSBIGLOCK
 void
 vfs_biglock_acquire(void)
 {
@@ -144,6 +163,7 @@ vfs_biglock_do_i_hold(void)
 {
 	return lock_do_i_hold(vfs_biglock);
 }
+#endif /* OPT_VFSBIGLOCK */
 
 /*
  * Global sync function - call FSOP_SYNC on all devices.
@@ -155,6 +175,7 @@ vfs_sync(void)
 	unsigned i, num;
 
 	vfs_biglock_acquire();
+	lock_acquire(vfs_devlistlock);
 
 	num = knowndevarray_num(knowndevs);
 	for (i=0; i<num; i++) {
@@ -164,6 +185,7 @@ vfs_sync(void)
 		}
 	}
 
+	lock_release(vfs_devlistlock);
 	vfs_biglock_release();
 
 	return 0;
@@ -173,13 +195,56 @@ vfs_sync(void)
  * Given a device name (lhd0, emu0, somevolname, null, etc.), hand
  * back an appropriate vnode.
  */
+/*
+ * Fast path for vfs_getroot: look for DEVNAME as a device that can't
+ * have a filesystem mounted on it, or as a raw device, without the
+ * lock. Those entries never change once added. Anything else might
+ * need FSOP_GETROOT, which can sleep, so is left to the slow path.
+ */
+static
+bool
+vfs_getdev_fast(const char *devname, struct vnode **result)
+{
+	struct knowndevarray *kds;
+	struct knowndev *kd;
+	unsigned i, num;
+	bool found = false;
+
+	rcu_read_lock();
+	kds = rcu_dereference(knowndevs);
+	num = knowndevarray_num(kds);
+	for (i=0; i<num; i++) {
+		kd = knowndevarray_get(kds, i);
+		if (kd->kd_rawname == NULL) {
+			if (kd->kd_fs != NULL || strcmp(kd->kd_name, devname)) {
+				continue;
+			}
+		}
+		else if (strcmp(kd->kd_rawname, devname)) {
+			continue;
+		}
+		KASSERT(kd->kd_device != NULL);
+		VOP_INCREF(kd->kd_vnode);
+		*result = kd->kd_vnode;
+		found = true;
+		break;
+	}
+	rcu_read_unlock();
+	return found;
+}
+
 int
 vfs_getroot(const char *devname, struct vnode **result)
 {
 	struct knowndev *kd;
 	unsigned i, num;
 
-	KASSERT(vfs_biglock_do_i_hold());
+	/* Names are unique, so this finds what the loop below would */
+	if (vfs_getdev_fast(devname, result)) {
+		return 0;
+	}
+
+	lock_acquire(vfs_devlistlock);
 
 	num = knowndevarray_num(knowndevs);
 	for (i=0; i<num; i++) {
@@ -201,12 +266,14 @@ vfs_getroot(const char *devname, struct vnode **result)
 			if (!strcmp(kd->kd_name, devname) ||
 			    (volname!=NULL && !strcmp(volname, devname))) {
 				*result = FSOP_GETROOT(kd->kd_fs);
+				lock_release(vfs_devlistlock);
 				return 0;
 			}
 		}
 		else {
 			if (kd->kd_rawname!=NULL &&
 			    !strcmp(kd->kd_name, devname)) {
+				lock_release(vfs_devlistlock);
 				return ENXIO;
 			}
 		}
@@ -222,6 +289,7 @@ vfs_getroot(const char *devname, struct vnode **result)
 			KASSERT(kd->kd_device != NULL);
 			VOP_INCREF(kd->kd_vnode);
 			*result = kd->kd_vnode;
+			lock_release(vfs_devlistlock);
 			return 0;
 		}
 
@@ -233,6 +301,7 @@ vfs_getroot(const char *devname, struct vnode **result)
 			KASSERT(kd->kd_device != NULL);
 			VOP_INCREF(kd->kd_vnode);
 			*result = kd->kd_vnode;
+			lock_release(vfs_devlistlock);
 			return 0;
 		}
 
@@ -247,6 +316,7 @@ vfs_getroot(const char *devname, struct vnode **result)
 	 * If we got here, the device specified by devname doesn't exist.
 	 */
 
+	lock_release(vfs_devlistlock);
 	return ENODEV;
 }
 
@@ -256,16 +326,19 @@ vfs_getroot(const char *devname, struct vnode **result)
 const char *
 vfs_getdevname(struct fs *fs)
 {
+	struct knowndevarray *kds;
 	struct knowndev *kd;
+	const char *name;
 	unsigned i, num;
 
 	KASSERT(fs != NULL);
 
-	KASSERT(vfs_biglock_do_i_hold());
-
-	num = knowndevarray_num(knowndevs);
+	name = NULL;
+	rcu_read_lock();
+	kds = rcu_dereference(knowndevs);
+	num = knowndevarray_num(kds);
 	for (i=0; i<num; i++) {
-		kd = knowndevarray_get(knowndevs, i);
+		kd = knowndevarray_get(kds, i);
 
 		if (kd->kd_fs == fs) {
 			/*
@@ -274,11 +347,13 @@ vfs_getdevname(struct fs *fs)
 			 * the fs cannot go away, and the device can't
 			 * go away until the fs goes away.
 			 */
-			return kd->kd_name;
+			name = kd->kd_name;
+			break;
 		}
 	}
+	rcu_read_unlock();
 
-	return NULL;
+	return name;
 }
 
 /*
@@ -338,7 +413,7 @@ badnames(const char *n1, const char *n2, const char *n3)
 	unsigned i, num;
 	struct knowndev *kd;
 
-	KASSERT(vfs_biglock_do_i_hold());
+	KASSERT(lock_do_i_hold(vfs_devlistlock));
 
 	num = knowndevarray_num(knowndevs);
 	for (i=0; i<num; i++) {
@@ -360,6 +435,49 @@ badnames(const char *n1, const char *n2, const char *n3)
 	return 0;
 }
 
+/*
+ * Add KD to knowndevs. Lookups may be walking the array without the
+ * lock, so rather than growing it in place, which can move it, build
+ * a bigger copy, publish that, and free the old one once no lookup
+ * can still be using it. Devices are only added while booting, so the
+ * copying doesn't matter.
+ */
+static
+int
+knowndevs_add(struct knowndev *kd, unsigned *index_ret)
+{
+	struct knowndevarray *old, *new;
+	unsigned i, num;
+	int result;
+
+	KASSERT(lock_do_i_hold(vfs_devlistlock));
+
+	old = knowndevs;
+	num = knowndevarray_num(old);
+	new = knowndevarray_create();
+	if (new == NULL) {
+		return ENOMEM;
+	}
+	result = knowndevarray_setsize(new, num + 1);
+	if (result) {
+		knowndevarray_destroy(new);
+		return result;
+	}
+	for (i=0; i<num; i++) {
+		knowndevarray_set(new, i, knowndevarray_get(old, i));
+	}
+	knowndevarray_set(new, num, kd);
+
+	rcu_assign_pointer(knowndevs, new);
+	rcu_synchronize();
+
+	knowndevarray_setsize(old, 0);
+	knowndevarray_destroy(old);
+
+	*index_ret = num;
+	return 0;
+}
+
 /*
  * Add a new device to the VFS layer's device table.
  *
@@ -379,6 +497,7 @@ vfs_doadd(const char *dname, int mountable, struct device *dev, struct fs *fs)
 	int result;
 
 	vfs_biglock_acquire();
+	lock_acquire(vfs_devlistlock);
 
 	name = kstrdup(dname);
 	if (name==NULL) {
@@ -412,17 +531,19 @@ vfs_doadd(const char *dname, int mountable, struct device *dev, struct fs *fs)
 	}
 
 	if (badnames(name, rawname, volname)) {
+		lock_release(vfs_devlistlock);
 		vfs_biglock_release();
 		return EEXIST;
 	}
 
-	result = knowndevarray_add(knowndevs, kd, &index);
+	result = knowndevs_add(kd, &index);
 
 	if (result == 0 && dev != NULL) {
 		/* use index+1 as the device number, so 0 is reserved */
 		dev->d_devnumber = index+1;
 	}
 
+	lock_release(vfs_devlistlock);
 	vfs_biglock_release();
 	return result;
 
@@ -441,6 +562,7 @@ vfs_doadd(const char *dname, int mountable, struct device *dev, struct fs *fs)
 		kfree(kd);
 	}
 	
+	lock_release(vfs_devlistlock);
 	vfs_biglock_release();
 	return ENOMEM;
 }
@@ -480,7 +602,7 @@ findmount(const char *devname, struct knowndev **result)
 	unsigned i, num;
 	bool found = false;
 
-	KASSERT(vfs_biglock_do_i_hold());
+	KASSERT(lock_do_i_hold(vfs_devlistlock));
 
 	num = knowndevarray_num(knowndevs);
 	for (i=0; !found && i<num; i++) {
@@ -515,14 +637,17 @@ vfs_mount(const char *devname, void *data,
 	int result;
 
 	vfs_biglock_acquire();
+	lock_acquire(vfs_devlistlock);
 
 	result = findmount(devname, &kd);
 	if (result) {
+		lock_release(vfs_devlistlock);
 		vfs_biglock_release();
 		return result;
 	}
 
 	if (kd->kd_fs != NULL) {
+		lock_release(vfs_devlistlock);
 		vfs_biglock_release();
 		return EBUSY;
 	}
@@ -531,6 +656,7 @@ vfs_mount(const char *devname, void *data,
 
 	result = mountfunc(data, kd->kd_device, &fs);
 	if (result) {
+		lock_release(vfs_devlistlock);
 		vfs_biglock_release();
 		return result;
 	}
@@ -543,6 +669,7 @@ vfs_mount(const char *devname, void *data,
 	kprintf("vfs: Mounted %s: on %s\n",
 		volname ? volname : kd->kd_name, kd->kd_name);
 
+	lock_release(vfs_devlistlock);
 	vfs_biglock_release();
 	return 0;
 }
@@ -558,6 +685,7 @@ vfs_unmount(const char *devname)
 	int result;
 
 	vfs_biglock_acquire();
+	lock_acquire(vfs_devlistlock);
 
 	result = findmount(devname, &kd);
 	if (result) {
@@ -589,6 +717,7 @@ vfs_unmount(const char *devname)
 	KASSERT(result==0);
 
  fail:
+	lock_release(vfs_devlistlock);
 	vfs_biglock_release();
 	return result;
 }
@@ -604,6 +733,7 @@ vfs_unmountall(void)
 	int result;
 
 	vfs_biglock_acquire();
+	lock_acquire(vfs_devlistlock);
 
 	num = knowndevarray_num(knowndevs);
 	for (i=0; i<num; i++) {
@@ -650,6 +780,7 @@ vfs_unmountall(void)
 		dev->kd_fs = NULL;
 	}
 
+	lock_release(vfs_devlistlock);
 	vfs_biglock_release();
 
 	return 0;
@@ -0,0 +1,405 @@
+/*
+ * Address spaces for the paged VM system. See <addrspace.h>.
+ *
+ * Regions come from as_define_region and as_define_stack; pages in
+ * them get physical memory when first touched, in vm_fault (vm.c).
+ * load_elf doesn't read the program in itself; it attaches the
+ * executable to its regions with as_define_file, and vm_fault reads
+ * each page from it when the page is first touched.
+ *
+ * as_copy doesn't copy pages either. The parent and child share them,
+ * marked PTE_COW so that vm_fault maps them read-only; the first write
+ * to one from either side gets a private copy. Forking costs one PTE
+ * per page in use rather than one page copy. Pages that are out in
+ * swap can't be shared that way; the child gets its own copy of those
+ * straight away.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <synch.h>
+#include <proc.h>
+#include <current.h>
+#include <vnode.h>
+#include <addrspace.h>
+#include <pagetable.h>
+#include <coremap.h>
+#include <swap.h>
+#include <vm.h>
+#include <uw-vmstats.h>
+
+struct addrspace *
+as_create(void)
+{
+	struct addrspace *as;
+
+	as = kmalloc(sizeof(struct addrspace));
+	if (as == NULL) {
+		return NULL;
+	}
+	as->as_pt = pt_create();
+	if (as->as_pt == NULL) {
+		kfree(as);
+		return NULL;
+	}
+	as->as_lock = lock_create("as_lock");
+	if (as->as_lock == NULL) {
+		pt_destroy(as->as_pt);
+		kfree(as);
+		return NULL;
+	}
+	as->as_busycv = cv_create("as_busycv");
+	if (as->as_busycv == NULL) {
+		lock_destroy(as->as_lock);
+		pt_destroy(as->as_pt);
+		kfree(as);
+		return NULL;
+	}
+	as->as_regions = NULL;
+	as->as_loading = false;
+
+	return as;
+}
+
+/*
+ * Add a region, with no file behind it. Doesn't check for overlaps.
+ * The new region is handed back in RET if that isn't NULL. Call with
+ * as_lock held.
+ */
+static
+int
+as_addregion(struct addrspace *as, vaddr_t base, size_t npages,
+	     bool writeable, struct region **ret)
+{
+	struct region *rg;
+
+	KASSERT(lock_do_i_hold(as->as_lock));
+
+	rg = kmalloc(sizeof(*rg));
+	if (rg == NULL) {
+		return ENOMEM;
+	}
+	rg->rg_base = base;
+	rg->rg_npages = npages;
+	rg->rg_writeable = writeable;
+	rg->rg_vnode = NULL;
+	rg->rg_filevaddr = 0;
+	rg->rg_fileoff = 0;
+	rg->rg_filesize = 0;
+
+	rg->rg_next = as->as_regions;
+	as->as_regions = rg;
+
+	if (ret != NULL) {
+		*ret = rg;
+	}
+	return 0;
+}
+
+struct region *
+as_findregion(struct addrspace *as, vaddr_t vaddr)
+{
+	struct region *rg;
+
+	KASSERT(lock_do_i_hold(as->as_lock));
+
+	for (rg = as->as_regions; rg != NULL; rg = rg->rg_next) {
+		if (vaddr >= rg->rg_base &&
+		    vaddr - rg->rg_base < rg->rg_npages * PAGE_SIZE) {
+			return rg;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Find the next PTE in use at or after *VADDR and before END, and
+ * advance *VADDR to it. Skips 4M at a time where there are no PTEs.
+ */
+static
+pte_t *
+as_nextpte(struct addrspace *as, vaddr_t *vaddr, vaddr_t end)
+{
+	pte_t *pte;
+	vaddr_t va;
+
+	va = *vaddr;
+	while (va < end) {
+		pte = pt_lookup(as->as_pt, va, false);
+		if (pte == NULL) {
+			va = (va + PT_DIRSIZE) & ~(vaddr_t)(PT_DIRSIZE - 1);
+			continue;
+		}
+		if (*pte != 0) {
+			*vaddr = va;
+			return pte;
+		}
+		va += PAGE_SIZE;
+	}
+	return NULL;
+}
+
+/*
+ * Throw away everything in this cpu's TLB.
+ */
+static
+void
+as_flushtlb(void)
+{
+	vm_tlbshootdown_all();
+	vmstats_inc(VMSTAT_TLB_INVALIDATE);
+}
+
+int
+as_copy(struct addrspace *old, struct addrspace **ret)
+{
+	struct addrspace *new;
+	struct region *rg, *newrg;
+	pte_t *oldpte, *newpte;
+	vaddr_t va, end;
+	paddr_t pa;
+	int result;
+
+	new = as_create();
+	if (new==NULL) {
+		return ENOMEM;
+	}
+
+	/*
+	 * Nobody else knows about NEW yet, so taking its lock second
+	 * can't deadlock; it keeps coremap_victim out of its page
+	 * table while we fill it in.
+	 */
+	lock_acquire(old->as_lock);
+	lock_acquire(new->as_lock);
+	for (rg = old->as_regions; rg != NULL; rg = rg->rg_next) {
+		result = as_addregion(new, rg->rg_base, rg->rg_npages,
+				      rg->rg_writeable, &newrg);
+		if (result) {
+			goto fail;
+		}
+		if (rg->rg_vnode != NULL) {
+			/* Pages not copied below still come from the file */
+			VOP_INCREF(rg->rg_vnode);
+			newrg->rg_vnode = rg->rg_vnode;
+			newrg->rg_filevaddr = rg->rg_filevaddr;
+			newrg->rg_fileoff = rg->rg_fileoff;
+			newrg->rg_filesize = rg->rg_filesize;
+		}
+
+		end = rg->rg_base + rg->rg_npages * PAGE_SIZE;
+		va = rg->rg_base;
+		for (; (oldpte = as_nextpte(old, &va, end)) != NULL;
+		     va += PAGE_SIZE) {
+			while (*oldpte & PTE_BUSY) {
+				cv_wait(old->as_busycv, old->as_lock);
+			}
+			if (*oldpte == 0) {
+				/* The read failed; it's untouched again */
+				continue;
+			}
+			newpte = pt_lookup(new->as_pt, va, true);
+			if (newpte == NULL) {
+				result = ENOMEM;
+				goto fail;
+			}
+			if (*oldpte & PTE_SWAPPED) {
+				pa = swap_getpage(CM_USER);
+				if (pa == 0) {
+					result = ENOMEM;
+					goto fail;
+				}
+				result = swap_read(PTE_TOSLOT(*oldpte), pa);
+				if (result) {
+					coremap_free(pa);
+					goto fail;
+				}
+				*newpte = pa | PTE_PRESENT;
+				coremap_touch(pa, new, va);
+				continue;
+			}
+			KASSERT(*oldpte & PTE_PRESENT);
+			if (rg->rg_writeable) {
+				*oldpte |= PTE_COW;
+			}
+			coremap_share(*oldpte & PTE_FRAME);
+			*newpte = *oldpte;
+		}
+	}
+	lock_release(new->as_lock);
+	lock_release(old->as_lock);
+
+	/*
+	 * We're the parent, and our TLB may still let us write pages
+	 * that are now shared. Other cpus flush when they switch to us.
+	 */
+	if (old == curproc_getas()) {
+		as_flushtlb();
+	}
+
+	*ret = new;
+	return 0;
+
+ fail:
+	lock_release(new->as_lock);
+	lock_release(old->as_lock);
+	as_destroy(new);
+	return result;
+}
+
+void
+as_destroy(struct addrspace *as)
+{
+	struct region *rg;
+	pte_t *pte;
+	vaddr_t va, end;
+
+	/* Keep swap_evict away, and wait out pages being read in */
+	lock_acquire(as->as_lock);
+	while (as->as_regions != NULL) {
+		rg = as->as_regions;
+		as->as_regions = rg->rg_next;
+
+		end = rg->rg_base + rg->rg_npages * PAGE_SIZE;
+		va = rg->rg_base;
+		for (; (pte = as_nextpte(as, &va, end)) != NULL;
+		     va += PAGE_SIZE) {
+			while (*pte & PTE_BUSY) {
+				cv_wait(as->as_busycv, as->as_lock);
+			}
+			if (*pte == 0) {
+				continue;
+			}
+			if (*pte & PTE_SWAPPED) {
+				swap_free(PTE_TOSLOT(*pte));
+			}
+			else {
+				KASSERT(*pte & PTE_PRESENT);
+				coremap_free(*pte & PTE_FRAME);
+			}
+			*pte = 0;
+		}
+		if (rg->rg_vnode != NULL) {
+			VOP_DECREF(rg->rg_vnode);
+		}
+		kfree(rg);
+	}
+	lock_release(as->as_lock);
+
+	pt_destroy(as->as_pt);
+	cv_destroy(as->as_busycv);
+	lock_destroy(as->as_lock);
+	kfree(as);
+}
+
+void
+as_activate(void)
+{
+	struct addrspace *as;
+
+	as = curproc_getas();
+	if (as == NULL) {
+		/* Kernel threads don't have an address space to activate */
+		return;
+	}
+
+	/* No address space IDs, so the last one's mappings must go */
+	as_flushtlb();
+}
+
+void
+as_deactivate(void)
+{
+	/* nothing */
+}
+
+int
+as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
+		 int readable, int writeable, int executable)
+{
+	size_t npages;
+	int result;
+
+	/* Align the region. First, the base... */
+	sz += vaddr & ~(vaddr_t)PAGE_FRAME;
+	vaddr &= PAGE_FRAME;
+
+	/* ...and now the length. */
+	sz = (sz + PAGE_SIZE - 1) & PAGE_FRAME;
+
+	npages = sz / PAGE_SIZE;
+
+	if (vaddr + sz > USERSTACK - VM_STACKPAGES * PAGE_SIZE ||
+	    vaddr + sz < vaddr) {
+		return EFAULT;
+	}
+
+	/* MIPS pages can't be made unreadable or unexecutable */
+	(void)readable;
+	(void)executable;
+
+	lock_acquire(as->as_lock);
+	result = as_addregion(as, vaddr, npages, writeable != 0, NULL);
+	lock_release(as->as_lock);
+	return result;
+}
+
+int
+as_define_file(struct addrspace *as, vaddr_t vaddr, struct vnode *v,
+	       off_t offset, size_t filesize)
+{
+	struct region *rg;
+
+	lock_acquire(as->as_lock);
+	rg = as_findregion(as, vaddr);
+	if (rg == NULL || rg->rg_vnode != NULL ||
+	    vaddr + filesize < vaddr ||
+	    vaddr + filesize > rg->rg_base + rg->rg_npages * PAGE_SIZE) {
+		lock_release(as->as_lock);
+		return ENOEXEC;
+	}
+	VOP_INCREF(v);
+	rg->rg_vnode = v;
+	rg->rg_filevaddr = vaddr;
+	rg->rg_fileoff = offset;
+	rg->rg_filesize = filesize;
+	lock_release(as->as_lock);
+
+	return 0;
+}
+
+int
+as_prepare_load(struct addrspace *as)
+{
+	/* Let load_elf write to read-only regions */
+	as->as_loading = true;
+	return 0;
+}
+
+int
+as_complete_load(struct addrspace *as)
+{
+	as->as_loading = false;
+
+	/* Drop writable mappings of read-only pages made while loading */
+	as_flushtlb();
+	return 0;
+}
+
+int
+as_define_stack(struct addrspace *as, vaddr_t *stackptr)
+{
+	int result;
+
+	lock_acquire(as->as_lock);
+	result = as_addregion(as, USERSTACK - VM_STACKPAGES * PAGE_SIZE,
+			      VM_STACKPAGES, true, NULL);
+	lock_release(as->as_lock);
+	if (result) {
+		return result;
+	}
+
+	*stackptr = USERSTACK;
+	return 0;
+}
@@ -0,0 +1,440 @@
+/*
+ * Coremap: the physical page allocator. See <coremap.h>.
+ *
+ * The coremap itself goes at the bottom of the memory ram_getsize
+ * hands us. Free pages are kept on a doubly linked list threaded
+ * through their entries by page number, so a page can be taken off
+ * it from the middle when a multi-page allocation needs it.
+ *
+ * Everything is protected by coremap_lock. It's a spinlock because
+ * kmalloc can be called with interrupts off.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <coremap.h>
+#include "opt-dumbvm.h"
+
+#define CM_NONE		0xffffffff	/* No page, in the free list */
+
+struct cm_entry {
+	uint8_t cme_state;		/* CM_* */
+	bool cme_referenced;		/* Used since the clock came by */
+	uint16_t cme_pincount;		/* Pins (user pages only) */
+	uint16_t cme_refcount;		/* References, on the first page */
+	uint32_t cme_npages;		/* Pages allocated, on the first */
+	uint32_t cme_next;		/* Free list, if CM_FREE */
+	uint32_t cme_prev;
+	struct addrspace *cme_as;	/* Sole owner, if known */
+	vaddr_t cme_vaddr;		/* ...and where it's mapped */
+};
+
+static struct cm_entry *coremap;
+static unsigned coremap_npages;		/* Entries in coremap */
+static unsigned coremap_first;		/* First page not CM_FIXED */
+static uint32_t coremap_freehead;	/* Free list */
+static uint32_t coremap_hand;		/* Clock hand, for eviction */
+static struct coremapstats coremap_stats;
+static struct spinlock coremap_lock = SPINLOCK_INITIALIZER;
+
+/*
+ * Free list operations.
+ */
+static
+void
+coremap_freepush(uint32_t i)
+{
+	coremap[i].cme_state = CM_FREE;
+	coremap[i].cme_pincount = 0;
+	coremap[i].cme_referenced = false;
+	coremap[i].cme_refcount = 0;
+	coremap[i].cme_npages = 0;
+	coremap[i].cme_as = NULL;
+	coremap[i].cme_vaddr = 0;
+	coremap[i].cme_prev = CM_NONE;
+	coremap[i].cme_next = coremap_freehead;
+	if (coremap_freehead != CM_NONE) {
+		coremap[coremap_freehead].cme_prev = i;
+	}
+	coremap_freehead = i;
+	coremap_stats.cms_free++;
+}
+
+static
+void
+coremap_freeremove(uint32_t i)
+{
+	struct cm_entry *cme = &coremap[i];
+
+	KASSERT(cme->cme_state == CM_FREE);
+	if (cme->cme_prev != CM_NONE) {
+		coremap[cme->cme_prev].cme_next = cme->cme_next;
+	}
+	else {
+		coremap_freehead = cme->cme_next;
+	}
+	if (cme->cme_next != CM_NONE) {
+		coremap[cme->cme_next].cme_prev = cme->cme_prev;
+	}
+	coremap_stats.cms_free--;
+}
+
+/*
+ * Count a page going into or out of STATE.
+ */
+static
+unsigned *
+coremap_statcount(int state)
+{
+	switch (state) {
+	    case CM_FIXED: return &coremap_stats.cms_fixed;
+	    case CM_KERNEL: return &coremap_stats.cms_kernel;
+	    case CM_USER: return &coremap_stats.cms_user;
+	}
+	panic("coremap: bad page state %d\n", state);
+	return NULL;
+}
+
+void
+coremap_bootstrap(void)
+{
+	paddr_t lo, hi;
+	size_t size;
+	uint32_t i;
+
+	KASSERT(coremap == NULL);
+
+	ram_getsize(&lo, &hi);
+	coremap_npages = hi / PAGE_SIZE;
+	size = coremap_npages * sizeof(struct cm_entry);
+	size = (size + PAGE_SIZE - 1) & PAGE_FRAME;
+	if (lo + size >= hi) {
+		panic("coremap: no room for the coremap\n");
+	}
+
+	spinlock_acquire(&coremap_lock);
+
+	coremap = (struct cm_entry *)PADDR_TO_KVADDR(lo);
+	coremap_first = (lo + size) / PAGE_SIZE;
+	coremap_freehead = CM_NONE;
+	coremap_stats.cms_total = coremap_npages;
+
+	for (i=0; i<coremap_first; i++) {
+		coremap[i].cme_state = CM_FIXED;
+		coremap[i].cme_pincount = 0;
+		coremap[i].cme_referenced = false;
+		coremap[i].cme_refcount = 0;
+		coremap[i].cme_npages = 0;
+		coremap[i].cme_as = NULL;
+		coremap[i].cme_vaddr = 0;
+		coremap[i].cme_next = coremap[i].cme_prev = CM_NONE;
+	}
+	coremap_stats.cms_fixed = coremap_first;
+	coremap_hand = coremap_first;
+
+	/* Push from the top down, so low pages get used first */
+	for (i = coremap_npages; i-- > coremap_first; ) {
+		coremap_freepush(i);
+	}
+
+	spinlock_release(&coremap_lock);
+
+	kprintf("coremap: %u pages, %u free\n", coremap_npages,
+		coremap_stats.cms_free);
+}
+
+/*
+ * Find NPAGES free pages in a row; returns the first or CM_NONE.
+ */
+static
+uint32_t
+coremap_findrun(unsigned npages)
+{
+	uint32_t i, run;
+
+	run = 0;
+	for (i = coremap_first; i < coremap_npages; i++) {
+		if (coremap[i].cme_state != CM_FREE) {
+			run = 0;
+			continue;
+		}
+		run++;
+		if (run == npages) {
+			return i + 1 - npages;
+		}
+	}
+	return CM_NONE;
+}
+
+paddr_t
+coremap_alloc(unsigned npages, int state)
+{
+	paddr_t pa;
+	uint32_t first, i;
+
+	KASSERT(state == CM_KERNEL || state == CM_USER);
+	KASSERT(npages > 0);
+
+	spinlock_acquire(&coremap_lock);
+
+	if (coremap == NULL) {
+		/* Not bootstrapped yet; these can never be freed */
+		pa = ram_stealmem(npages);
+		spinlock_release(&coremap_lock);
+		return pa;
+	}
+
+	if (npages == 1) {
+		first = coremap_freehead;
+	}
+	else if (npages > coremap_stats.cms_free) {
+		first = CM_NONE;
+	}
+	else {
+		first = coremap_findrun(npages);
+	}
+	if (first == CM_NONE) {
+		spinlock_release(&coremap_lock);
+		return 0;
+	}
+
+	for (i = first; i < first + npages; i++) {
+		coremap_freeremove(i);
+		coremap[i].cme_state = state;
+		coremap[i].cme_npages = 0;
+	}
+	coremap[first].cme_npages = npages;
+	coremap[first].cme_refcount = 1;
+	*coremap_statcount(state) += npages;
+
+	spinlock_release(&coremap_lock);
+
+	return (paddr_t)first * PAGE_SIZE;
+}
+
+void
+coremap_free(paddr_t pa)
+{
+	uint32_t first, i;
+	unsigned npages;
+	int state;
+
+	KASSERT((pa & PAGE_FRAME) == pa);
+
+	spinlock_acquire(&coremap_lock);
+
+	first = pa / PAGE_SIZE;
+	if (coremap == NULL || first < coremap_first) {
+		/* From ram_stealmem; we don't know how big it is. Leak it. */
+		spinlock_release(&coremap_lock);
+		return;
+	}
+	KASSERT(first < coremap_npages);
+
+	state = coremap[first].cme_state;
+	npages = coremap[first].cme_npages;
+	KASSERT(state == CM_KERNEL || state == CM_USER);
+	KASSERT(npages > 0);
+	KASSERT(first + npages <= coremap_npages);
+	KASSERT(coremap[first].cme_refcount > 0);
+
+	if (coremap[first].cme_refcount > 1) {
+		/* Still shared; just drop our reference */
+		coremap[first].cme_refcount--;
+		if (coremap[first].cme_refcount == 1) {
+			coremap_stats.cms_shared -= npages;
+		}
+		spinlock_release(&coremap_lock);
+		return;
+	}
+
+	for (i = first; i < first + npages; i++) {
+		KASSERT(coremap[i].cme_state == state);
+		KASSERT(coremap[i].cme_pincount == 0);
+		coremap_freepush(i);
+	}
+	*coremap_statcount(state) -= npages;
+
+	spinlock_release(&coremap_lock);
+}
+
+void
+coremap_share(paddr_t pa)
+{
+	struct cm_entry *cme;
+
+	KASSERT(coremap != NULL);
+	KASSERT(pa / PAGE_SIZE < coremap_npages);
+
+	spinlock_acquire(&coremap_lock);
+	cme = &coremap[pa / PAGE_SIZE];
+	KASSERT(cme->cme_state == CM_USER);
+	KASSERT(cme->cme_npages > 0);
+	KASSERT(cme->cme_refcount > 0 && cme->cme_refcount < 0xffff);
+	cme->cme_refcount++;
+	if (cme->cme_refcount == 2) {
+		coremap_stats.cms_shared += cme->cme_npages;
+	}
+	/* No single owner any more, so it can't be evicted */
+	cme->cme_as = NULL;
+	spinlock_release(&coremap_lock);
+}
+
+bool
+coremap_touch(paddr_t pa, struct addrspace *as, vaddr_t vaddr)
+{
+	struct cm_entry *cme;
+	bool ours;
+
+	KASSERT(coremap != NULL);
+	KASSERT(pa / PAGE_SIZE < coremap_npages);
+
+	spinlock_acquire(&coremap_lock);
+	cme = &coremap[pa / PAGE_SIZE];
+	KASSERT(cme->cme_state == CM_USER);
+	KASSERT(cme->cme_npages == 1);
+	cme->cme_referenced = true;
+	ours = cme->cme_refcount == 1;
+	if (ours) {
+		cme->cme_as = as;
+		cme->cme_vaddr = vaddr;
+	}
+	spinlock_release(&coremap_lock);
+	return ours;
+}
+
+#if !OPT_DUMBVM
+paddr_t
+coremap_victim(struct addrspace **asp, vaddr_t *vaddrp, bool *lockedp)
+{
+	struct cm_entry *cme;
+	struct addrspace *as;
+	unsigned n;
+	uint32_t i;
+
+	KASSERT(coremap != NULL);
+
+	spinlock_acquire(&coremap_lock);
+
+	/* Twice around: the first time may only clear referenced bits */
+	for (n = 0; n < 2 * (coremap_npages - coremap_first); n++) {
+		i = coremap_hand;
+		coremap_hand = i + 1 < coremap_npages ? i + 1 : coremap_first;
+
+		cme = &coremap[i];
+		if (cme->cme_state != CM_USER || cme->cme_pincount > 0 ||
+		    cme->cme_as == NULL) {
+			continue;
+		}
+		KASSERT(cme->cme_refcount == 1);
+		if (cme->cme_referenced) {
+			/* Second chance */
+			cme->cme_referenced = false;
+			continue;
+		}
+
+		/*
+		 * The owner's pages can't be freed, nor its address space
+		 * destroyed, without its as_lock, and since we hold the
+		 * coremap lock we can't wait for it. Pass over pages
+		 * whose owner is busy.
+		 */
+		as = cme->cme_as;
+		if (lock_do_i_hold(as->as_lock)) {
+			*lockedp = false;
+		}
+		else if (lock_tryacquire(as->as_lock)) {
+			*lockedp = true;
+		}
+		else {
+			continue;
+		}
+
+		cme->cme_pincount = 1;
+		coremap_stats.cms_pinned++;
+		*asp = as;
+		*vaddrp = cme->cme_vaddr;
+		spinlock_release(&coremap_lock);
+		return (paddr_t)i * PAGE_SIZE;
+	}
+
+	spinlock_release(&coremap_lock);
+	return 0;
+}
+#endif /* !OPT_DUMBVM */
+
+/*
+ * Pin or unpin the user page at PA. Pins are counted, since, e.g.,
+ * several futex operations may be looking at the same page at once.
+ */
+static
+void
+coremap_setpinned(paddr_t pa, bool pinned)
+{
+	struct cm_entry *cme;
+
+	KASSERT(coremap != NULL);
+	KASSERT(pa / PAGE_SIZE < coremap_npages);
+
+	spinlock_acquire(&coremap_lock);
+	cme = &coremap[pa / PAGE_SIZE];
+	KASSERT(cme->cme_state == CM_USER);
+	if (pinned) {
+		KASSERT(cme->cme_pincount < 0xffff);
+		if (cme->cme_pincount++ == 0) {
+			coremap_stats.cms_pinned++;
+		}
+	}
+	else {
+		KASSERT(cme->cme_pincount > 0);
+		if (--cme->cme_pincount == 0) {
+			coremap_stats.cms_pinned--;
+		}
+	}
+	spinlock_release(&coremap_lock);
+}
+
+void
+coremap_pin(paddr_t pa)
+{
+	coremap_setpinned(pa, true);
+}
+
+void
+coremap_unpin(paddr_t pa)
+{
+	coremap_setpinned(pa, false);
+}
+
+void
+coremap_getstats(struct coremapstats *cms)
+{
+	spinlock_acquire(&coremap_lock);
+	*cms = coremap_stats;
+	spinlock_release(&coremap_lock);
+}
+
+void
+coremap_printstats(void)
+{
+	struct coremapstats cms;
+
+	coremap_getstats(&cms);
+	if (cms.cms_total == 0) {
+		kprintf("coremap: not set up yet\n");
+		return;
+	}
+	kprintf("Physical memory: %u pages (%uk)\n", cms.cms_total,
+		cms.cms_total * PAGE_SIZE / 1024);
+	kprintf("    free:   %6u\n", cms.cms_free);
+	kprintf("    used:   %6u\n", cms.cms_total - cms.cms_free);
+	kprintf("      fixed:  %6u (kernel image and boot allocations)\n",
+		cms.cms_fixed);
+	kprintf("      kernel: %6u\n", cms.cms_kernel);
+	kprintf("      user:   %6u (%u pinned, %u shared)\n", cms.cms_user,
+		cms.cms_pinned, cms.cms_shared);
+}
@@ -0,0 +1,63 @@
+/*
+ * Two-level page tables. See <pagetable.h>.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <vm.h>
+#include <pagetable.h>
+
+struct pagetable *
+pt_create(void)
+{
+	struct pagetable *pt;
+	unsigned i;
+
+	pt = kmalloc(sizeof(*pt));
+	if (pt == NULL) {
+		return NULL;
+	}
+	for (i=0; i<PT_NDIR; i++) {
+		pt->pt_dir[i] = NULL;
+	}
+	return pt;
+}
+
+void
+pt_destroy(struct pagetable *pt)
+{
+	unsigned i;
+
+	for (i=0; i<PT_NDIR; i++) {
+		if (pt->pt_dir[i] != NULL) {
+			kfree(pt->pt_dir[i]);
+		}
+	}
+	kfree(pt);
+}
+
+pte_t *
+pt_lookup(struct pagetable *pt, vaddr_t vaddr, bool create)
+{
+	unsigned dir, i;
+	pte_t *ptes;
+
+	KASSERT(vaddr < USERSPACETOP);
+
+	dir = vaddr >> PT_DIRSHIFT;
+	ptes = pt->pt_dir[dir];
+	if (ptes == NULL) {
+		if (!create) {
+			return NULL;
+		}
+		ptes = kmalloc(PT_NPTES * sizeof(pte_t));
+		if (ptes == NULL) {
+			return NULL;
+		}
+		for (i=0; i<PT_NPTES; i++) {
+			ptes[i] = 0;
+		}
+		pt->pt_dir[dir] = ptes;
+	}
+	return &ptes[(vaddr >> PT_PTESHIFT) & (PT_NPTES - 1)];
+}
@@ -0,0 +1,215 @@
+/*
+ * Swap space and page eviction for the paged VM system. See <swap.h>.
+ *
+ * Eviction takes the victim the coremap's clock gives us, with its
+ * owner's as_lock held, so nothing can look at or change its PTE
+ * while we work. The mapping is shot down on every cpu before the
+ * page is written out, so that the owner, if it's running, faults
+ * (and waits for the as_lock) instead of changing the page under us.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/stat.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <bitmap.h>
+#include <cpu.h>
+#include <thread.h>
+#include <current.h>
+#include <uio.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <addrspace.h>
+#include <pagetable.h>
+#include <coremap.h>
+#include <swap.h>
+#include <vm.h>
+#include <uw-vmstats.h>
+
+static struct vnode *swap_vnode;	/* NULL if there's no swap */
+static unsigned swap_nslots;
+static struct bitmap *swap_map;		/* Slots in use */
+static struct spinlock swap_lock = SPINLOCK_INITIALIZER;
+
+void
+swap_bootstrap(void)
+{
+	char path[] = SWAP_DEVICE;
+	struct stat st;
+	int result;
+
+	/* vfs_open may change PATH, which is why it's a copy */
+	result = vfs_open(path, O_RDWR, 0, &swap_vnode);
+	if (result) {
+		kprintf("swap: %s: %s; no swap space\n", SWAP_DEVICE,
+			strerror(result));
+		swap_vnode = NULL;
+		return;
+	}
+	result = VOP_STAT(swap_vnode, &st);
+	if (result) {
+		kprintf("swap: %s: stat: %s; no swap space\n", SWAP_DEVICE,
+			strerror(result));
+		vfs_close(swap_vnode);
+		swap_vnode = NULL;
+		return;
+	}
+
+	swap_nslots = st.st_size / PAGE_SIZE;
+	swap_map = bitmap_create(swap_nslots);
+	if (swap_nslots == 0 || swap_map == NULL) {
+		kprintf("swap: %s: no swap space\n", SWAP_DEVICE);
+		if (swap_map != NULL) {
+			bitmap_destroy(swap_map);
+			swap_map = NULL;
+		}
+		vfs_close(swap_vnode);
+		swap_vnode = NULL;
+		return;
+	}
+
+	kprintf("swap: %u pages on %s\n", swap_nslots, SWAP_DEVICE);
+}
+
+static
+int
+swap_alloc(unsigned *slot)
+{
+	int result;
+
+	spinlock_acquire(&swap_lock);
+	result = bitmap_alloc(swap_map, slot);
+	spinlock_release(&swap_lock);
+	return result;
+}
+
+void
+swap_free(unsigned slot)
+{
+	KASSERT(slot < swap_nslots);
+
+	spinlock_acquire(&swap_lock);
+	KASSERT(bitmap_isset(swap_map, slot));
+	bitmap_unmark(swap_map, slot);
+	spinlock_release(&swap_lock);
+}
+
+/*
+ * Move a page between memory at PA and swap slot SLOT.
+ */
+static
+int
+swap_io(unsigned slot, paddr_t pa, enum uio_rw rw)
+{
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	KASSERT(swap_vnode != NULL);
+	KASSERT(slot < swap_nslots);
+
+	uio_kinit(&iov, &ku, (void *)PADDR_TO_KVADDR(pa), PAGE_SIZE,
+		  (off_t)slot * PAGE_SIZE, rw);
+	if (rw == UIO_READ) {
+		result = VOP_READ(swap_vnode, &ku);
+	}
+	else {
+		result = VOP_WRITE(swap_vnode, &ku);
+	}
+	if (result) {
+		return result;
+	}
+	if (ku.uio_resid != 0) {
+		return EIO;
+	}
+	return 0;
+}
+
+int
+swap_read(unsigned slot, paddr_t pa)
+{
+	int result;
+
+	result = swap_io(slot, pa, UIO_READ);
+	if (result == 0) {
+		vmstats_inc(VMSTAT_SWAP_FILE_READ);
+	}
+	return result;
+}
+
+/*
+ * Write some user page out to swap and free it.
+ */
+static
+int
+swap_evict(void)
+{
+	struct addrspace *as;
+	struct tlbshootdown ts;
+	vaddr_t vaddr;
+	paddr_t pa;
+	pte_t *pte;
+	unsigned slot;
+	bool locked;
+	int result;
+
+	if (swap_vnode == NULL) {
+		return ENOMEM;
+	}
+	result = swap_alloc(&slot);
+	if (result) {
+		return result;
+	}
+
+	pa = coremap_victim(&as, &vaddr, &locked);
+	if (pa == 0) {
+		swap_free(slot);
+		return ENOMEM;
+	}
+
+	pte = pt_lookup(as->as_pt, vaddr, false);
+	KASSERT(pte != NULL);
+	/* A lone page may still be marked COW until it faults again */
+	KASSERT((*pte & ~(pte_t)PTE_COW) == (pa | PTE_PRESENT));
+
+	ts.ts_addrspace = as;
+	ts.ts_vaddr = vaddr;
+	ipi_tlbshootdown_allcpus(&ts);
+
+	result = swap_io(slot, pa, UIO_WRITE);
+	coremap_unpin(pa);
+	if (result) {
+		/* Leave it where it was */
+		swap_free(slot);
+	}
+	else {
+		vmstats_inc(VMSTAT_SWAP_FILE_WRITE);
+		*pte = PTE_FROMSLOT(slot);
+		coremap_free(pa);
+	}
+
+	if (locked) {
+		lock_release(as->as_lock);
+	}
+	return result;
+}
+
+paddr_t
+swap_getpage(int state)
+{
+	paddr_t pa;
+
+	while ((pa = coremap_alloc(1, state)) == 0) {
+		if (curthread->t_in_interrupt || curthread->t_curspl > 0) {
+			/* Can't wait for the disk */
+			return 0;
+		}
+		if (swap_evict()) {
+			return 0;
+		}
+	}
+	return pa;
+}
@@ -0,0 +1,418 @@
+/*
+ * The paged VM system: page faults, kernel pages, and TLB handling.
+ *
+ * This is used instead of dumbvm when the dumbvm option is off. The
+ * address space side of it is in addrspace.c, and physical pages
+ * come from the coremap.
+ *
+ * A fault looks up the page in the current address space's page
+ * table, gives it a page if it has never been touched (read in from
+ * the executable, for the parts of it that are in the file, and
+ * zero-filled otherwise), and loads the mapping into the TLB. Pages in
+ * read-only regions are mapped without TLBLO_DIRTY, so writes to them
+ * fault as VM_FAULT_READONLY and fail.
+ *
+ * Pages shared copy-on-write after a fork (PTE_COW) are also mapped
+ * without TLBLO_DIRTY. A write to one gets the faulting process its
+ * own copy, or just the page itself if nobody else is left sharing it.
+ *
+ * When memory is full, pages come from evicting others to swap (see
+ * swap.c), and a fault on a page that was evicted reads it back in.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spl.h>
+#include <synch.h>
+#include <proc.h>
+#include <current.h>
+#include <uio.h>
+#include <vnode.h>
+#include <mips/tlb.h>
+#include <addrspace.h>
+#include <pagetable.h>
+#include <coremap.h>
+#include <swap.h>
+#include <vm.h>
+#include <uw-vmstats.h>
+
+void
+vm_bootstrap(void)
+{
+	coremap_bootstrap();
+	vmstats_init();
+}
+
+/* Allocate/free some kernel-space virtual pages */
+vaddr_t
+alloc_kpages(int npages)
+{
+	paddr_t pa;
+
+	if (npages == 1) {
+		pa = swap_getpage(CM_KERNEL);
+	}
+	else {
+		pa = coremap_alloc(npages, CM_KERNEL);
+	}
+	if (pa == 0) {
+		return 0;
+	}
+	return PADDR_TO_KVADDR(pa);
+}
+
+void
+free_kpages(vaddr_t addr)
+{
+	coremap_free(KVADDR_TO_PADDR(addr));
+}
+
+/*
+ * Load a mapping into this cpu's TLB, in a free slot if there is one.
+ * Replaces any mapping already there for the same page.
+ */
+static
+void
+vm_tlbload(vaddr_t vaddr, uint32_t elo)
+{
+	uint32_t ehi, oldehi, oldelo;
+	int i, spl;
+
+	ehi = vaddr & TLBHI_VPAGE;
+
+	/* Disable interrupts on this CPU while frobbing the TLB. */
+	spl = splhigh();
+
+	i = tlb_probe(ehi, 0);
+	if (i >= 0) {
+		tlb_write(ehi, elo, i);
+		vmstats_inc(VMSTAT_TLB_FAULT_FREE);
+		splx(spl);
+		return;
+	}
+	for (i=0; i<NUM_TLB; i++) {
+		tlb_read(&oldehi, &oldelo, i);
+		if (oldelo & TLBLO_VALID) {
+			continue;
+		}
+		tlb_write(ehi, elo, i);
+		vmstats_inc(VMSTAT_TLB_FAULT_FREE);
+		splx(spl);
+		return;
+	}
+	tlb_random(ehi, elo);
+	vmstats_inc(VMSTAT_TLB_FAULT_REPLACE);
+
+	splx(spl);
+}
+
+/*
+ * Fill in the new page at VADDR in region RG of AS, whose memory is
+ * at PA and whose PTE is PTE: from the file for whatever part of it
+ * the file covers, and with zeroes elsewhere. Call with as_lock held.
+ *
+ * The file system may sleep on its own locks while reading, and
+ * those may be held by someone who is waiting for our as_lock, so
+ * it's let go of around the read. The page is pinned and its PTE
+ * marked PTE_BUSY meanwhile, which keeps everyone else off it; they
+ * wait on as_busycv. On return the PTE is zero again, for the caller
+ * to fill in.
+ */
+static
+int
+vm_fillpage(struct addrspace *as, struct region *rg, pte_t *pte,
+	    vaddr_t vaddr, paddr_t pa)
+{
+	struct iovec iov;
+	struct uio ku;
+	vaddr_t start, end;
+	char *kva;
+	int result;
+
+	kva = (char *)PADDR_TO_KVADDR(pa);
+	bzero(kva, PAGE_SIZE);
+
+	start = vaddr;
+	end = vaddr + PAGE_SIZE;
+	if (rg->rg_vnode != NULL) {
+		if (start < rg->rg_filevaddr) {
+			start = rg->rg_filevaddr;
+		}
+		if (end > rg->rg_filevaddr + rg->rg_filesize) {
+			end = rg->rg_filevaddr + rg->rg_filesize;
+		}
+	}
+	if (rg->rg_vnode == NULL || start >= end) {
+		vmstats_inc(VMSTAT_PAGE_FAULT_ZERO);
+		return 0;
+	}
+
+	KASSERT(*pte == 0);
+	coremap_pin(pa);
+	*pte = pa | PTE_BUSY;
+	lock_release(as->as_lock);
+
+	/* RG can't go away: as_destroy waits for busy pages first */
+	uio_kinit(&iov, &ku, kva + (start - vaddr), end - start,
+		  rg->rg_fileoff + (start - rg->rg_filevaddr), UIO_READ);
+	result = VOP_READ(rg->rg_vnode, &ku);
+
+	lock_acquire(as->as_lock);
+	/* Nobody else touches a busy PTE */
+	KASSERT(*pte == (pa | PTE_BUSY));
+	*pte = 0;
+	coremap_unpin(pa);
+	cv_broadcast(as->as_busycv, as->as_lock);
+
+	if (result) {
+		return result;
+	}
+	if (ku.uio_resid != 0) {
+		/* short read; problem with executable? */
+		kprintf("vm: short read on segment - file truncated?\n");
+		return ENOEXEC;
+	}
+	vmstats_inc(VMSTAT_PAGE_FAULT_DISK);
+	vmstats_inc(VMSTAT_ELF_FILE_READ);
+	return 0;
+}
+
+/*
+ * Give AS its own copy of the copy-on-write page at PTE, which is
+ * mapped at VADDR.
+ */
+static
+int
+vm_unshare(struct addrspace *as, pte_t *pte, vaddr_t vaddr)
+{
+	paddr_t pa, oldpa;
+
+	oldpa = *pte & PTE_FRAME;
+	pa = swap_getpage(CM_USER);
+	if (pa == 0) {
+		return ENOMEM;
+	}
+	memmove((void *)PADDR_TO_KVADDR(pa),
+		(const void *)PADDR_TO_KVADDR(oldpa), PAGE_SIZE);
+	coremap_free(oldpa);
+	*pte = pa | PTE_PRESENT;
+	coremap_touch(pa, as, vaddr);
+	return 0;
+}
+
+/*
+ * Bring the page at PTE, mapped at VADDR in AS, back in from swap.
+ */
+static
+int
+vm_swapin(struct addrspace *as, pte_t *pte, vaddr_t vaddr)
+{
+	unsigned slot;
+	paddr_t pa;
+	int result;
+
+	KASSERT(*pte & PTE_SWAPPED);
+	slot = PTE_TOSLOT(*pte);
+
+	pa = swap_getpage(CM_USER);
+	if (pa == 0) {
+		return ENOMEM;
+	}
+	result = swap_read(slot, pa);
+	if (result) {
+		coremap_free(pa);
+		return result;
+	}
+	swap_free(slot);
+	*pte = pa | PTE_PRESENT;
+	coremap_touch(pa, as, vaddr);
+	return 0;
+}
+
+int
+vm_fault(int faulttype, vaddr_t faultaddress)
+{
+	struct addrspace *as;
+	struct region *rg;
+	pte_t *pte;
+	paddr_t pa;
+	uint32_t elo;
+	int result;
+
+	faultaddress &= PAGE_FRAME;
+
+	DEBUG(DB_VM, "vm: fault: 0x%x\n", faultaddress);
+
+	switch (faulttype) {
+	    case VM_FAULT_READONLY:
+	    case VM_FAULT_READ:
+	    case VM_FAULT_WRITE:
+		break;
+	    default:
+		return EINVAL;
+	}
+
+	if (curproc == NULL) {
+		/*
+		 * No process. This is probably a kernel fault early
+		 * in boot. Return EFAULT so as to panic instead of
+		 * getting into an infinite faulting loop.
+		 */
+		return EFAULT;
+	}
+
+	as = curproc_getas();
+	if (as == NULL) {
+		/*
+		 * No address space set up. This is probably also a
+		 * kernel fault early in boot.
+		 */
+		return EFAULT;
+	}
+
+	lock_acquire(as->as_lock);
+
+	rg = as_findregion(as, faultaddress);
+	if (rg == NULL) {
+		lock_release(as->as_lock);
+		return EFAULT;
+	}
+	if (faulttype != VM_FAULT_READ && !rg->rg_writeable &&
+	    !as->as_loading) {
+		/* Write to a read-only region */
+		lock_release(as->as_lock);
+		return EFAULT;
+	}
+
+	pte = pt_lookup(as->as_pt, faultaddress, true);
+	if (pte == NULL) {
+		lock_release(as->as_lock);
+		return ENOMEM;
+	}
+	while (*pte & PTE_BUSY) {
+		/* Someone else is reading it in */
+		cv_wait(as->as_busycv, as->as_lock);
+	}
+
+	vmstats_inc(VMSTAT_TLB_FAULT);
+	if (*pte & PTE_PRESENT) {
+		if (coremap_touch(*pte & PTE_FRAME, as, faultaddress)) {
+			/* The others have copied it or gone away */
+			*pte &= ~(pte_t)PTE_COW;
+		}
+		else if (faulttype != VM_FAULT_READ && (*pte & PTE_COW)) {
+			result = vm_unshare(as, pte, faultaddress);
+			if (result) {
+				lock_release(as->as_lock);
+				return result;
+			}
+		}
+		vmstats_inc(VMSTAT_TLB_RELOAD);
+	}
+	else if (*pte & PTE_SWAPPED) {
+		result = vm_swapin(as, pte, faultaddress);
+		if (result) {
+			lock_release(as->as_lock);
+			return result;
+		}
+		vmstats_inc(VMSTAT_PAGE_FAULT_DISK);
+	}
+	else {
+		/* First touch */
+		pa = swap_getpage(CM_USER);
+		if (pa == 0) {
+			lock_release(as->as_lock);
+			return ENOMEM;
+		}
+		result = vm_fillpage(as, rg, pte, faultaddress, pa);
+		if (result) {
+			coremap_free(pa);
+			lock_release(as->as_lock);
+			return result;
+		}
+		*pte = pa | PTE_PRESENT;
+		coremap_touch(pa, as, faultaddress);
+	}
+
+	elo = (*pte & PTE_FRAME) | TLBLO_VALID;
+	if ((*pte & PTE_COW) == 0 && (rg->rg_writeable || as->as_loading)) {
+		elo |= TLBLO_DIRTY;
+	}
+	DEBUG(DB_VM, "vm: 0x%x -> 0x%x\n", faultaddress, elo & TLBLO_PPAGE);
+	vm_tlbload(faultaddress, elo);
+
+	lock_release(as->as_lock);
+	return 0;
+}
+
+int
+vm_translate(struct addrspace *as, vaddr_t vaddr, paddr_t *ret)
+{
+	pte_t *pte;
+	int result;
+
+	if (vaddr >= USERSPACETOP) {
+		return EFAULT;
+	}
+
+	lock_acquire(as->as_lock);
+	pte = pt_lookup(as->as_pt, vaddr, false);
+	while (pte != NULL && (*pte & PTE_BUSY)) {
+		cv_wait(as->as_busycv, as->as_lock);
+	}
+	if (pte != NULL && (*pte & PTE_SWAPPED)) {
+		/* Evicted since the caller touched it */
+		result = vm_swapin(as, pte, vaddr & PAGE_FRAME);
+		if (result) {
+			lock_release(as->as_lock);
+			return result;
+		}
+	}
+	if (pte == NULL || (*pte & PTE_PRESENT) == 0) {
+		result = EFAULT;
+	}
+	else {
+		/* Pin it before the as_lock goes, so it can't be evicted */
+		coremap_pin(*pte & PTE_FRAME);
+		if (coremap_touch(*pte & PTE_FRAME, as, vaddr & PAGE_FRAME)) {
+			/* As in vm_fault: nobody else is sharing it now */
+			*pte &= ~(pte_t)PTE_COW;
+		}
+		*ret = (*pte & PTE_FRAME) | (vaddr & ~(vaddr_t)PAGE_FRAME);
+		result = 0;
+	}
+	lock_release(as->as_lock);
+	return result;
+}
+
+void
+vm_tlbshootdown_all(void)
+{
+	int i, spl;
+
+	/* Disable interrupts on this CPU while frobbing the TLB. */
+	spl = splhigh();
+	for (i=0; i<NUM_TLB; i++) {
+		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+	splx(spl);
+}
+
+void
+vm_tlbshootdown(const struct tlbshootdown *ts)
+{
+	int i, spl;
+
+	if (ts->ts_addrspace != curproc_getas()) {
+		/* Not loaded here; as_activate will flush it anyway */
+		return;
+	}
+
+	spl = splhigh();
+	i = tlb_probe(ts->ts_vaddr & TLBHI_VPAGE, 0);
+	if (i >= 0) {
+		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+	splx(spl);
+}
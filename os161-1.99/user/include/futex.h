@@ -0,0 +1,44 @@
+/*
+ * User-level mutexes and condition variables.
+ *
+ * These keep their state in an int in user memory and only enter the
+ * kernel (futex_wait/futex_wake, see <unistd.h>) when a thread has to
+ * block or when some thread is blocked. Taking and releasing a free
+ * mutex makes no system call.
+ */
+
+#ifndef _FUTEX_H_
+#define _FUTEX_H_
+
+/*
+ * Mutex. um_state is 0 when free, 1 when held, and 2 when held and
+ * there may be threads waiting for it.
+ */
+struct umutex {
+	volatile int um_state;
+};
+
+#define UMUTEX_INITIALIZER	{ 0 }
+
+void umutex_init(struct umutex *mx);
+void umutex_lock(struct umutex *mx);
+int umutex_trylock(struct umutex *mx);		/* 0 on success */
+void umutex_unlock(struct umutex *mx);
+
+/*
+ * Condition variable. uc_seq changes on every signal or broadcast, so
+ * a waiter that saw the old value and then went to sleep will not
+ * miss a wakeup that happened in between.
+ */
+struct ucond {
+	volatile int uc_seq;
+};
+
+#define UCOND_INITIALIZER	{ 0 }
+
+void ucond_init(struct ucond *cv);
+void ucond_wait(struct ucond *cv, struct umutex *mx);
+void ucond_signal(struct ucond *cv);
+void ucond_broadcast(struct ucond *cv);
+
+#endif /* _FUTEX_H_ */
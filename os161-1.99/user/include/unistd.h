@@ -154,6 +154,8 @@ int dup2(int filehandle, int newhandle);
 int pipe(int filehandles[2]);
 time_t __time(time_t *seconds, unsigned long *nanoseconds);
 int __getcwd(char *buf, size_t buflen);
+int futex_wait(volatile int *addr, int expected);
+int futex_wake(volatile int *addr, int count);
 /* stat - see sys/stat.h */
 /* lstat - see sys/stat.h */
 
@@ -0,0 +1,178 @@
+/*
+ * User-level mutexes and condition variables on top of futex_wait
+ * and futex_wake. See <futex.h>.
+ *
+ * The mutex is the usual three-state futex mutex: 0 free, 1 held, 2
+ * held with (possible) waiters. Only a lock that finds it held, or an
+ * unlock that finds it in state 2, makes a system call.
+ */
+
+#include <unistd.h>
+#include <futex.h>
+
+/* Wake everyone; more threads than this can't be waiting. */
+#define UCOND_WAKEALL	0x7fffffff
+
+/*
+ * Atomic operations using LL/SC.
+ */
+
+/* If *P is OLD, set it to NEW. Returns what *P was. */
+static
+int
+atomic_cas(volatile int *p, int old, int new)
+{
+	int x, y;
+
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 instructions */
+		".set noreorder;"	/* we fill the delay slots */
+		"1: ll %0, 0(%2);"	/*   x = *p */
+		"bne %0, %3, 2f;"	/*   if (x != old) give up */
+		" move %1, %4;"		/*   y = new (delay slot) */
+		"sc %1, 0(%2);"		/*   *p = y; y = success? */
+		"beqz %1, 1b;"		/*   retry if the sc failed */
+		" nop;"
+		"2: .set pop"		/* restore assembler mode */
+		: "=&r" (x), "=&r" (y) : "r" (p), "r" (old), "r" (new)
+		: "memory");
+	return x;
+}
+
+/* Set *P to NEW. Returns what *P was. */
+static
+int
+atomic_swap(volatile int *p, int new)
+{
+	int x, y;
+
+	do {
+		__asm volatile(
+			".set push;"		/* save assembler mode */
+			".set mips32;"		/* allow MIPS32 instructions */
+			".set volatile;"	/* avoid unwanted optimization */
+			"ll %0, 0(%2);"		/*   x = *p */
+			"move %1, %3;"		/*   y = new */
+			"sc %1, 0(%2);"		/*   *p = y; y = success? */
+			".set pop"		/* restore assembler mode */
+			: "=&r" (x), "=&r" (y) : "r" (p), "r" (new)
+			: "memory");
+	} while (y == 0);
+	return x;
+}
+
+/* Add VAL to *P. */
+static
+void
+atomic_add(volatile int *p, int val)
+{
+	int x, y;
+
+	do {
+		__asm volatile(
+			".set push;"		/* save assembler mode */
+			".set mips32;"		/* allow MIPS32 instructions */
+			".set volatile;"	/* avoid unwanted optimization */
+			"ll %0, 0(%2);"		/*   x = *p */
+			"addu %1, %0, %3;"	/*   y = x + val */
+			"sc %1, 0(%2);"		/*   *p = y; y = success? */
+			".set pop"		/* restore assembler mode */
+			: "=&r" (x), "=&r" (y) : "r" (p), "r" (val)
+			: "memory");
+	} while (y == 0);
+}
+
+////////////////////////////////////////////////////////////
+// mutex
+
+void
+umutex_init(struct umutex *mx)
+{
+	mx->um_state = 0;
+}
+
+int
+umutex_trylock(struct umutex *mx)
+{
+	return atomic_cas(&mx->um_state, 0, 1) == 0 ? 0 : -1;
+}
+
+void
+umutex_lock(struct umutex *mx)
+{
+	int c;
+
+	c = atomic_cas(&mx->um_state, 0, 1);
+	if (c == 0) {
+		/* Fast path: it was free. */
+		return;
+	}
+
+	/*
+	 * Mark it contended and sleep until we get it. Once we've set
+	 * state 2 we must leave it at 2 when we do get the lock, since
+	 * we can't tell whether anyone else is still waiting.
+	 */
+	if (c != 2) {
+		c = atomic_swap(&mx->um_state, 2);
+	}
+	while (c != 0) {
+		futex_wait(&mx->um_state, 2);
+		c = atomic_swap(&mx->um_state, 2);
+	}
+}
+
+void
+umutex_unlock(struct umutex *mx)
+{
+	if (atomic_swap(&mx->um_state, 0) == 2) {
+		/* Someone may be asleep; wake one of them. */
+		futex_wake(&mx->um_state, 1);
+	}
+}
+
+////////////////////////////////////////////////////////////
+// condition variable
+
+void
+ucond_init(struct ucond *cv)
+{
+	cv->uc_seq = 0;
+}
+
+void
+ucond_wait(struct ucond *cv, struct umutex *mx)
+{
+	int seq, c;
+
+	seq = cv->uc_seq;
+	umutex_unlock(mx);
+
+	/* Returns at once if a signal already changed uc_seq. */
+	futex_wait(&cv->uc_seq, seq);
+
+	/*
+	 * Reacquire the mutex in the contended state: after a
+	 * broadcast the other waiters are likely to be queued on it.
+	 */
+	c = atomic_swap(&mx->um_state, 2);
+	while (c != 0) {
+		futex_wait(&mx->um_state, 2);
+		c = atomic_swap(&mx->um_state, 2);
+	}
+}
+
+void
+ucond_signal(struct ucond *cv)
+{
+	atomic_add(&cv->uc_seq, 1);
+	futex_wake(&cv->uc_seq, 1);
+}
+
+void
+ucond_broadcast(struct ucond *cv)
+{
+	atomic_add(&cv->uc_seq, 1);
+	futex_wake(&cv->uc_seq, UCOND_WAKEALL);
+}
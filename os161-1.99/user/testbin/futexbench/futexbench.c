@@ -0,0 +1,113 @@
+/*
+ * futexbench - compare futex-based user synchronization with going
+ * through the kernel.
+ *
+ * Times, per operation:
+ *    - lock+unlock of an uncontended user mutex (no system call);
+ *    - futex_wake with nobody waiting (one system call);
+ *    - futex_wait on a stale value (one system call, returns EAGAIN);
+ *    - getpid, as the cheapest possible system call;
+ *    - a one-byte pipe write+read round trip, if pipes work.
+ *
+ * OS/161 processes don't share memory, so there's nothing to contend
+ * with here; the point is what the uncontended path saves over a
+ * kernel round trip.
+ */
+
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <err.h>
+#include <futex.h>
+
+#define NITERS	20000
+
+static struct umutex mx = UMUTEX_INITIALIZER;
+static volatile int word;
+
+static time_t startsecs;
+static unsigned long startnsecs;
+
+static
+void
+starttimer(void)
+{
+	__time(&startsecs, &startnsecs);
+}
+
+/* Print the time per iteration since starttimer. */
+static
+void
+stoptimer(const char *what, unsigned niters)
+{
+	time_t secs;
+	unsigned long nsecs;
+	unsigned long long total;
+
+	__time(&secs, &nsecs);
+	total = (unsigned long long)(secs - startsecs) * 1000000000ULL;
+	total = total + nsecs - startnsecs;
+	printf("%-32s %8lu ns/op\n", what,
+	       (unsigned long)(total / niters));
+}
+
+int
+main(void)
+{
+	int fds[2];
+	char ch;
+	unsigned i;
+
+	printf("futexbench: %u iterations each\n", NITERS);
+
+	starttimer();
+	for (i=0; i<NITERS; i++) {
+		umutex_lock(&mx);
+		umutex_unlock(&mx);
+	}
+	stoptimer("umutex lock+unlock", NITERS);
+
+	starttimer();
+	for (i=0; i<NITERS; i++) {
+		if (futex_wake(&word, 1) < 0) {
+			err(1, "futex_wake");
+		}
+	}
+	stoptimer("futex_wake, no waiters", NITERS);
+
+	word = 1;
+	if (futex_wait(&word, 0) == 0 || errno != EAGAIN) {
+		errx(1, "futex_wait on a stale value didn't fail with EAGAIN");
+	}
+	starttimer();
+	for (i=0; i<NITERS; i++) {
+		futex_wait(&word, 0);
+	}
+	stoptimer("futex_wait, stale value", NITERS);
+
+	starttimer();
+	for (i=0; i<NITERS; i++) {
+		getpid();
+	}
+	stoptimer("getpid", NITERS);
+
+	if (pipe(fds) < 0) {
+		warn("pipe");
+		printf("%-32s  skipped\n", "pipe round trip");
+	}
+	else {
+		ch = 'x';
+		starttimer();
+		for (i=0; i<NITERS; i++) {
+			if (write(fds[1], &ch, 1) != 1 ||
+			    read(fds[0], &ch, 1) != 1) {
+				err(1, "pipe round trip");
+			}
+		}
+		stoptimer("pipe round trip", NITERS);
+		close(fds[0]);
+		close(fds[1]);
+	}
+
+	return 0;
+}